@@ -0,0 +1,287 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "arbiter.h"
+#include "gstnxvideodec.h"
+
+#define	NX_VPU_SLOTS_DEFAULT		1
+// a key frame may overtake others only while its client is less than
+// this much virtual time (usec at default weight) ahead of them
+#define	NX_VPU_KEY_BOOST			100000
+
+typedef struct _NX_VPU_REQUEST NX_VPU_REQUEST;
+
+struct _NX_VPU_REQUEST
+{
+	NX_VPU_CLIENT *pClient;
+	gboolean bKeyFrame;
+	guint64 seq;
+};
+
+struct _NX_VPU_CLIENT
+{
+	gint refCount;
+	gint weight;
+	gint maxInFlight;				// 0 = no limit
+	gint inFlight;
+	gint waiting;
+	guint64 vtime;					// virtual start time of the next request
+	NX_VPU_STATS stats;
+};
+
+typedef struct
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	gint slots;
+	gint busy;
+	guint64 vclock;					// virtual time of the last granted request
+	guint64 seq;
+	GList *pWaitList;				// NX_VPU_REQUEST
+} NX_VPU_ARBITER;
+
+static NX_VPU_ARBITER gstArbiter = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	-1,
+};
+
+// caller holds gstArbiter.mutex
+static void ArbiterLoadConfig( void )
+{
+	const gchar *pEnv;
+
+	if( 0 <= gstArbiter.slots )
+		return;
+
+	gstArbiter.slots = NX_VPU_SLOTS_DEFAULT;
+	pEnv = g_getenv( "NX_VPU_ARBITER_SLOTS" );
+	if( pEnv && *pEnv )
+	{
+		gstArbiter.slots = CLAMP( atoi(pEnv), 0, NX_VPU_MAX_INFLIGHT );
+	}
+	GST_INFO( "VPU arbiter: %d slot(s)", gstArbiter.slots );
+}
+
+// caller holds gstArbiter.mutex
+static NX_VPU_REQUEST *ArbiterPickNext( void )
+{
+	NX_VPU_REQUEST *pBest = NULL;
+	guint64 minVtime = G_MAXUINT64;
+	GList *pList;
+
+	if( gstArbiter.busy >= gstArbiter.slots )
+		return NULL;
+
+	for( pList = gstArbiter.pWaitList ; pList ; pList = pList->next )
+	{
+		NX_VPU_REQUEST *pReq = pList->data;
+		if( pReq->pClient->vtime < minVtime )
+			minVtime = pReq->pClient->vtime;
+	}
+
+	for( pList = gstArbiter.pWaitList ; pList ; pList = pList->next )
+	{
+		NX_VPU_REQUEST *pReq = pList->data;
+		NX_VPU_CLIENT *pClient = pReq->pClient;
+		gboolean bBoost;
+
+		if( pClient->maxInFlight > 0 && pClient->inFlight >= pClient->maxInFlight )
+			continue;
+
+		bBoost = pReq->bKeyFrame && (pClient->vtime - minVtime < NX_VPU_KEY_BOOST);
+
+		if( NULL == pBest )
+		{
+			pBest = pReq;
+			continue;
+		}
+
+		{
+			gboolean bBestBoost = pBest->bKeyFrame && (pBest->pClient->vtime - minVtime < NX_VPU_KEY_BOOST);
+
+			if( bBoost != bBestBoost )
+			{
+				if( bBoost )
+					pBest = pReq;
+				continue;
+			}
+
+			if( (pClient->vtime < pBest->pClient->vtime) ||
+				(pClient->vtime == pBest->pClient->vtime && pReq->seq < pBest->seq) )
+			{
+				pBest = pReq;
+			}
+		}
+	}
+
+	return pBest;
+}
+
+NX_VPU_CLIENT *VpuArbiterRegister( gint weight, gint maxInFlight )
+{
+	NX_VPU_CLIENT *pClient = (NX_VPU_CLIENT *)g_malloc( sizeof(NX_VPU_CLIENT) );
+
+	memset( pClient, 0, sizeof(NX_VPU_CLIENT) );
+	pClient->refCount = 1;
+	pClient->weight = CLAMP( weight, 1, NX_VPU_WEIGHT_MAX );
+	pClient->maxInFlight = CLAMP( maxInFlight, 0, NX_VPU_MAX_INFLIGHT );
+
+	pthread_mutex_lock( &gstArbiter.mutex );
+	ArbiterLoadConfig();
+	// start at the current virtual clock so a new channel does not get
+	// credit for the time it was not running
+	pClient->vtime = gstArbiter.vclock;
+	pthread_mutex_unlock( &gstArbiter.mutex );
+
+	return pClient;
+}
+
+NX_VPU_CLIENT *VpuArbiterRef( NX_VPU_CLIENT *pClient )
+{
+	pthread_mutex_lock( &gstArbiter.mutex );
+	pClient->refCount++;
+	pthread_mutex_unlock( &gstArbiter.mutex );
+
+	return pClient;
+}
+
+void VpuArbiterUnregister( NX_VPU_CLIENT *pClient )
+{
+	gint refCount;
+
+	if( NULL == pClient )
+		return;
+
+	pthread_mutex_lock( &gstArbiter.mutex );
+	refCount = --pClient->refCount;
+	pthread_mutex_unlock( &gstArbiter.mutex );
+
+	// the last owner guarantees there is no call in progress
+	if( 0 == refCount )
+		g_free( pClient );
+}
+
+gint VpuArbiterGetSlots( void )
+{
+	gint slots;
+
+	pthread_mutex_lock( &gstArbiter.mutex );
+	ArbiterLoadConfig();
+	slots = gstArbiter.slots;
+	pthread_mutex_unlock( &gstArbiter.mutex );
+
+	return slots;
+}
+
+void VpuArbiterSetWeight( NX_VPU_CLIENT *pClient, gint weight )
+{
+	pthread_mutex_lock( &gstArbiter.mutex );
+	pClient->weight = CLAMP( weight, 1, NX_VPU_WEIGHT_MAX );
+	pthread_mutex_unlock( &gstArbiter.mutex );
+}
+
+void VpuArbiterSetMaxInFlight( NX_VPU_CLIENT *pClient, gint maxInFlight )
+{
+	pthread_mutex_lock( &gstArbiter.mutex );
+	pClient->maxInFlight = CLAMP( maxInFlight, 0, NX_VPU_MAX_INFLIGHT );
+	pthread_cond_broadcast( &gstArbiter.cond );
+	pthread_mutex_unlock( &gstArbiter.mutex );
+}
+
+//
+//	Returns when the call may enter the hardware, with the time it did;
+//	the caller hands that back to VpuArbiterRelease(), the calls of a
+//	shared client do not finish in the order they started.
+//
+gint64 VpuArbiterAcquire( NX_VPU_CLIENT *pClient, gboolean bKeyFrame )
+{
+	NX_VPU_REQUEST req;
+	gint64 waitStart;
+	gint64 startTime;
+	guint64 waitTime;
+
+	if( NULL == pClient )
+		return 0;
+
+	waitStart = g_get_monotonic_time();
+
+	pthread_mutex_lock( &gstArbiter.mutex );
+
+	// an idle client restarts at the current virtual clock
+	if( 0 == pClient->inFlight && 0 == pClient->waiting && pClient->vtime < gstArbiter.vclock )
+		pClient->vtime = gstArbiter.vclock;
+
+	if( 0 < gstArbiter.slots )
+	{
+		req.pClient = pClient;
+		req.bKeyFrame = bKeyFrame;
+		req.seq = gstArbiter.seq++;
+		gstArbiter.pWaitList = g_list_append( gstArbiter.pWaitList, &req );
+		pClient->waiting++;
+
+		while( ArbiterPickNext() != &req )
+		{
+			pthread_cond_wait( &gstArbiter.cond, &gstArbiter.mutex );
+		}
+
+		gstArbiter.pWaitList = g_list_remove( gstArbiter.pWaitList, &req );
+		pClient->waiting--;
+		gstArbiter.busy++;
+		if( pClient->vtime > gstArbiter.vclock )
+			gstArbiter.vclock = pClient->vtime;
+	}
+
+	startTime = g_get_monotonic_time();
+	pClient->inFlight++;
+
+	waitTime = startTime - waitStart;
+	pClient->stats.decodeCount++;
+	if( bKeyFrame )
+		pClient->stats.keyCount++;
+	pClient->stats.waitTime += waitTime;
+	if( waitTime > pClient->stats.maxWaitTime )
+		pClient->stats.maxWaitTime = waitTime;
+
+	// other waiters may have become eligible (e.g. a different client
+	// while this one reached its in-flight cap)
+	pthread_cond_broadcast( &gstArbiter.cond );
+	pthread_mutex_unlock( &gstArbiter.mutex );
+
+	return startTime;
+}
+
+void VpuArbiterRelease( NX_VPU_CLIENT *pClient, gint64 startTime )
+{
+	guint64 elapsed;
+
+	if( NULL == pClient )
+		return;
+
+	elapsed = g_get_monotonic_time() - startTime;
+
+	pthread_mutex_lock( &gstArbiter.mutex );
+
+	pClient->inFlight--;
+	pClient->stats.busyTime += elapsed;
+	pClient->vtime += elapsed * NX_VPU_WEIGHT_DEFAULT / pClient->weight;
+
+	if( 0 < gstArbiter.slots )
+		gstArbiter.busy--;
+
+	pthread_cond_broadcast( &gstArbiter.cond );
+	pthread_mutex_unlock( &gstArbiter.mutex );
+}
+
+void VpuArbiterGetStats( NX_VPU_CLIENT *pClient, NX_VPU_STATS *pStats )
+{
+	pthread_mutex_lock( &gstArbiter.mutex );
+	*pStats = pClient->stats;
+	pStats->weight = pClient->weight;
+	pStats->maxInFlight = pClient->maxInFlight;
+	pthread_mutex_unlock( &gstArbiter.mutex );
+}
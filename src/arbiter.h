@@ -0,0 +1,59 @@
+#include <gst/gst.h>
+#include <pthread.h>
+
+#ifndef __ARBITER_H__
+#define __ARBITER_H__
+
+G_BEGIN_DECLS
+
+#define	NX_VPU_WEIGHT_DEFAULT		100
+#define	NX_VPU_WEIGHT_MAX			10000
+#define	NX_VPU_MAX_INFLIGHT			16
+
+typedef struct _NX_VPU_CLIENT NX_VPU_CLIENT;
+typedef struct _NX_VPU_STATS NX_VPU_STATS;
+
+struct _NX_VPU_STATS
+{
+	gint weight;
+	gint maxInFlight;
+	guint64 decodeCount;			// hardware calls granted
+	guint64 keyCount;				// ... of which were key frames
+	guint64 busyTime;				// usec spent inside the hardware call
+	guint64 waitTime;				// usec spent waiting for the arbiter
+	guint64 maxWaitTime;			// worst single wait (usec)
+};
+
+//
+//	Process-wide VPU arbiter.
+//
+//	Every decoder instance registers a client and brackets each hardware
+//	decode call with VpuArbiterAcquire()/VpuArbiterRelease(). Requests are
+//	granted in start-time fair queueing order: each client carries a
+//	virtual time which advances by (hardware time / weight), and the
+//	waiting request of the client with the smallest virtual time goes
+//	next. Key frames jump the queue as long as their client is not too far
+//	ahead of the others, and a client never has more than maxInFlight
+//	calls inside the hardware.
+//
+//	The hardware instances GOP-parallel decoding opens for one element
+//	share its client (VpuArbiterRef()), so together they get the share of
+//	a single channel, and maxInFlight caps how many of their calls run at
+//	once. A client with a single instance never has more than one.
+//
+//	The number of concurrent hardware calls in the process is read from
+//	NX_VPU_ARBITER_SLOTS (default 1, 0 disables arbitration).
+//
+NX_VPU_CLIENT *VpuArbiterRegister( gint weight, gint maxInFlight );
+NX_VPU_CLIENT *VpuArbiterRef( NX_VPU_CLIENT *pClient );
+gint VpuArbiterGetSlots( void );
+void VpuArbiterUnregister( NX_VPU_CLIENT *pClient );
+void VpuArbiterSetWeight( NX_VPU_CLIENT *pClient, gint weight );
+void VpuArbiterSetMaxInFlight( NX_VPU_CLIENT *pClient, gint maxInFlight );
+gint64 VpuArbiterAcquire( NX_VPU_CLIENT *pClient, gboolean bKeyFrame );
+void VpuArbiterRelease( NX_VPU_CLIENT *pClient, gint64 startTime );
+void VpuArbiterGetStats( NX_VPU_CLIENT *pClient, NX_VPU_STATS *pStats );
+
+G_END_DECLS
+
+#endif //__ARBITER_H__
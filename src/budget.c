@@ -0,0 +1,120 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "budget.h"
+#include "gstnxvideodec.h"
+
+static pthread_mutex_t gstBudgetMutex = PTHREAD_MUTEX_INITIALIZER;
+static gboolean gbBudgetLoaded = FALSE;
+static guint64 gstBudgetLimit = 0;
+static guint64 gstBudgetUsed = 0;
+
+static guint64 ParseSize( const gchar *pStr )
+{
+	gchar *pEnd = NULL;
+	guint64 size = g_ascii_strtoull( pStr, &pEnd, 10 );
+
+	switch( *pEnd )
+	{
+		case 'g': case 'G':
+			size <<= 10;
+			/* fall through */
+		case 'm': case 'M':
+			size <<= 10;
+			/* fall through */
+		case 'k': case 'K':
+			size <<= 10;
+			break;
+		default:
+			break;
+	}
+
+	return size;
+}
+
+// caller holds gstBudgetMutex
+static void BudgetLoadConfig( void )
+{
+	const gchar *pEnv;
+
+	if( gbBudgetLoaded )
+		return;
+
+	gbBudgetLoaded = TRUE;
+	pEnv = g_getenv( "NX_VDEC_MEMORY_BUDGET" );
+	if( pEnv && *pEnv )
+	{
+		gstBudgetLimit = ParseSize( pEnv );
+		GST_INFO( "decoder memory budget: %" G_GUINT64_FORMAT " bytes", gstBudgetLimit );
+	}
+}
+
+void MemBudgetSetLimit( guint64 limit )
+{
+	pthread_mutex_lock( &gstBudgetMutex );
+	gbBudgetLoaded = TRUE;
+	gstBudgetLimit = limit;
+	if( limit && gstBudgetUsed > limit )
+	{
+		// existing reservations are kept, only new ones are refused
+		GST_WARNING( "memory budget %" G_GUINT64_FORMAT " is below current use %" G_GUINT64_FORMAT,
+			limit, gstBudgetUsed );
+	}
+	pthread_mutex_unlock( &gstBudgetMutex );
+}
+
+guint64 MemBudgetGetLimit( void )
+{
+	guint64 limit;
+
+	pthread_mutex_lock( &gstBudgetMutex );
+	BudgetLoadConfig();
+	limit = gstBudgetLimit;
+	pthread_mutex_unlock( &gstBudgetMutex );
+
+	return limit;
+}
+
+guint64 MemBudgetGetUsed( void )
+{
+	guint64 used;
+
+	pthread_mutex_lock( &gstBudgetMutex );
+	used = gstBudgetUsed;
+	pthread_mutex_unlock( &gstBudgetMutex );
+
+	return used;
+}
+
+gboolean MemBudgetReserve( guint64 size )
+{
+	gboolean bRet = TRUE;
+
+	pthread_mutex_lock( &gstBudgetMutex );
+	BudgetLoadConfig();
+
+	if( gstBudgetLimit && (gstBudgetUsed + size > gstBudgetLimit) )
+	{
+		bRet = FALSE;
+	}
+	else
+	{
+		gstBudgetUsed += size;
+	}
+
+	pthread_mutex_unlock( &gstBudgetMutex );
+
+	return bRet;
+}
+
+void MemBudgetRelease( guint64 size )
+{
+	pthread_mutex_lock( &gstBudgetMutex );
+	gstBudgetUsed = (size > gstBudgetUsed) ? 0 : (gstBudgetUsed - size);
+	pthread_mutex_unlock( &gstBudgetMutex );
+}
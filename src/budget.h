@@ -0,0 +1,32 @@
+#include <gst/gst.h>
+
+#ifndef __BUDGET_H__
+#define __BUDGET_H__
+
+G_BEGIN_DECLS
+
+enum
+{
+	NX_BUDGET_POLICY_REFUSE		= 0,	// fail the new stream
+	NX_BUDGET_POLICY_DOWNGRADE	= 1,	// retry with fewer output buffers first
+};
+
+//
+//	Process-wide decoder memory budget.
+//
+//	Every instance reserves its staging buffer and capture frames here
+//	before the hardware allocates them, so the stream which does not fit
+//	is rejected cleanly instead of running the CMA pool dry for everybody.
+//	The limit comes from the memory-budget property or, until somebody
+//	sets that, from NX_VDEC_MEMORY_BUDGET (bytes, K/M/G suffix allowed).
+//	A limit of 0 means unlimited.
+//
+void MemBudgetSetLimit( guint64 limit );
+guint64 MemBudgetGetLimit( void );
+guint64 MemBudgetGetUsed( void );
+gboolean MemBudgetReserve( guint64 size );
+void MemBudgetRelease( guint64 size );
+
+G_END_DECLS
+
+#endif //__BUDGET_H__
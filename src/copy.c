@@ -0,0 +1,786 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define	NX_COPY_X86
+#endif
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define	NX_COPY_NEON
+#endif
+
+#include "copy.h"
+
+#define	PREFETCH_DIST		512		// bytes ahead of the row being copied
+
+// adds one source row to the 16 bit row sums of the downscaler
+typedef void (*NX_ACCUM_ROW_FUNC)( guint16 *pAcc, const guint8 *pSrc, gint width );
+// rounded average of two rows, for the de-interlacer
+typedef void (*NX_AVG_ROW_FUNC)( guint8 *pDst, const guint8 *pA, const guint8 *pB, gint width );
+
+typedef struct
+{
+	const gchar *pName;
+	NX_COPY_PLANE_FUNC func;
+	NX_ACCUM_ROW_FUNC accum;
+	NX_AVG_ROW_FUNC avg;
+} NX_COPY_KERNEL;
+
+typedef struct
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	gint pending;
+} NX_COPY_BATCH;
+
+typedef struct
+{
+	NX_COPY_PLANE band;				// whole plane when rows are filtered
+	gint y0, y1;					// destination rows of a scaled or de-interlaced band
+	NX_COPY_BATCH *pBatch;
+	NX_THREAD_ATTR threadAttr;		// the caller's, for the helper thread
+} NX_COPY_JOB;
+
+static NX_COPY_KERNEL gstCopyKernel = { NULL, NULL, NULL, NULL };
+
+static pthread_mutex_t gstCopyPoolMutex = PTHREAD_MUTEX_INITIALIZER;
+static GThreadPool *gpCopyPool = NULL;
+static gint gstCopyThreads = NX_COPY_THREADS_AUTO;
+static guint gstCopyMinSize = NX_COPY_MIN_SIZE_DEFAULT;
+
+// scheduling attributes last applied on this helper thread
+static __thread guint gTlsAttrSerial = 0;
+
+static void CopyPlaneC( guint8 *pDst, gint dstStride, const guint8 *pSrc, gint srcStride, gint width, gint height )
+{
+	gint y;
+
+	if( (width == dstStride) && (width == srcStride) )
+	{
+		memcpy( pDst, pSrc, (gsize)width * height );
+		return;
+	}
+
+	for( y=0 ; y<height ; y++ )
+	{
+		memcpy( pDst, pSrc, width );
+		pSrc += srcStride;
+		pDst += dstStride;
+	}
+}
+
+static void AccumRowC( guint16 *pAcc, const guint8 *pSrc, gint width )
+{
+	gint x;
+
+	for( x=0 ; x<width ; x++ )
+	{
+		pAcc[x] += pSrc[x];
+	}
+}
+
+static void AvgRowC( guint8 *pDst, const guint8 *pA, const guint8 *pB, gint width )
+{
+	gint x;
+
+	for( x=0 ; x<width ; x++ )
+	{
+		pDst[x] = (guint8)((pA[x] + pB[x] + 1) >> 1);
+	}
+}
+
+#ifdef NX_COPY_X86
+//
+//	A decoded frame is not read back by this CPU before downstream touches
+//	it, so the stores bypass the cache. Stream stores need an aligned
+//	destination: the head of every row is copied bytewise up to that.
+//
+__attribute__((target("sse2")))
+static void CopyPlaneSse2( guint8 *pDst, gint dstStride, const guint8 *pSrc, gint srcStride, gint width, gint height )
+{
+	gint x, y;
+
+	for( y=0 ; y<height ; y++ )
+	{
+		x = 0;
+		while( (x < width) && ((guintptr)(pDst + x) & 15) )
+		{
+			pDst[x] = pSrc[x];
+			x++;
+		}
+
+		for( ; x + 64 <= width ; x += 64 )
+		{
+			__m128i v0, v1, v2, v3;
+
+			_mm_prefetch( (const char *)(pSrc + x + PREFETCH_DIST), _MM_HINT_NTA );
+			v0 = _mm_loadu_si128( (const __m128i *)(pSrc + x) );
+			v1 = _mm_loadu_si128( (const __m128i *)(pSrc + x + 16) );
+			v2 = _mm_loadu_si128( (const __m128i *)(pSrc + x + 32) );
+			v3 = _mm_loadu_si128( (const __m128i *)(pSrc + x + 48) );
+			_mm_stream_si128( (__m128i *)(pDst + x), v0 );
+			_mm_stream_si128( (__m128i *)(pDst + x + 16), v1 );
+			_mm_stream_si128( (__m128i *)(pDst + x + 32), v2 );
+			_mm_stream_si128( (__m128i *)(pDst + x + 48), v3 );
+		}
+
+		for( ; x + 16 <= width ; x += 16 )
+		{
+			_mm_stream_si128( (__m128i *)(pDst + x), _mm_loadu_si128( (const __m128i *)(pSrc + x) ) );
+		}
+
+		if( x < width )
+		{
+			memcpy( pDst + x, pSrc + x, width - x );
+		}
+
+		pSrc += srcStride;
+		pDst += dstStride;
+	}
+
+	_mm_sfence();
+}
+
+__attribute__((target("sse2")))
+static void AccumRowSse2( guint16 *pAcc, const guint8 *pSrc, gint width )
+{
+	const __m128i zero = _mm_setzero_si128();
+	gint x;
+
+	for( x=0 ; x + 16 <= width ; x += 16 )
+	{
+		__m128i v = _mm_loadu_si128( (const __m128i *)(pSrc + x) );
+		__m128i a0 = _mm_loadu_si128( (const __m128i *)(pAcc + x) );
+		__m128i a1 = _mm_loadu_si128( (const __m128i *)(pAcc + x + 8) );
+
+		_mm_storeu_si128( (__m128i *)(pAcc + x), _mm_add_epi16( a0, _mm_unpacklo_epi8( v, zero ) ) );
+		_mm_storeu_si128( (__m128i *)(pAcc + x + 8), _mm_add_epi16( a1, _mm_unpackhi_epi8( v, zero ) ) );
+	}
+
+	AccumRowC( pAcc + x, pSrc + x, width - x );
+}
+
+__attribute__((target("sse2")))
+static void AvgRowSse2( guint8 *pDst, const guint8 *pA, const guint8 *pB, gint width )
+{
+	gint x;
+
+	for( x=0 ; x + 16 <= width ; x += 16 )
+	{
+		_mm_storeu_si128( (__m128i *)(pDst + x), _mm_avg_epu8( _mm_loadu_si128( (const __m128i *)(pA + x) ),
+			_mm_loadu_si128( (const __m128i *)(pB + x) ) ) );
+	}
+
+	AvgRowC( pDst + x, pA + x, pB + x, width - x );
+}
+
+__attribute__((target("avx2")))
+static void CopyPlaneAvx2( guint8 *pDst, gint dstStride, const guint8 *pSrc, gint srcStride, gint width, gint height )
+{
+	gint x, y;
+
+	for( y=0 ; y<height ; y++ )
+	{
+		x = 0;
+		while( (x < width) && ((guintptr)(pDst + x) & 31) )
+		{
+			pDst[x] = pSrc[x];
+			x++;
+		}
+
+		for( ; x + 128 <= width ; x += 128 )
+		{
+			__m256i v0, v1, v2, v3;
+
+			_mm_prefetch( (const char *)(pSrc + x + PREFETCH_DIST), _MM_HINT_NTA );
+			_mm_prefetch( (const char *)(pSrc + x + PREFETCH_DIST + 64), _MM_HINT_NTA );
+			v0 = _mm256_loadu_si256( (const __m256i *)(pSrc + x) );
+			v1 = _mm256_loadu_si256( (const __m256i *)(pSrc + x + 32) );
+			v2 = _mm256_loadu_si256( (const __m256i *)(pSrc + x + 64) );
+			v3 = _mm256_loadu_si256( (const __m256i *)(pSrc + x + 96) );
+			_mm256_stream_si256( (__m256i *)(pDst + x), v0 );
+			_mm256_stream_si256( (__m256i *)(pDst + x + 32), v1 );
+			_mm256_stream_si256( (__m256i *)(pDst + x + 64), v2 );
+			_mm256_stream_si256( (__m256i *)(pDst + x + 96), v3 );
+		}
+
+		for( ; x + 32 <= width ; x += 32 )
+		{
+			_mm256_stream_si256( (__m256i *)(pDst + x), _mm256_loadu_si256( (const __m256i *)(pSrc + x) ) );
+		}
+
+		if( x < width )
+		{
+			memcpy( pDst + x, pSrc + x, width - x );
+		}
+
+		pSrc += srcStride;
+		pDst += dstStride;
+	}
+
+	_mm_sfence();
+	_mm256_zeroupper();
+}
+
+__attribute__((target("avx2")))
+static void AccumRowAvx2( guint16 *pAcc, const guint8 *pSrc, gint width )
+{
+	gint x;
+
+	for( x=0 ; x + 32 <= width ; x += 32 )
+	{
+		__m256i v0 = _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i *)(pSrc + x) ) );
+		__m256i v1 = _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i *)(pSrc + x + 16) ) );
+		__m256i a0 = _mm256_loadu_si256( (const __m256i *)(pAcc + x) );
+		__m256i a1 = _mm256_loadu_si256( (const __m256i *)(pAcc + x + 16) );
+
+		_mm256_storeu_si256( (__m256i *)(pAcc + x), _mm256_add_epi16( a0, v0 ) );
+		_mm256_storeu_si256( (__m256i *)(pAcc + x + 16), _mm256_add_epi16( a1, v1 ) );
+	}
+	_mm256_zeroupper();
+
+	AccumRowC( pAcc + x, pSrc + x, width - x );
+}
+
+__attribute__((target("avx2")))
+static void AvgRowAvx2( guint8 *pDst, const guint8 *pA, const guint8 *pB, gint width )
+{
+	gint x;
+
+	for( x=0 ; x + 32 <= width ; x += 32 )
+	{
+		_mm256_storeu_si256( (__m256i *)(pDst + x), _mm256_avg_epu8( _mm256_loadu_si256( (const __m256i *)(pA + x) ),
+			_mm256_loadu_si256( (const __m256i *)(pB + x) ) ) );
+	}
+	_mm256_zeroupper();
+
+	AvgRowC( pDst + x, pA + x, pB + x, width - x );
+}
+#endif	// NX_COPY_X86
+
+#ifdef NX_COPY_NEON
+//
+//	AArch64 writes pairs of q registers with STNP, the non-temporal hint
+//	keeping the frame out of the caches as the x86 stream stores do; STNP
+//	takes any alignment. AArch32 has no non-temporal store and keeps plain
+//	stores, the Cortex-A53 switches to write streaming on its own for long
+//	sequential writes there.
+//
+#ifdef __aarch64__
+static inline void StorePairNt( guint8 *pDst, uint8x16_t v0, uint8x16_t v1 )
+{
+	__asm__ volatile( "stnp %q1, %q2, [%0]" : : "r"(pDst), "w"(v0), "w"(v1) : "memory" );
+}
+#else
+static inline void StorePairNt( guint8 *pDst, uint8x16_t v0, uint8x16_t v1 )
+{
+	vst1q_u8( pDst, v0 );
+	vst1q_u8( pDst + 16, v1 );
+}
+#endif
+
+static void CopyPlaneNeon( guint8 *pDst, gint dstStride, const guint8 *pSrc, gint srcStride, gint width, gint height )
+{
+	gint x, y;
+
+	for( y=0 ; y<height ; y++ )
+	{
+		for( x=0 ; x + 64 <= width ; x += 64 )
+		{
+			uint8x16_t v0, v1, v2, v3;
+
+			__builtin_prefetch( pSrc + x + PREFETCH_DIST, 0, 0 );
+			v0 = vld1q_u8( pSrc + x );
+			v1 = vld1q_u8( pSrc + x + 16 );
+			v2 = vld1q_u8( pSrc + x + 32 );
+			v3 = vld1q_u8( pSrc + x + 48 );
+			StorePairNt( pDst + x, v0, v1 );
+			StorePairNt( pDst + x + 32, v2, v3 );
+		}
+
+		for( ; x + 32 <= width ; x += 32 )
+		{
+			StorePairNt( pDst + x, vld1q_u8( pSrc + x ), vld1q_u8( pSrc + x + 16 ) );
+		}
+
+		for( ; x + 16 <= width ; x += 16 )
+		{
+			vst1q_u8( pDst + x, vld1q_u8( pSrc + x ) );
+		}
+
+		if( x < width )
+		{
+			memcpy( pDst + x, pSrc + x, width - x );
+		}
+
+		pSrc += srcStride;
+		pDst += dstStride;
+	}
+}
+
+static void AccumRowNeon( guint16 *pAcc, const guint8 *pSrc, gint width )
+{
+	gint x;
+
+	for( x=0 ; x + 16 <= width ; x += 16 )
+	{
+		uint8x16_t v = vld1q_u8( pSrc + x );
+
+		vst1q_u16( pAcc + x, vaddw_u8( vld1q_u16( pAcc + x ), vget_low_u8( v ) ) );
+		vst1q_u16( pAcc + x + 8, vaddw_u8( vld1q_u16( pAcc + x + 8 ), vget_high_u8( v ) ) );
+	}
+
+	AccumRowC( pAcc + x, pSrc + x, width - x );
+}
+
+static void AvgRowNeon( guint8 *pDst, const guint8 *pA, const guint8 *pB, gint width )
+{
+	gint x;
+
+	for( x=0 ; x + 16 <= width ; x += 16 )
+	{
+		vst1q_u8( pDst + x, vrhaddq_u8( vld1q_u8( pA + x ), vld1q_u8( pB + x ) ) );
+	}
+
+	AvgRowC( pDst + x, pA + x, pB + x, width - x );
+}
+#endif	// NX_COPY_NEON
+
+static void SelectKernel( NX_COPY_KERNEL *pKernel )
+{
+	const gchar *pForce = getenv( "NX_VDEC_COPY_KERNEL" );
+
+	pKernel->pName = "c";
+	pKernel->func = CopyPlaneC;
+	pKernel->accum = AccumRowC;
+	pKernel->avg = AvgRowC;
+
+	if( pForce && !strcmp( pForce, "c" ) )
+		return;
+
+#ifdef NX_COPY_X86
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports( "avx2" ) && (!pForce || !strcmp( pForce, "avx2" )) )
+	{
+		pKernel->pName = "avx2";
+		pKernel->func = CopyPlaneAvx2;
+		pKernel->accum = AccumRowAvx2;
+		pKernel->avg = AvgRowAvx2;
+		return;
+	}
+	if( __builtin_cpu_supports( "sse2" ) && (!pForce || !strcmp( pForce, "sse2" )) )
+	{
+		pKernel->pName = "sse2";
+		pKernel->func = CopyPlaneSse2;
+		pKernel->accum = AccumRowSse2;
+		pKernel->avg = AvgRowSse2;
+		return;
+	}
+#endif
+
+#ifdef NX_COPY_NEON
+	// NEON is part of the baseline whenever this is compiled in
+	if( !pForce || !strcmp( pForce, "neon" ) )
+	{
+		pKernel->pName = "neon";
+		pKernel->func = CopyPlaneNeon;
+		pKernel->accum = AccumRowNeon;
+		pKernel->avg = AvgRowNeon;
+		return;
+	}
+#endif
+}
+
+static const NX_COPY_KERNEL *GetKernel( void )
+{
+	static gsize bSelected = 0;
+
+	if( g_once_init_enter( &bSelected ) )
+	{
+		SelectKernel( &gstCopyKernel );
+		GST_INFO("plane copy kernel: %s", gstCopyKernel.pName);
+		g_once_init_leave( &bSelected, 1 );
+	}
+
+	return &gstCopyKernel;
+}
+
+void CopyPlane( guint8 *pDst, gint dstStride, const guint8 *pSrc, gint srcStride, gint width, gint height )
+{
+	if( (0 >= width) || (0 >= height) )
+		return;
+
+	GetKernel()->func( pDst, dstStride, pSrc, srcStride, width, height );
+}
+
+static gboolean IsScaled( const NX_COPY_PLANE *pPlane )
+{
+	return ((0 < pPlane->srcWidth) && (pPlane->srcWidth != pPlane->width)) ||
+		((0 < pPlane->srcHeight) && (pPlane->srcHeight != pPlane->height));
+}
+
+// rows of these planes depend on other rows, bands keep the whole plane
+static gboolean IsRowFiltered( const NX_COPY_PLANE *pPlane )
+{
+	return IsScaled( pPlane ) || (NX_COPY_DEINT_NONE != pPlane->deinterlace);
+}
+
+// source bytes a plane reads, which is what a band's cost follows
+static gsize PlaneSize( const NX_COPY_PLANE *pPlane )
+{
+	if( IsScaled( pPlane ) )
+		return (gsize)(pPlane->srcWidth ? pPlane->srcWidth : pPlane->width) * (pPlane->srcHeight ? pPlane->srcHeight : pPlane->height);
+
+	return (gsize)pPlane->width * pPlane->height;
+}
+
+// the source rows around row y of a plane with the given number of rows, mirrored at the edges
+static void FieldRows( const NX_COPY_PLANE *pPlane, gint y, gint height, const guint8 **ppPrev, const guint8 **ppCur, const guint8 **ppNext )
+{
+	gint last = height - 1;
+
+	*ppCur = pPlane->pSrc + (gsize)y * pPlane->srcStride;
+	*ppPrev = pPlane->pSrc + (gsize)((0 < y) ? y - 1 : MIN( 1, last )) * pPlane->srcStride;
+	*ppNext = pPlane->pSrc + (gsize)((y < last) ? y + 1 : MAX( 0, last - 1 )) * pPlane->srcStride;
+}
+
+//
+//	Source row y, of width bytes at most NX_COPY_MAX_ROW, de-interlaced for
+//	the scaler. A row bob keeps is returned in place, any other is rebuilt
+//	in pRow.
+//
+static const guint8 *DeinterlaceSourceRow( const NX_COPY_PLANE *pPlane, gint y, gint width, gint height, guint8 *pRow )
+{
+	guint8 tmp[NX_COPY_MAX_ROW];
+	NX_AVG_ROW_FUNC avg = GetKernel()->avg;
+	gint keep = (NX_COPY_DEINT_BOB_BOTTOM == pPlane->deinterlace) ? 1 : 0;
+	const guint8 *pPrev, *pCur, *pNext;
+
+	FieldRows( pPlane, y, height, &pPrev, &pCur, &pNext );
+
+	if( NX_COPY_DEINT_BLEND == pPlane->deinterlace )
+	{
+		avg( tmp, pPrev, pNext, width );
+		avg( pRow, tmp, pCur, width );
+		return pRow;
+	}
+	if( ((y & 1) == keep) || (1 == height) )
+	{
+		return pCur;
+	}
+	avg( pRow, pPrev, pNext, width );
+	return pRow;
+}
+
+//
+//	Box filter for destination rows y0..y1: every output sample is the
+//	rounded mean of the source samples under it. The source rows of one
+//	output row are summed into a row accumulator with the SIMD kernel, then
+//	each output sample adds up its columns. Enlarging degenerates into
+//	nearest neighbour. An interlaced source is de-interlaced row by row
+//	on the way in, a box over both fields would mix them.
+//
+static void ScalePlaneRows( const NX_COPY_PLANE *pPlane, gint y0, gint y1 )
+{
+	guint16 acc[NX_COPY_MAX_ROW];
+	guint8 row[NX_COPY_MAX_ROW];
+	NX_ACCUM_ROW_FUNC accum = GetKernel()->accum;
+	const guint8 *pRow;
+	gint ps = MAX( 1, pPlane->pixelStride );
+	gint srcWidth = pPlane->srcWidth ? pPlane->srcWidth : pPlane->width;
+	gint srcHeight = pPlane->srcHeight ? pPlane->srcHeight : pPlane->height;
+	gint srcPixels = MIN( srcWidth, NX_COPY_MAX_ROW ) / ps;
+	gint dstPixels = pPlane->width / ps;
+	gint x, y, c, sx, sx0, sx1, sy, sy0, sy1, n;
+	guint32 sum;
+	guint8 *pDst;
+
+	if( (0 >= srcPixels) || (0 >= dstPixels) || (0 >= srcHeight) )
+		return;
+
+	for( y=y0 ; y<y1 ; y++ )
+	{
+		sy0 = (gint)((gint64)y * srcHeight / pPlane->height);
+		sy1 = MAX( sy0 + 1, (gint)((gint64)(y + 1) * srcHeight / pPlane->height) );
+
+		memset( acc, 0, (gsize)srcPixels * ps * sizeof(acc[0]) );
+		for( sy=sy0 ; sy<sy1 ; sy++ )
+		{
+			pRow = pPlane->pSrc + (gsize)sy * pPlane->srcStride;
+			if( NX_COPY_DEINT_NONE != pPlane->deinterlace )
+			{
+				pRow = DeinterlaceSourceRow( pPlane, sy, srcPixels * ps, srcHeight, row );
+			}
+			accum( acc, pRow, srcPixels * ps );
+		}
+
+		pDst = pPlane->pDst + (gsize)y * pPlane->dstStride;
+		for( x=0 ; x<dstPixels ; x++ )
+		{
+			sx0 = (gint)((gint64)x * srcPixels / dstPixels);
+			sx1 = MAX( sx0 + 1, (gint)((gint64)(x + 1) * srcPixels / dstPixels) );
+			n = (sx1 - sx0) * (sy1 - sy0);
+
+			for( c=0 ; c<ps ; c++ )
+			{
+				sum = 0;
+				for( sx=sx0 ; sx<sx1 ; sx++ )
+				{
+					sum += acc[sx * ps + c];
+				}
+				pDst[x * ps + c] = (guint8)((sum + n / 2) / n);
+			}
+		}
+	}
+}
+
+//
+//	Destination rows y0..y1 of a de-interlaced plane. Blend averages the
+//	outer neighbours first into a row on the stack, so the destination is
+//	only written once.
+//
+static void DeinterlacePlaneRows( const NX_COPY_PLANE *pPlane, gint y0, gint y1 )
+{
+	guint8 tmp[NX_COPY_MAX_ROW];
+	NX_AVG_ROW_FUNC avg = GetKernel()->avg;
+	gint keep = (NX_COPY_DEINT_BOB_BOTTOM == pPlane->deinterlace) ? 1 : 0;
+	gint last = pPlane->height - 1;
+	const guint8 *pPrev, *pCur, *pNext;
+	guint8 *pDst;
+	gint x, y, n;
+
+	for( y=y0 ; y<y1 ; y++ )
+	{
+		pDst = pPlane->pDst + (gsize)y * pPlane->dstStride;
+		FieldRows( pPlane, y, pPlane->height, &pPrev, &pCur, &pNext );
+
+		if( NX_COPY_DEINT_BLEND == pPlane->deinterlace )
+		{
+			for( x=0 ; x<pPlane->width ; x+=n )
+			{
+				n = MIN( pPlane->width - x, NX_COPY_MAX_ROW );
+				avg( tmp, pPrev + x, pNext + x, n );
+				avg( pDst + x, tmp, pCur + x, n );
+			}
+		}
+		else if( ((y & 1) == keep) || (0 == last) )
+		{
+			memcpy( pDst, pCur, pPlane->width );
+		}
+		else
+		{
+			// both neighbours belong to the kept field
+			avg( pDst, pPrev, pNext, pPlane->width );
+		}
+	}
+}
+
+static void RunJob( const NX_COPY_JOB *pJob )
+{
+	if( IsScaled( &pJob->band ) )
+	{
+		ScalePlaneRows( &pJob->band, pJob->y0, pJob->y1 );
+	}
+	else if( NX_COPY_DEINT_NONE != pJob->band.deinterlace )
+	{
+		DeinterlacePlaneRows( &pJob->band, pJob->y0, pJob->y1 );
+	}
+	else
+	{
+		CopyPlane( pJob->band.pDst, pJob->band.dstStride, pJob->band.pSrc, pJob->band.srcStride, pJob->band.width, pJob->band.height );
+	}
+}
+
+const gchar *CopyKernelName( void )
+{
+	GetKernel();
+
+	return gstCopyKernel.pName;
+}
+
+static gint ResolveThreads( gint numThreads )
+{
+	if( NX_COPY_THREADS_AUTO == numThreads )
+	{
+		numThreads = g_get_num_processors() - 1;
+	}
+
+	return CLAMP( numThreads, 0, NX_COPY_MAX_THREADS );
+}
+
+static void CopyWorker( gpointer pData, gpointer pUserData )
+{
+	NX_COPY_JOB *pJob = (NX_COPY_JOB *)pData;
+	NX_COPY_BATCH *pBatch = pJob->pBatch;
+
+	if( pJob->threadAttr.serial != gTlsAttrSerial )
+	{
+		gTlsAttrSerial = pJob->threadAttr.serial;
+		ThreadAttrApply( &pJob->threadAttr );
+	}
+
+	RunJob( pJob );
+
+	pthread_mutex_lock( &pBatch->mutex );
+	if( 0 == --pBatch->pending )
+	{
+		pthread_cond_signal( &pBatch->cond );
+	}
+	pthread_mutex_unlock( &pBatch->mutex );
+}
+
+// number of helper threads for a picture of this size, 0 keeps the copy on the caller
+static gint GetHelpers( gsize size, GThreadPool **ppPool )
+{
+	gint numHelpers;
+
+	pthread_mutex_lock( &gstCopyPoolMutex );
+	numHelpers = ResolveThreads( gstCopyThreads );
+	if( (0 < numHelpers) && (size >= gstCopyMinSize) )
+	{
+		if( NULL == gpCopyPool )
+		{
+			gpCopyPool = g_thread_pool_new( CopyWorker, NULL, numHelpers, FALSE, NULL );
+		}
+	}
+	else
+	{
+		numHelpers = 0;
+	}
+	*ppPool = gpCopyPool;
+	pthread_mutex_unlock( &gstCopyPoolMutex );
+
+	return (NULL != *ppPool) ? numHelpers : 0;
+}
+
+void CopyPlanes( const NX_COPY_PLANE *pPlanes, gint numPlanes )
+{
+	NX_COPY_JOB jobs[NX_COPY_MAX_THREADS + 1 + NX_COPY_MAX_PLANES];
+	NX_COPY_BATCH batch;
+	NX_THREAD_ATTR attr;
+	GThreadPool *pPool = NULL;
+	gsize size = 0, planeSize;
+	gint numBands, planeBands, rows, y;
+	gint numJobs = 0;
+	gint i;
+
+	numPlanes = MIN( numPlanes, NX_COPY_MAX_PLANES );
+	for( i=0 ; i<numPlanes ; i++ )
+	{
+		size += PlaneSize( &pPlanes[i] );
+	}
+
+	numBands = GetHelpers( size, &pPool ) + 1;
+	if( 1 == numBands )
+	{
+		for( i=0 ; i<numPlanes ; i++ )
+		{
+			jobs[0].band = pPlanes[i];
+			jobs[0].y0 = 0;
+			jobs[0].y1 = pPlanes[i].height;
+			RunJob( &jobs[0] );
+		}
+		return;
+	}
+
+	ThreadAttrGetCurrent( &attr );
+
+	// every plane gets bands in proportion to its share of the picture
+	for( i=0 ; i<numPlanes ; i++ )
+	{
+		planeSize = PlaneSize( &pPlanes[i] );
+		if( 0 == planeSize )
+			continue;
+
+		planeBands = CLAMP( (gint)((numBands * planeSize + size / 2) / size), 1, pPlanes[i].height );
+		rows = (pPlanes[i].height + planeBands - 1) / planeBands;
+		for( y=0 ; y<pPlanes[i].height ; y+=rows )
+		{
+			NX_COPY_PLANE *pBand = &jobs[numJobs].band;
+
+			*pBand = pPlanes[i];
+			jobs[numJobs].y0 = y;
+			jobs[numJobs].y1 = MIN( y + rows, pPlanes[i].height );
+			// a filtered band keeps the whole plane and maps its rows itself
+			if( !IsRowFiltered( &pPlanes[i] ) )
+			{
+				pBand->pDst += (gsize)y * pPlanes[i].dstStride;
+				pBand->pSrc += (gsize)y * pPlanes[i].srcStride;
+				pBand->height = jobs[numJobs].y1 - y;
+				pBand->srcWidth = 0;
+				pBand->srcHeight = 0;
+			}
+			jobs[numJobs].pBatch = &batch;
+			jobs[numJobs].threadAttr = attr;
+			numJobs++;
+		}
+	}
+
+	pthread_mutex_init( &batch.mutex, NULL );
+	pthread_cond_init( &batch.cond, NULL );
+	batch.pending = numJobs - 1;
+
+	// the caller copies the first band itself
+	for( i=1 ; i<numJobs ; i++ )
+	{
+		g_thread_pool_push( pPool, &jobs[i], NULL );
+	}
+	RunJob( &jobs[0] );
+
+	pthread_mutex_lock( &batch.mutex );
+	while( 0 < batch.pending )
+	{
+		pthread_cond_wait( &batch.cond, &batch.mutex );
+	}
+	pthread_mutex_unlock( &batch.mutex );
+
+	pthread_mutex_destroy( &batch.mutex );
+	pthread_cond_destroy( &batch.cond );
+}
+
+void CopyPoolSetThreads( gint numThreads )
+{
+	pthread_mutex_lock( &gstCopyPoolMutex );
+	gstCopyThreads = numThreads;
+	if( gpCopyPool )
+	{
+		g_thread_pool_set_max_threads( gpCopyPool, MAX( 1, ResolveThreads( numThreads ) ), NULL );
+	}
+	pthread_mutex_unlock( &gstCopyPoolMutex );
+}
+
+gint CopyPoolGetThreads( void )
+{
+	gint numThreads;
+
+	pthread_mutex_lock( &gstCopyPoolMutex );
+	numThreads = gstCopyThreads;
+	pthread_mutex_unlock( &gstCopyPoolMutex );
+
+	return numThreads;
+}
+
+void CopyPoolSetMinSize( guint size )
+{
+	pthread_mutex_lock( &gstCopyPoolMutex );
+	gstCopyMinSize = size;
+	pthread_mutex_unlock( &gstCopyPoolMutex );
+}
+
+guint CopyPoolGetMinSize( void )
+{
+	guint size;
+
+	pthread_mutex_lock( &gstCopyPoolMutex );
+	size = gstCopyMinSize;
+	pthread_mutex_unlock( &gstCopyPoolMutex );
+
+	return size;
+}
@@ -0,0 +1,79 @@
+#include <gst/gst.h>
+
+#ifndef __COPY_H__
+#define __COPY_H__
+
+#include "thread.h"
+
+G_BEGIN_DECLS
+
+//
+//	Strided to packed plane copies.
+//
+//	The first call picks the widest kernel the running CPU supports (AVX2,
+//	SSE2 or NEON, otherwise memcpy per row). NX_VDEC_COPY_KERNEL=c|sse2|
+//	avx2|neon forces one of them, e.g. to compare output against the
+//	scalar kernel.
+//
+typedef void (*NX_COPY_PLANE_FUNC)( guint8 *pDst, gint dstStride, const guint8 *pSrc, gint srcStride, gint width, gint height );
+
+void CopyPlane( guint8 *pDst, gint dstStride, const guint8 *pSrc, gint srcStride, gint width, gint height );
+const gchar *CopyKernelName( void );
+
+#define	NX_COPY_MAX_PLANES			4
+#define	NX_COPY_MAX_THREADS			32
+#define	NX_COPY_THREADS_AUTO		(-1)		// one per CPU besides the caller
+#define	NX_COPY_MIN_SIZE_DEFAULT	(1 << 20)	// bytes
+
+//
+//	width and srcWidth are in bytes, pixelStride is the number of bytes per
+//	sample group (2 for interleaved chroma). A source larger than the
+//	destination is box filtered down to it: every source row is read once
+//	and only the destination is written. srcWidth/srcHeight of 0 mean the
+//	destination size, i.e. a plain copy.
+//
+//	deinterlace rebuilds an interlaced plane: bob keeps one field and
+//	interpolates the other one's rows, blend filters every row with its
+//	neighbours (1/4, 1/2, 1/4). A scaled plane is de-interlaced first, the
+//	box filter reads the rebuilt source rows.
+//
+typedef struct
+{
+	guint8 *pDst;
+	gint dstStride;
+	const guint8 *pSrc;
+	gint srcStride;
+	gint width;
+	gint height;
+	gint srcWidth;
+	gint srcHeight;
+	gint pixelStride;
+	gint deinterlace;
+} NX_COPY_PLANE;
+
+enum
+{
+	NX_COPY_DEINT_NONE,
+	NX_COPY_DEINT_BOB_TOP,			// keeps the top field (even rows)
+	NX_COPY_DEINT_BOB_BOTTOM,		// keeps the bottom field (odd rows)
+	NX_COPY_DEINT_BLEND,
+};
+
+#define	NX_COPY_MAX_ROW				4096		// source bytes per row the downscaler sums
+#define	NX_COPY_MAX_SCALE			16			// per axis, keeps the row sums in 16 bits
+
+//
+//	Copies a whole picture. Pictures of at least the minimum size are cut
+//	into row bands, which a process-wide thread pool and the calling
+//	thread copy together; the call returns when all bands are done. The
+//	helpers run under the caller's scheduling attributes meanwhile.
+//
+void CopyPlanes( const NX_COPY_PLANE *pPlanes, gint numPlanes );
+void CopyPoolSetThreads( gint numThreads );
+gint CopyPoolGetThreads( void );
+void CopyPoolSetMinSize( guint size );
+guint CopyPoolGetMinSize( void );
+
+G_END_DECLS
+
+#endif //__COPY_H__
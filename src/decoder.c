@@ -7,14 +7,26 @@
 #include <linux/videodev2.h>
 
 #include "decoder.h"
+#include "copy.h"
+#include "warm.h"
 #include "gstnxvideodec.h"
 
 #define	MAX_OUTPUT_BUF	6
+#define	MIN_OUTPUT_BUF	2
 
 static gint ParseH264Info( guint8 *pData, gint size, NX_AVCC_TYPE *pH264Info );
 static gint ParseAvcStream( guint8 *pInBuf, gint inSize, gint nalLengthSize, unsigned char *pBuffer, gint *pIsKey );
 static gint InitializeCodaVpu( NX_VIDEO_DEC_STRUCT *pHDec, guint8 *pInitBuf, gint initBufSize );
 static gint FlushDecoder( NX_VIDEO_DEC_STRUCT *pNxVideoDecHandle );
+static gint HwDecodeFrame( NX_VIDEO_DEC_STRUCT *pHDec, NX_V4L2DEC_IN *pDecIn, NX_V4L2DEC_OUT *pDecOut, gboolean bKeyFrame );
+static gint ResetVideoDec( NX_VIDEO_DEC_STRUCT *pHDec );
+static gint ResumeVideoDec( NX_VIDEO_DEC_STRUCT *pHDec );
+static void RestartStream( NX_VIDEO_DEC_STRUCT *pHDec );
+static gint ReopenHandle( NX_VIDEO_DEC_STRUCT *pHDec );
+static gint ReconfigureVideoDec( NX_VIDEO_DEC_STRUCT *pHDec );
+static void SaveConfig( NX_VIDEO_DEC_STRUCT *pHDec );
+static gboolean IsInbandResize( NX_VIDEO_DEC_STRUCT *pHDec, guint8 *pData, gint size );
+static void SaveInbandHeader( NX_VIDEO_DEC_STRUCT *pHDec, guint8 *pData, gint size );
 static gint Initialize( NX_VIDEO_DEC_STRUCT *pHDec, GstBuffer *pGstBuf, NX_V4L2DEC_OUT *pDecOut, gboolean bKeyFrame, guint8 *pInBuf, gint inSize, gint64 timestamp, NX_AVCC_TYPE *h264Info );
 //TimeStamp
 static void InitVideoTimeStamp( NX_VIDEO_DEC_STRUCT *hDec);
@@ -22,29 +34,13 @@ static void PushVideoTimeStamp( NX_VIDEO_DEC_STRUCT *hDec, gint64 timestamp, gui
 static gint PopVideoTimeStamp( NX_VIDEO_DEC_STRUCT *hDec, gint64 *pTimestamp, guint *pFlag );
 
 //
-//			Find Codec Matching Codec Information
+//			Codec of a caps structure, -1 when not supported
 //
-gint FindCodecInfo( GstVideoCodecState *pState, NX_VIDEO_DEC_STRUCT *pDecHandle )
+gint FindCodecType( GstStructure *pStructure )
 {
 	guint codecType = -1;
-	GstStructure *pStructure = gst_caps_get_structure( pState->caps, 0 );;
 	const gchar *pMime = gst_structure_get_name( pStructure );
 
-	FUNC_IN();
-
-	pDecHandle->width  = GST_VIDEO_INFO_WIDTH( &pState->info );
-	pDecHandle->height = GST_VIDEO_INFO_HEIGHT( &pState->info );
-	pDecHandle->fpsNum = GST_VIDEO_INFO_FPS_N( &pState->info );
-	pDecHandle->fpsDen = GST_VIDEO_INFO_FPS_D( &pState->info );
-
-	if( 0 == pDecHandle->fpsNum )
-	{
-		pDecHandle->fpsNum = 30;
-		pDecHandle->fpsDen = 1;
-	}
-
-	g_print("mime type = %s\n", pMime);
-
 	// H.264
 	if( !strcmp(pMime, "video/x-h264") )
 	{
@@ -108,6 +104,41 @@ gint FindCodecInfo( GstVideoCodecState *pState, NX_VIDEO_DEC_STRUCT *pDecHandle
 		}
 	}
 
+	return codecType;
+}
+
+//
+//			Find Codec Matching Codec Information
+//
+gint FindCodecInfo( GstVideoCodecState *pState, NX_VIDEO_DEC_STRUCT *pDecHandle )
+{
+	guint codecType = -1;
+	GstStructure *pStructure = gst_caps_get_structure( pState->caps, 0 );;
+	const gchar *pMime = gst_structure_get_name( pStructure );
+
+	FUNC_IN();
+
+	pDecHandle->width  = GST_VIDEO_INFO_WIDTH( &pState->info );
+	pDecHandle->height = GST_VIDEO_INFO_HEIGHT( &pState->info );
+	pDecHandle->outWidth  = pDecHandle->width;
+	pDecHandle->outHeight = pDecHandle->height;
+	pDecHandle->codedWidth  = 0;
+	pDecHandle->codedHeight = 0;
+	pDecHandle->cropX = 0;
+	pDecHandle->cropY = 0;
+	pDecHandle->fpsNum = GST_VIDEO_INFO_FPS_N( &pState->info );
+	pDecHandle->fpsDen = GST_VIDEO_INFO_FPS_D( &pState->info );
+
+	if( 0 == pDecHandle->fpsNum )
+	{
+		pDecHandle->fpsNum = 30;
+		pDecHandle->fpsDen = 1;
+	}
+
+	g_print("mime type = %s\n", pMime);
+
+	codecType = FindCodecType( pStructure );
+
 	if( codecType == -1 )
 	{
 		GST_ERROR("out of profile or not supported video codec.(mime_type=%s)\n", pMime);
@@ -180,21 +211,45 @@ NX_VIDEO_DEC_STRUCT *OpenVideoDec()
 	}
 
 	memset (pDecHandle, 0 ,sizeof(NX_VIDEO_DEC_STRUCT));
+	pDecHandle->refCount = 1;
+	pDecHandle->imgFourcc = V4L2_PIX_FMT_YUV420;
+	pDecHandle->bTopFieldFirst = TRUE;
+	pthread_mutex_init( &pDecHandle->hwMutex, NULL );
 
 	FUNC_OUT();
 
 	return pDecHandle;
 }
 
+//
+//	Sets the handle up for the stream described by FindCodecInfo() and
+//	GetExtraInfo(). Once open, the handle and its staging buffer are kept:
+//	see ReconfigureVideoDec().
+//
 gint InitVideoDec( NX_VIDEO_DEC_STRUCT *pDecHandle )
 {
 	gint ret = 0;
 	FUNC_IN();
 
-	pDecHandle->hCodec = NX_V4l2DecOpen( pDecHandle->codecType );
+	if( pDecHandle->hCodec )
+	{
+		return ReconfigureVideoDec( pDecHandle );
+	}
+
+	if( !MemBudgetReserve( MAX_INPUT_BUF_SIZE ) )
+	{
+		GST_ERROR("Decoder memory budget exhausted: no room for the %d byte stream buffer (used %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT ").\n",
+			MAX_INPUT_BUF_SIZE, MemBudgetGetUsed(), MemBudgetGetLimit());
+		return DEC_BUDGET_ERR;
+	}
+	pDecHandle->strmBufMem = MAX_INPUT_BUF_SIZE;
+
+	pDecHandle->hCodec = WarmPoolOpen( pDecHandle->codecType );
 	if ( NULL == pDecHandle->hCodec )
 	{
 		GST_ERROR("%s(%d) NX_V4l2DecOpen() failed.\n", __FILE__, __LINE__);
+		MemBudgetRelease( pDecHandle->strmBufMem );
+		pDecHandle->strmBufMem = 0;
 		return -1;
 	}
 
@@ -205,6 +260,8 @@ gint InitVideoDec( NX_VIDEO_DEC_STRUCT *pDecHandle )
 	InitVideoTimeStamp(pDecHandle);
 
 	pDecHandle->bNeedIframe = TRUE;
+	pDecHandle->bSuspended = FALSE;
+	SaveConfig( pDecHandle );
 
 	FUNC_OUT();
 
@@ -227,13 +284,34 @@ gint VideoDecodeFrame( NX_VIDEO_DEC_STRUCT *pDecHandle, GstBuffer *pGstBuf, NX_V
 
 	FUNC_IN();
 
+	if( pHDec->bSuspended )
+	{
+		ret = ResumeVideoDec( pHDec );
+		if( 0 != ret )
+		{
+			pDecOut->dispIdx = -1;
+			return ret;
+		}
+	}
+
+	if( pHDec->bNeedReset )
+	{
+		if( 0 != ResetVideoDec( pHDec ) )
+		{
+			pDecOut->dispIdx = -1;
+			return DEC_INIT_ERR;
+		}
+	}
+
 	if( pHDec->bFlush )
 	{
 		FlushDecoder( pHDec );
 		pHDec->bFlush = FALSE;
 		pHDec->bNeedKey = TRUE;
 		pHDec->bNeedIframe = TRUE;
-		pHDec->bIsFlush = TRUE;
+		// a key unit has no next picture to be fed with, waiting for one
+		// would hold every jump of a scan back by a frame
+		pHDec->bIsFlush = !pHDec->bKeyUnitsOnly;
 	}
 
 	if( pHDec->bNeedKey )
@@ -251,6 +329,33 @@ gint VideoDecodeFrame( NX_VIDEO_DEC_STRUCT *pDecHandle, GstBuffer *pGstBuf, NX_V
 	pInBuf = mapInfo.data;
 	inSize = gst_buffer_get_size(pGstBuf);
 
+	// a sequence header with a new picture size needs capture buffers of
+	// that size, the handle is set up again from this key frame
+	if( bKeyFrame && pHDec->bInitialized && IsInbandResize( pHDec, pInBuf, inSize ) )
+	{
+		if( 0 != ReopenHandle( pHDec ) )
+		{
+			pDecOut->dispIdx = -1;
+			ret = DEC_INIT_ERR;
+			goto VideoDecodeFrame_Exit;
+		}
+		// the cached headers describe the old size, this key frame has the new ones
+		g_free( pHDec->pInbandHdr );
+		pHDec->pInbandHdr = NULL;
+		pHDec->inbandHdrSize = 0;
+		if( pHDec->bInbandExtraData )
+		{
+			g_free( pHDec->pExtraData );
+			pHDec->pExtraData = NULL;
+			pHDec->extraDataSize = 0;
+			pHDec->bInbandExtraData = FALSE;
+		}
+		RestartStream( pHDec );
+		pHDec->bNeedKey = FALSE;
+		SaveConfig( pHDec );
+		pHDec->cfgSerial++;
+	}
+
 	// Push Input Time Stamp
 	if ( GST_BUFFER_PTS_IS_VALID(pGstBuf) )
 	{
@@ -271,7 +376,7 @@ gint VideoDecodeFrame( NX_VIDEO_DEC_STRUCT *pDecHandle, GstBuffer *pGstBuf, NX_V
 		{
 			goto VideoDecodeFrame_Exit;
 		}
-		else if( (ret == DEC_INIT_ERR) || (ret == DEC_ERR) )
+		else if( (ret == DEC_INIT_ERR) || (ret == DEC_BUDGET_ERR) || (ret == DEC_ERR) )
 		{
 			goto VideoDecodeFrame_Exit;
 		}
@@ -372,8 +477,13 @@ gint VideoDecodeFrame( NX_VIDEO_DEC_STRUCT *pDecHandle, GstBuffer *pGstBuf, NX_V
 		decIn.strmSize = decBufSize;
 		decIn.timeStamp = timestamp;
 		decIn.eos = 0;
-		VDecSemPend(pHDec->pSem);
-		ret = NX_V4l2DecDecodeFrame( pHDec->hCodec,&decIn, pDecOut );
+		if( !VDecSemPend(pHDec->pSem) )
+		{
+			pDecOut->dispIdx = -1;
+			ret = DEC_ERR;
+			goto VideoDecodeFrame_Exit;
+		}
+		ret = HwDecodeFrame( pHDec, &decIn, pDecOut, bKeyFrame );
 
 		if( (0 == ret ) && (0 <= pDecOut->dispIdx) )
 		{
@@ -397,7 +507,7 @@ gint VideoDecodeFrame( NX_VIDEO_DEC_STRUCT *pDecHandle, GstBuffer *pGstBuf, NX_V
 
 		if( 0 != ret )
 		{
-			g_print("NX_V4l2DecDecodeFrame!!!!, ret = %d\n",ret);
+			GST_WARNING("NX_V4l2DecDecodeFrame() failed, ret = %d (%d in a row)\n", ret, pHDec->consecErrors);
 			ret = DEC_ERR;
 		}
 	}
@@ -413,16 +523,48 @@ void CloseVideoDec( NX_VIDEO_DEC_STRUCT *pDecHandle )
 {
 	if(pDecHandle == NULL)
 	{
-		g_free(pDecHandle);
 		GST_ERROR("pDecHandle is null\n");
 		return;
 	}
+
+	// a decode call waiting for an output slot gives up instead of
+	// decoding on a closed handle
+	pthread_mutex_lock( &pDecHandle->hwMutex );
+	pDecHandle->bClosed = TRUE;
+	if( pDecHandle->pSem )
+	{
+		VDecSemClose( pDecHandle->pSem );
+	}
+	pthread_mutex_unlock( &pDecHandle->hwMutex );
+
+	VideoDecUnref( pDecHandle );
+}
+
+NX_VIDEO_DEC_STRUCT *VideoDecRef( NX_VIDEO_DEC_STRUCT *pDecHandle )
+{
+	g_atomic_int_inc( &pDecHandle->refCount );
+	return pDecHandle;
+}
+
+void VideoDecUnref( NX_VIDEO_DEC_STRUCT *pDecHandle )
+{
+	if( !g_atomic_int_dec_and_test( &pDecHandle->refCount ) )
+	{
+		return;
+	}
+
 	if( pDecHandle->hCodec )
 	{
-		NX_V4l2DecClose( pDecHandle->hCodec );
+		WarmPoolClose( pDecHandle->cfgCodecType, pDecHandle->hCodec, !pDecHandle->bInitialized );
 		pDecHandle->hCodec = NULL;
 	}
 
+	if( pDecHandle->pVpuClient )
+	{
+		VpuArbiterUnregister( pDecHandle->pVpuClient );
+		pDecHandle->pVpuClient = NULL;
+	}
+
 	if( pDecHandle->pExtraData )
 	{
 		g_free(pDecHandle->pExtraData);
@@ -442,77 +584,888 @@ void CloseVideoDec( NX_VIDEO_DEC_STRUCT *pDecHandle )
 		pDecHandle->pTmpStrmBuf = NULL;
 	}
 
+	g_free( pDecHandle->pConvBuf );
+	pDecHandle->pConvBuf = NULL;
+	pDecHandle->convBufSize = 0;
+
+	if( pDecHandle->pInbandHdr )
+	{
+		g_free( pDecHandle->pInbandHdr );
+		pDecHandle->pInbandHdr = NULL;
+	}
+
+	if( pDecHandle->pCfgExtraData )
+	{
+		g_free( pDecHandle->pCfgExtraData );
+		pDecHandle->pCfgExtraData = NULL;
+	}
+
+	if( pDecHandle->pSem )
+	{
+		VDecSemDestroy( pDecHandle->pSem );
+		pDecHandle->pSem = NULL;
+	}
+
+	MemBudgetRelease( pDecHandle->strmBufMem + pDecHandle->frameBufMem );
+
+	pthread_mutex_destroy( &pDecHandle->hwMutex );
 	g_free(pDecHandle);
 }
 
-gint DisplayDone( NX_VIDEO_DEC_STRUCT *pDecHandle, gint v4l2BufferIdx )
+gint DisplayDone( NX_VIDEO_DEC_STRUCT *pDecHandle, gint v4l2BufferIdx, guint generation )
 {
 	FUNC_IN();
 
-	if( pDecHandle->hCodec && (v4l2BufferIdx >= 0) )
+	pthread_mutex_lock( &pDecHandle->hwMutex );
+	// a buffer decoded before a reset belongs to a handle which is gone
+	if( pDecHandle->hCodec && !pDecHandle->bClosed && (v4l2BufferIdx >= 0) && (generation == pDecHandle->generation) )
+	{
+		NX_V4l2DecClrDspFlag( pDecHandle->hCodec, NULL, v4l2BufferIdx );
+		VDecSemPost( pDecHandle->pSem );
+	}
+	pthread_mutex_unlock( &pDecHandle->hwMutex );
+
+	FUNC_OUT();
+
+	return 0;
+}
+
+gint GetTimeStamp(NX_VIDEO_DEC_STRUCT *pDecHandle, gint64 *pTimestamp)
+{
+	gint ret = 0;
+	guint flag;
+
+	ret = PopVideoTimeStamp(pDecHandle, pTimestamp, &flag );
+
+	return ret;
+}
+
+//
+//	Creates a second decoder for the same stream: codec configuration and
+//	codec data are copied from pSrc, the hardware handle is new.
+//
+gint CloneVideoDec( NX_VIDEO_DEC_STRUCT *pSrc, NX_VIDEO_DEC_STRUCT **ppDst )
+{
+	NX_VIDEO_DEC_STRUCT *pDst = NULL;
+	gint ret;
+
+	FUNC_IN();
+
+	*ppDst = NULL;
+
+	pDst = OpenVideoDec();
+	if( NULL == pDst )
+	{
+		return -1;
+	}
+
+	pDst->width = pSrc->width;
+	pDst->height = pSrc->height;
+	pDst->outWidth = pSrc->outWidth;
+	pDst->outHeight = pSrc->outHeight;
+	pDst->codedWidth = pSrc->codedWidth;
+	pDst->codedHeight = pSrc->codedHeight;
+	pDst->cropX = pSrc->cropX;
+	pDst->cropY = pSrc->cropY;
+	pDst->fpsNum = pSrc->fpsNum;
+	pDst->fpsDen = pSrc->fpsDen;
+	pDst->codecType = pSrc->codecType;
+	pDst->h264Alignment = pSrc->h264Alignment;
+	pDst->imgPlaneNum = pSrc->imgPlaneNum;
+	pDst->imgFourcc = pSrc->imgFourcc;
+	pDst->capFourcc = pSrc->capFourcc;
+	pDst->deinterlace = pSrc->deinterlace;
+	pDst->bInterlacedStream = pSrc->bInterlacedStream;
+	pDst->bTopFieldFirst = pSrc->bTopFieldFirst;
+	pDst->budgetPolicy = pSrc->budgetPolicy;
+	pDst->hangTimeout = pSrc->hangTimeout;
+	pDst->maxErrors = pSrc->maxErrors;
+
+	if( pSrc->pExtraData && pSrc->extraDataSize > 0 )
+	{
+		pDst->pExtraData = (guint8 *)g_malloc( pSrc->extraDataSize );
+		memcpy( pDst->pExtraData, pSrc->pExtraData, pSrc->extraDataSize );
+		pDst->extraDataSize = pSrc->extraDataSize;
+		pDst->bInbandExtraData = pSrc->bInbandExtraData;
+	}
+
+	if( pSrc->pH264Info )
+	{
+		pDst->pH264Info = (NX_AVCC_TYPE *)g_malloc( sizeof(NX_AVCC_TYPE) );
+		memcpy( pDst->pH264Info, pSrc->pH264Info, sizeof(NX_AVCC_TYPE) );
+	}
+
+	// a clone competes for the VPU as part of its source's channel
+	if( pSrc->pVpuClient )
+	{
+		pDst->pVpuClient = VpuArbiterRef( pSrc->pVpuClient );
+	}
+
+	ret = InitVideoDec( pDst );
+	if( 0 != ret )
+	{
+		CloseVideoDec( pDst );
+		return ret;
+	}
+
+	*ppDst = pDst;
+
+	FUNC_OUT();
+
+	return 0;
+}
+
+//
+//	Pulls out pictures still held by the decoder after the last input.
+//	Call repeatedly until dispIdx < 0; set bFlush before feeding new data.
+//
+gint VideoDecodeDrain( NX_VIDEO_DEC_STRUCT *pDecHandle, NX_V4L2DEC_OUT *pDecOut )
+{
+	NX_V4L2DEC_IN decIn;
+	gint ret = 0;
+
+	FUNC_IN();
+
+	pDecOut->dispIdx = -1;
+
+	if( (FALSE == pDecHandle->bInitialized) || (NULL == pDecHandle->hCodec) )
+	{
+		return 0;
+	}
+
+	memset( &decIn, 0, sizeof(decIn) );
+	decIn.strmBuf = pDecHandle->pTmpStrmBuf;
+
+	// frames held back by the post-flush accumulation are sent first
+	if( pDecHandle->bIsFlush && (0 < pDecHandle->tmpStrmBufIndex) )
+	{
+		decIn.strmSize = pDecHandle->tmpStrmBufIndex;
+		pDecHandle->tmpStrmBufIndex = 0;
+		pDecHandle->frameCount = 0;
+		pDecHandle->bIsFlush = FALSE;
+	}
+	else
+	{
+		decIn.strmSize = 0;
+		decIn.eos = 1;
+	}
+
+	if( !VDecSemPend( pDecHandle->pSem ) )
+	{
+		return DEC_ERR;
+	}
+	ret = HwDecodeFrame( pDecHandle, &decIn, pDecOut, FALSE );
+
+	if( (0 != ret) || (0 > pDecOut->dispIdx) )
+	{
+		VDecSemPost( pDecHandle->pSem );
+	}
+
+	if( 0 != ret )
+	{
+		pDecOut->dispIdx = -1;
+		ret = DEC_ERR;
+	}
+	else if( (0 > pDecOut->dispIdx) && (0 < decIn.strmSize) )
+	{
+		// the held back frames produced nothing yet, keep draining
+		return VideoDecodeDrain( pDecHandle, pDecOut );
+	}
+
+	FUNC_OUT();
+
+	return ret;
+}
+
+//
+//	TRUE when decoding can start at this access unit without any earlier
+//	data: an H.264 IDR picture, or an MPEG-2 closed GOP. Other codecs are
+//	never split.
+//
+gboolean IsRandomAccessPoint( NX_VIDEO_DEC_STRUCT *pDecHandle, guint8 *pData, gint size )
+{
+	gint pos = 0;
+
+	if( V4L2_PIX_FMT_H264 == pDecHandle->codecType )
+	{
+		NX_AVCC_TYPE *h264Info = pDecHandle->pH264Info;
+		gint nalLengthSize = 0;
+
+		if( (h264Info) && (h264Info->eStreamType == NX_H264_STREAM_AVCC) )
+			nalLengthSize = h264Info->nalLengthSize;
+
+		if( nalLengthSize )
+		{
+			while( pos + nalLengthSize < size )
+			{
+				gint nalLength = 0, i;
+				for( i=0 ; i<nalLengthSize ; i++ )
+					nalLength = (nalLength << 8) | pData[pos + i];
+				pos += nalLengthSize;
+				if( (pData[pos] & 0x1f) == 0x5 )
+					return TRUE;
+				pos += nalLength;
+			}
+		}
+		else
+		{
+			for( ; pos + 3 < size ; pos++ )
+			{
+				if( pData[pos] == 0 && pData[pos+1] == 0 && pData[pos+2] == 1 )
+				{
+					if( (pData[pos+3] & 0x1f) == 0x5 )
+						return TRUE;
+					pos += 2;
+				}
+			}
+		}
+	}
+	else if( V4L2_PIX_FMT_MPEG2 == pDecHandle->codecType )
+	{
+		for( ; pos + 7 < size ; pos++ )
+		{
+			if( pData[pos] == 0 && pData[pos+1] == 0 && pData[pos+2] == 1 && pData[pos+3] == 0xb8 )
+			{
+				// group_of_pictures_header: time_code(25) closed_gop(1) broken_link(1)
+				return (pData[pos+7] & 0x40) ? TRUE : FALSE;
+			}
+		}
+	}
+
+	return FALSE;
+}
+
+typedef struct
+{
+	const guint8 *pData;
+	gint size;
+	gint bitPos;
+	gboolean bFailed;				// a code that cannot be, the rest is not parsed
+} NX_BIT_READER;
+
+// zeros past the end, which every caller's range checks catch
+static guint ReadBits( NX_BIT_READER *pReader, gint bits )
+{
+	guint value = 0;
+
+	while( bits-- > 0 )
+	{
+		gint byte = pReader->bitPos >> 3;
+
+		value <<= 1;
+		if( byte < pReader->size )
+			value |= (pReader->pData[byte] >> (7 - (pReader->bitPos & 7))) & 1;
+		pReader->bitPos++;
+	}
+
+	return value;
+}
+
+// Exp-Golomb codes of 32 bits at most; more leading zeros fail the reader
+static guint ReadUe( NX_BIT_READER *pReader )
+{
+	gint zeros = 0;
+
+	if( pReader->bFailed )
+		return 0;
+
+	while( 0 == ReadBits( pReader, 1 ) )
+	{
+		if( (31 <= zeros) || (pReader->bitPos > (pReader->size << 3)) )
+		{
+			pReader->bFailed = TRUE;
+			return 0;
+		}
+		zeros++;
+	}
+
+	return (1u << zeros) - 1 + ReadBits( pReader, zeros );
+}
+
+static gint ReadSe( NX_BIT_READER *pReader )
+{
+	guint code = ReadUe( pReader );
+
+	return (code & 1) ? (gint)((code + 1) >> 1) : -(gint)(code >> 1);
+}
+
+typedef struct
+{
+	gint codedWidth, codedHeight;
+	gint x, y, width, height;
+} NX_VISIBLE_AREA;
+
+static gboolean IsHighProfile( guint profile )
+{
+	switch( profile )
+	{
+		case 100: case 110: case 122: case 244: case 44:
+		case 83: case 86: case 118: case 128: case 138: case 139: case 134: case 135:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+//
+//	SPS up to the conformance window (frame_cropping_flag and offsets),
+//	pData is the NAL unit without its start code.
+//
+static gboolean ParseH264Sps( const guint8 *pData, gint size, NX_VISIBLE_AREA *pArea )
+{
+	guint8 rbsp[512];
+	NX_BIT_READER reader;
+	guint profile, chromaFormat = 1, pocType, frameMbsOnly;
+	guint widthMbs, heightMapUnits;
+	guint cropLeft = 0, cropRight = 0, cropTop = 0, cropBottom = 0;
+	gint cropUnitX, cropUnitY;
+	gint i, j, n, lastScale, nextScale, rbspSize = 0;
+
+	// drop the emulation prevention bytes
+	for( i=1 ; (i<size) && (rbspSize<(gint)sizeof(rbsp)) ; i++ )
+	{
+		if( (2 <= rbspSize) && (3 == pData[i]) && (0 == rbsp[rbspSize-1]) && (0 == rbsp[rbspSize-2]) )
+			continue;
+		rbsp[rbspSize++] = pData[i];
+	}
+
+	reader.pData = rbsp;
+	reader.size = rbspSize;
+	reader.bitPos = 0;
+	reader.bFailed = FALSE;
+
+	profile = ReadBits( &reader, 8 );
+	ReadBits( &reader, 16 );			// constraint flags, level_idc
+	ReadUe( &reader );					// seq_parameter_set_id
+	if( IsHighProfile( profile ) )
+	{
+		chromaFormat = ReadUe( &reader );
+		if( 3 == chromaFormat )
+			ReadBits( &reader, 1 );		// separate_colour_plane_flag
+		ReadUe( &reader );				// bit_depth_luma_minus8
+		ReadUe( &reader );				// bit_depth_chroma_minus8
+		ReadBits( &reader, 1 );			// qpprime_y_zero_transform_bypass_flag
+		if( ReadBits( &reader, 1 ) )	// seq_scaling_matrix_present_flag
+		{
+			for( i=0 ; i<((3 != chromaFormat) ? 8 : 12) ; i++ )
+			{
+				if( !ReadBits( &reader, 1 ) )
+					continue;
+				lastScale = nextScale = 8;
+				for( j=0 ; j<((6 > i) ? 16 : 64) ; j++ )
+				{
+					if( 0 != nextScale )
+						nextScale = (lastScale + ReadSe( &reader ) + 256) % 256;
+					lastScale = (0 == nextScale) ? lastScale : nextScale;
+				}
+			}
+		}
+	}
+	ReadUe( &reader );					// log2_max_frame_num_minus4
+	pocType = ReadUe( &reader );
+	if( 0 == pocType )
+	{
+		ReadUe( &reader );				// log2_max_pic_order_cnt_lsb_minus4
+	}
+	else if( 1 == pocType )
+	{
+		ReadBits( &reader, 1 );			// delta_pic_order_always_zero_flag
+		ReadSe( &reader );				// offset_for_non_ref_pic
+		ReadSe( &reader );				// offset_for_top_to_bottom_field
+		n = ReadUe( &reader );
+		for( i=0 ; (i<n) && (i<256) && !reader.bFailed ; i++ )
+			ReadSe( &reader );
+	}
+	ReadUe( &reader );					// max_num_ref_frames
+	ReadBits( &reader, 1 );				// gaps_in_frame_num_value_allowed_flag
+	widthMbs = ReadUe( &reader ) + 1;
+	heightMapUnits = ReadUe( &reader ) + 1;
+	frameMbsOnly = ReadBits( &reader, 1 );
+	if( !frameMbsOnly )
+		ReadBits( &reader, 1 );			// mb_adaptive_frame_field_flag
+	ReadBits( &reader, 1 );				// direct_8x8_inference_flag
+	if( ReadBits( &reader, 1 ) )		// frame_cropping_flag
+	{
+		cropLeft = ReadUe( &reader );
+		cropRight = ReadUe( &reader );
+		cropTop = ReadUe( &reader );
+		cropBottom = ReadUe( &reader );
+	}
+
+	if( reader.bFailed || (reader.bitPos > (reader.size << 3)) )
+		return FALSE;
+
+	cropUnitX = ((1 == chromaFormat) || (2 == chromaFormat)) ? 2 : 1;
+	cropUnitY = ((1 == chromaFormat) ? 2 : 1) * (2 - frameMbsOnly);
+
+	pArea->codedWidth = widthMbs * 16;
+	pArea->codedHeight = heightMapUnits * 16 * (2 - frameMbsOnly);
+	pArea->x = cropLeft * cropUnitX;
+	pArea->y = cropTop * cropUnitY;
+	pArea->width = pArea->codedWidth - (cropLeft + cropRight) * cropUnitX;
+	pArea->height = pArea->codedHeight - (cropTop + cropBottom) * cropUnitY;
+
+	return TRUE;
+}
+
+//
+//	Sequence header size (with the sequence extension's high bits). A
+//	smaller sequence display extension narrows it to its centre.
+//
+static gboolean ParseMpeg2Sequence( const guint8 *pData, gint size, NX_VISIBLE_AREA *pArea )
+{
+	NX_BIT_READER reader;
+	gint width = 0, height = 0, displayWidth = 0, displayHeight = 0;
+	gint pos;
+
+	for( pos=0 ; pos+4<size ; pos++ )
+	{
+		if( (0 != pData[pos]) || (0 != pData[pos+1]) || (1 != pData[pos+2]) )
+			continue;
+
+		reader.pData = pData + pos + 4;
+		reader.size = size - pos - 4;
+		reader.bitPos = 0;
+		reader.bFailed = FALSE;
+
+		if( 0xb3 == pData[pos+3] )
+		{
+			width = ReadBits( &reader, 12 );
+			height = ReadBits( &reader, 12 );
+		}
+		else if( (0xb5 == pData[pos+3]) && width )
+		{
+			switch( ReadBits( &reader, 4 ) )
+			{
+				case 1:		// sequence_extension
+					ReadBits( &reader, 8 + 1 + 2 );
+					width |= ReadBits( &reader, 2 ) << 12;
+					height |= ReadBits( &reader, 2 ) << 12;
+					break;
+				case 2:		// sequence_display_extension
+					ReadBits( &reader, 3 );
+					if( ReadBits( &reader, 1 ) )
+						ReadBits( &reader, 24 );
+					displayWidth = ReadBits( &reader, 14 );
+					ReadBits( &reader, 1 );
+					displayHeight = ReadBits( &reader, 14 );
+					break;
+			}
+		}
+		else if( (0x00 == pData[pos+3]) && width )
+		{
+			// headers end with the first picture
+			break;
+		}
+		pos += 3;
+	}
+
+	if( (0 == width) || (0 == height) )
+		return FALSE;
+
+	pArea->codedWidth = GST_ROUND_UP_16( width );
+	pArea->codedHeight = GST_ROUND_UP_16( height );
+	pArea->x = 0;
+	pArea->y = 0;
+	pArea->width = width;
+	pArea->height = height;
+	if( (0 < displayWidth) && (displayWidth < width) )
+	{
+		pArea->x = ((width - displayWidth) / 2) & ~1;
+		pArea->width = displayWidth;
+	}
+	if( (0 < displayHeight) && (displayHeight < height) )
+	{
+		pArea->y = ((height - displayHeight) / 2) & ~1;
+		pArea->height = displayHeight;
+	}
+
+	return TRUE;
+}
+
+//
+//	Visible area from the SPS (H.264) or the sequence headers (MPEG-2) in
+//	Annex B data. With bResize the visible size replaces the caps size,
+//	which is only allowed before the output caps are set; otherwise the
+//	crop origin is taken only when the sizes agree.
+//
+static gboolean FindVisibleArea( NX_VIDEO_DEC_STRUCT *pDecHandle, const guint8 *pData, gint size, NX_VISIBLE_AREA *pArea )
+{
+	NX_VISIBLE_AREA area;
+	gboolean bFound = FALSE;
+	gint pos, end;
+
+	if( (NULL == pData) || (4 > size) )
+		return FALSE;
+
+	if( V4L2_PIX_FMT_H264 == pDecHandle->codecType )
+	{
+		for( pos=0 ; (pos+3<size) && !bFound ; pos++ )
+		{
+			if( (0 != pData[pos]) || (0 != pData[pos+1]) || (1 != pData[pos+2]) )
+				continue;
+			pos += 3;
+			if( 7 != (pData[pos] & 0x1f) )
+				continue;
+
+			for( end=pos ; end+2<size ; end++ )
+			{
+				if( (0 == pData[end]) && (0 == pData[end+1]) && (1 >= pData[end+2]) )
+					break;
+			}
+			if( end + 2 >= size )
+				end = size;
+			bFound = ParseH264Sps( pData + pos, end - pos, &area );
+		}
+	}
+	else if( V4L2_PIX_FMT_MPEG2 == pDecHandle->codecType )
+	{
+		bFound = ParseMpeg2Sequence( pData, size, &area );
+	}
+
+	if( !bFound || (0 >= area.width) || (0 >= area.height) ||
+		(area.x + area.width > area.codedWidth) || (area.y + area.height > area.codedHeight) )
+	{
+		return FALSE;
+	}
+
+	*pArea = area;
+	return TRUE;
+}
+
+gboolean ParseVisibleArea( NX_VIDEO_DEC_STRUCT *pDecHandle, const guint8 *pData, gint size, gboolean bResize )
+{
+	NX_VISIBLE_AREA area;
+
+	if( !FindVisibleArea( pDecHandle, pData, size, &area ) )
+	{
+		return FALSE;
+	}
+
+	if( !bResize && ((area.width != pDecHandle->width) || (area.height != pDecHandle->height)) )
+	{
+		GST_WARNING("visible area %dx%d disagrees with the caps (%dx%d), keeping the caps",
+			area.width, area.height, pDecHandle->width, pDecHandle->height);
+		return FALSE;
+	}
+
+	if( (pDecHandle->width != area.width) || (pDecHandle->height != area.height) || area.x || area.y )
+	{
+		GST_INFO("visible area %dx%d at %d,%d of %dx%d",
+			area.width, area.height, area.x, area.y, area.codedWidth, area.codedHeight);
+	}
+
+	pDecHandle->width = area.width;
+	pDecHandle->height = area.height;
+	pDecHandle->cropX = area.x;
+	pDecHandle->cropY = area.y;
+	pDecHandle->codedWidth = MAX( pDecHandle->codedWidth, area.codedWidth );
+	pDecHandle->codedHeight = MAX( pDecHandle->codedHeight, area.codedHeight );
+
+	return TRUE;
+}
+
+// the decoded picture has rows or columns outside the visible area
+//
+//	Only streams without codec data are looked at, the others change their
+//	headers through new caps.
+//
+static gboolean FindInbandResize( NX_VIDEO_DEC_STRUCT *pHDec, const guint8 *pData, gint size, NX_VISIBLE_AREA *pArea )
+{
+	// codec data of the caps fixes the size, cached in-band headers do not
+	if( ((0 != pHDec->extraDataSize) && !pHDec->bInbandExtraData) || !FindVisibleArea( pHDec, pData, size, pArea ) ||
+		((pArea->width == pHDec->cfgWidth) && (pArea->height == pHDec->cfgHeight)) )
+	{
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+//
+//	TRUE when VideoDecodeFrame() will reopen the handle for this input, so
+//	the pictures the handle still holds are drained first. The handle is
+//	left as it is.
+//
+gboolean IsInbandResizeFrame( NX_VIDEO_DEC_STRUCT *pDecHandle, const guint8 *pData, gint size, gboolean bKeyFrame )
+{
+	NX_VISIBLE_AREA area;
+
+	return bKeyFrame && pDecHandle->bInitialized && FindInbandResize( pDecHandle, pData, size, &area );
+}
+
+// the handle takes the new visible area
+static gboolean IsInbandResize( NX_VIDEO_DEC_STRUCT *pHDec, guint8 *pData, gint size )
+{
+	NX_VISIBLE_AREA area;
+
+	if( !FindInbandResize( pHDec, pData, size, &area ) )
+	{
+		return FALSE;
+	}
+
+	GST_INFO("in-band sequence header changes the picture size to %dx%d\n", area.width, area.height);
+
+	pHDec->width = area.width;
+	pHDec->height = area.height;
+	pHDec->outWidth = area.width;
+	pHDec->outHeight = area.height;
+	pHDec->cropX = area.x;
+	pHDec->cropY = area.y;
+	pHDec->codedWidth = area.codedWidth;
+	pHDec->codedHeight = area.codedHeight;
+
+	return TRUE;
+}
+
+gboolean IsCroppedPicture( NX_VIDEO_DEC_STRUCT *pDecHandle )
+{
+	return pDecHandle->cropX || pDecHandle->cropY ||
+		(pDecHandle->codedWidth > pDecHandle->width) || (pDecHandle->codedHeight > pDecHandle->height);
+}
+
+void GetCodedSize( NX_VIDEO_DEC_STRUCT *pDecHandle, gint *pWidth, gint *pHeight )
+{
+	*pWidth = MAX( pDecHandle->codedWidth, pDecHandle->cropX + pDecHandle->width );
+	*pHeight = MAX( pDecHandle->codedHeight, pDecHandle->cropY + pDecHandle->height );
+}
+
+//
+//	One contiguous capture buffer: a 32 aligned luma plane of 16 aligned
+//	height, followed by either the interleaved chroma plane (NV12/NV21)
+//	or the two half-width chroma planes (YUV420). The planes start at the
+//	top left of the coded picture, not of the visible area.
+//
+gint GetDecodedPlanes( NX_VIDEO_DEC_STRUCT *pDecHandle, NX_V4L2DEC_OUT *pDecOut, guint8 **ppPlane, gint *pStride )
+{
+	gint codedWidth, codedHeight;
+	gint luStride, luVStride, cVStride;
+
+	GetCodedSize( pDecHandle, &codedWidth, &codedHeight );
+	luStride = GST_ROUND_UP_32(codedWidth);
+	luVStride = GST_ROUND_UP_16(codedHeight);
+	cVStride = GST_ROUND_UP_16(codedHeight/2);
+
+	ppPlane[0] = (guint8 *)pDecOut->hImg.pBuffer[0];
+	ppPlane[1] = ppPlane[0] + luStride * luVStride;
+	pStride[0] = luStride;
+
+	if( V4L2_PIX_FMT_YUV420 != VideoFormatToFourcc( GetCaptureFormat( pDecHandle ) ) )
+	{
+		pStride[1] = luStride;
+		return 2;
+	}
+
+	ppPlane[2] = ppPlane[1] + (luStride/2) * cVStride;
+	pStride[1] = luStride/2;
+	pStride[2] = luStride/2;
+	return 3;
+}
+
+static GstVideoFormat FourccToVideoFormat( guint32 fourcc )
+{
+	switch( fourcc )
+	{
+		case V4L2_PIX_FMT_NV12:
+			return GST_VIDEO_FORMAT_NV12;
+		case V4L2_PIX_FMT_NV21:
+			return GST_VIDEO_FORMAT_NV21;
+		default:
+			return GST_VIDEO_FORMAT_I420;
+	}
+}
+
+static gboolean IsCaptureFourcc( guint32 fourcc )
+{
+	return (V4L2_PIX_FMT_YUV420 == fourcc) || (V4L2_PIX_FMT_NV12 == fourcc) || (V4L2_PIX_FMT_NV21 == fourcc);
+}
+
+// the negotiated layout, which pictures leave the decoder in
+GstVideoFormat GetDecodedFormat( NX_VIDEO_DEC_STRUCT *pDecHandle )
+{
+	return FourccToVideoFormat( pDecHandle->imgFourcc );
+}
+
+// the layout of the capture buffers
+GstVideoFormat GetCaptureFormat( NX_VIDEO_DEC_STRUCT *pDecHandle )
+{
+	return FourccToVideoFormat( pDecHandle->capFourcc ? pDecHandle->capFourcc : pDecHandle->imgFourcc );
+}
+
+// the hardware writes its own layout, only copies have the negotiated one
+gboolean IsConvertedPicture( NX_VIDEO_DEC_STRUCT *pDecHandle )
+{
+	return pDecHandle->capFourcc && (pDecHandle->capFourcc != pDecHandle->imgFourcc);
+}
+
+guint32 VideoFormatToFourcc( GstVideoFormat format )
+{
+	switch( format )
+	{
+		case GST_VIDEO_FORMAT_NV12:
+			return V4L2_PIX_FMT_NV12;
+		case GST_VIDEO_FORMAT_NV21:
+			return V4L2_PIX_FMT_NV21;
+		default:
+			return V4L2_PIX_FMT_YUV420;
+	}
+}
+
+//
+//	Asks for another capture layout. Pictures already decoded keep the
+//	current one, the handle is reopened with the new layout before the
+//	next frame and the stream restarts at a key frame.
+//
+void RequestDecodedFormat( NX_VIDEO_DEC_STRUCT *pDecHandle, GstVideoFormat format )
+{
+	pDecHandle->reqFourcc = VideoFormatToFourcc( format );
+	pDecHandle->bNeedReset = TRUE;
+	pDecHandle->resetReason = NX_RESET_FORMAT;
+}
+
+// Copies the visible area of a picture into a mapped frame of the same format, scaled to the frame's size
+//
+//	Moves the chroma samples of the copied capture layout, two-plane or
+//	three-plane, into the components of the frame's layout.
+//
+static void RearrangeChroma( const GstVideoFormatInfo *pCapInfo, const NX_COPY_PLANE *pPlanes, GstVideoFrame *pFrame )
+{
+	gint width = GST_VIDEO_FRAME_COMP_WIDTH( pFrame, 1 );
+	gint height = GST_VIDEO_FRAME_COMP_HEIGHT( pFrame, 1 );
+	const NX_COPY_PLANE *pPlane;
+	const guint8 *pSrc;
+	guint8 *pDst;
+	gint srcPixelStride, dstPixelStride;
+	gint c, x, y;
+
+	for( c=1 ; c<3 ; c++ )
 	{
-		NX_V4l2DecClrDspFlag( pDecHandle->hCodec, NULL, v4l2BufferIdx );
-		VDecSemPost( pDecHandle->pSem );
+		pPlane = &pPlanes[GST_VIDEO_FORMAT_INFO_PLANE( pCapInfo, c )];
+		srcPixelStride = GST_VIDEO_FORMAT_INFO_PSTRIDE( pCapInfo, c );
+		dstPixelStride = GST_VIDEO_FRAME_COMP_PSTRIDE( pFrame, c );
+		for( y=0 ; y<height ; y++ )
+		{
+			pSrc = pPlane->pDst + (gsize)y * pPlane->dstStride + GST_VIDEO_FORMAT_INFO_POFFSET( pCapInfo, c );
+			pDst = (guint8 *)GST_VIDEO_FRAME_COMP_DATA( pFrame, c ) + (gsize)y * GST_VIDEO_FRAME_COMP_STRIDE( pFrame, c );
+			for( x=0 ; x<width ; x++ )
+			{
+				pDst[x * dstPixelStride] = pSrc[x * srcPixelStride];
+			}
+		}
 	}
-
-	FUNC_OUT();
-
-	return 0;
 }
 
-gint GetTimeStamp(NX_VIDEO_DEC_STRUCT *pDecHandle, gint64 *pTimestamp)
+static gboolean IsScaledFrame( NX_VIDEO_DEC_STRUCT *pDecHandle, GstVideoFrame *pFrame )
 {
-	gint ret = 0;
-	guint flag;
-
-	ret = PopVideoTimeStamp(pDecHandle, pTimestamp, &flag );
-
-	return ret;
+	return (GST_VIDEO_FRAME_WIDTH( pFrame ) != pDecHandle->width) || (GST_VIDEO_FRAME_HEIGHT( pFrame ) != pDecHandle->height);
 }
 
-// Copy Image YV12 to General YV12
-gint CopyImageToBufferYV12( uint8_t *pSrcY, uint8_t *pSrcU, uint8_t *pSrcV, uint8_t *pDst, uint32_t strideY, uint32_t strideUV, uint32_t width, uint32_t height )
+//
+//	Copies the visible picture into a frame of the negotiated layout. When
+//	the hardware writes its own layout, the chroma planes are copied into
+//	a scratch of that layout first and rearranged from there.
+//
+void CopyDecodedPicture( NX_VIDEO_DEC_STRUCT *pDecHandle, NX_V4L2DEC_OUT *pDecOut, GstVideoFrame *pFrame )
 {
-	uint32_t i;
-	if( width == strideY )
+	const GstVideoFormatInfo *pFormatInfo = gst_video_format_get_info( GetCaptureFormat( pDecHandle ) );
+	gboolean bConvert = IsConvertedPicture( pDecHandle );
+	NX_COPY_PLANE planes[3];
+	guint8 *pPlane[3] = { NULL, };
+	gint stride[3] = { 0, };
+	gint deinterlace = NX_COPY_DEINT_NONE;
+	gint compWidth, compHeight;
+	gsize convSize = 0;
+	gint numPlanes;
+	gint i;
+
+	// bob keeps the field that is displayed first; scaling cannot keep the
+	// fields apart, a scaled copy is always de-interlaced, blended unless
+	// bob was asked for
+	if( IsInterlacedPicture( pDecHandle, pDecOut ) &&
+		((NX_DEINTERLACE_OFF != pDecHandle->deinterlace) || IsScaledFrame( pDecHandle, pFrame )) )
 	{
-		memcpy( pDst, pSrcY, width*height );
-		pDst += width*height;
+		if( NX_DEINTERLACE_BOB == pDecHandle->deinterlace )
+			deinterlace = pDecHandle->bTopFieldFirst ? NX_COPY_DEINT_BOB_TOP : NX_COPY_DEINT_BOB_BOTTOM;
+		else
+			deinterlace = NX_COPY_DEINT_BLEND;
 	}
-	else
+
+	numPlanes = GetDecodedPlanes( pDecHandle, pDecOut, pPlane, stride );
+	if( !bConvert )
 	{
-		for( i=0 ; i<height ; i++ )
-		{
-			memcpy( pDst, pSrcY, width );
-			pSrcY += strideY;
-			pDst += width;
-		}
+		numPlanes = MIN( numPlanes, (gint)GST_VIDEO_FRAME_N_PLANES( pFrame ) );
 	}
 
-	width /= 2;
-	height /= 2;
-	if( width == strideUV )
+	// plane i holds component i for all three layouts; a frame smaller than
+	// the decoded picture is box filtered down while it is copied
+	for( i=0 ; i<numPlanes ; i++ )
 	{
-		memcpy( pDst, pSrcU, width*height );
-		pDst += width*height;
-		memcpy( pDst, pSrcV, width*height );
+		compWidth = GST_VIDEO_FORMAT_INFO_SCALE_WIDTH( pFormatInfo, i, GST_VIDEO_FRAME_WIDTH( pFrame ) );
+		compHeight = GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT( pFormatInfo, i, GST_VIDEO_FRAME_HEIGHT( pFrame ) );
+		planes[i].pixelStride = GST_VIDEO_FORMAT_INFO_PSTRIDE( pFormatInfo, i );
+		if( bConvert && (0 < i) )
+		{
+			planes[i].dstStride = compWidth * planes[i].pixelStride;
+			convSize += (gsize)planes[i].dstStride * compHeight;
+		}
+		else
+		{
+			planes[i].pDst = GST_VIDEO_FRAME_PLANE_DATA( pFrame, i );
+			planes[i].dstStride = GST_VIDEO_FRAME_PLANE_STRIDE( pFrame, i );
+		}
+		planes[i].pSrc = pPlane[i] + (gsize)(pDecHandle->cropY >> GST_VIDEO_FORMAT_INFO_H_SUB( pFormatInfo, i )) * stride[i] +
+			(pDecHandle->cropX >> GST_VIDEO_FORMAT_INFO_W_SUB( pFormatInfo, i )) * planes[i].pixelStride;
+		planes[i].srcStride = stride[i];
+		planes[i].width = compWidth * planes[i].pixelStride;
+		planes[i].height = compHeight;
+		planes[i].srcWidth = GST_VIDEO_FORMAT_INFO_SCALE_WIDTH( pFormatInfo, i, pDecHandle->width ) * planes[i].pixelStride;
+		planes[i].srcHeight = GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT( pFormatInfo, i, pDecHandle->height );
+		planes[i].deinterlace = deinterlace;
 	}
-	else
+
+	if( bConvert )
 	{
-		for( i=0 ; i<height ; i++ )
+		if( pDecHandle->convBufSize < convSize )
 		{
-			memcpy( pDst, pSrcU, width );
-			pSrcY += strideY;
-			pDst += width;
+			g_free( pDecHandle->pConvBuf );
+			pDecHandle->pConvBuf = (guint8 *)g_malloc( convSize );
+			pDecHandle->convBufSize = convSize;
 		}
-		for( i=0 ; i<height ; i++ )
+		convSize = 0;
+		for( i=1 ; i<numPlanes ; i++ )
 		{
-			memcpy( pDst, pSrcV, width );
-			pSrcY += strideY;
-			pDst += width;
+			planes[i].pDst = pDecHandle->pConvBuf + convSize;
+			convSize += (gsize)planes[i].dstStride * planes[i].height;
 		}
 	}
-	return 0;
+
+	CopyPlanes( planes, numPlanes );
+
+	if( bConvert )
+	{
+		RearrangeChroma( pFormatInfo, planes, pFrame );
+	}
+}
+
+gboolean IsInterlacedPicture( NX_VIDEO_DEC_STRUCT *pDecHandle, NX_V4L2DEC_OUT *pDecOut )
+{
+	return pDecHandle->bInterlacedStream || (0 != pDecOut->interlace[DISPLAY_FRAME]);
+}
+
+// Marks a picture that leaves the decoder interlaced, i.e. neither de-interlaced nor scaled by the copy
+void SetInterlaceFlags( NX_VIDEO_DEC_STRUCT *pDecHandle, NX_V4L2DEC_OUT *pDecOut, GstBuffer *pBuffer )
+{
+	GST_BUFFER_FLAG_UNSET( pBuffer, GST_VIDEO_BUFFER_FLAG_INTERLACED | GST_VIDEO_BUFFER_FLAG_TFF );
+
+	if( (NX_DEINTERLACE_OFF != pDecHandle->deinterlace) || !IsInterlacedPicture( pDecHandle, pDecOut ) ||
+		(pDecHandle->outWidth != pDecHandle->width) || (pDecHandle->outHeight != pDecHandle->height) )
+		return;
+
+	GST_BUFFER_FLAG_SET( pBuffer, GST_VIDEO_BUFFER_FLAG_INTERLACED );
+	if( pDecHandle->bTopFieldFirst )
+	{
+		GST_BUFFER_FLAG_SET( pBuffer, GST_VIDEO_BUFFER_FLAG_TFF );
+	}
 }
 
 static gint Initialize( NX_VIDEO_DEC_STRUCT *pHDec, GstBuffer *pGstBuf, NX_V4L2DEC_OUT *pDecOut, gboolean bKeyFrame, guint8 *pInBuf, gint inSize, gint64 timestamp, NX_AVCC_TYPE *h264Info )
@@ -617,14 +1570,19 @@ static gint Initialize( NX_VIDEO_DEC_STRUCT *pHDec, GstBuffer *pGstBuf, NX_V4L2D
 	if( 0 > ret )
 	{
 		GST_ERROR("VPU initialized Failed!!!!\n");
-		NX_V4l2DecClose( pHDec->hCodec );
+		WarmPoolClose( pHDec->cfgCodecType, pHDec->hCodec, FALSE );
 		pHDec->hCodec = NULL;
-		ret = DEC_INIT_ERR;
+		ret = (DEC_BUDGET_ERR == ret) ? DEC_BUDGET_ERR : DEC_INIT_ERR;
 		return ret;
 	}
 
 	pHDec->bInitialized = TRUE;
 
+	if( 0 == pHDec->extraDataSize )
+	{
+		SaveInbandHeader( pHDec, pSeqData, seqSize );
+	}
+
 	if( TRUE == bDecode )
 	{
 		if( pHDec->codecType == V4L2_PIX_FMT_H264 )
@@ -656,8 +1614,12 @@ static gint Initialize( NX_VIDEO_DEC_STRUCT *pHDec, GstBuffer *pGstBuf, NX_V4L2D
 		decIn.strmSize = decBufSize;
 		decIn.timeStamp = timestamp;
 		decIn.eos = 0;
-		VDecSemPend(pHDec->pSem);
-		ret = NX_V4l2DecDecodeFrame( pHDec->hCodec,&decIn, pDecOut );
+		if( !VDecSemPend(pHDec->pSem) )
+		{
+			pDecOut->dispIdx = -1;
+			return DEC_ERR;
+		}
+		ret = HwDecodeFrame( pHDec, &decIn, pDecOut, bKeyFrame );
 
 		if( (0 == ret ) && (0 <= pDecOut->dispIdx) )
 		{
@@ -681,7 +1643,7 @@ static gint Initialize( NX_VIDEO_DEC_STRUCT *pHDec, GstBuffer *pGstBuf, NX_V4L2D
 
 		if( 0 != ret )
 		{
-			g_print("NX_V4l2DecDecodeFrame!!!!, ret = %d\n",ret);
+			GST_WARNING("NX_V4l2DecDecodeFrame() failed, ret = %d (%d in a row)\n", ret, pHDec->consecErrors);
 			ret = DEC_ERR;
 		}
 	}
@@ -694,6 +1656,396 @@ static gint Initialize( NX_VIDEO_DEC_STRUCT *pHDec, GstBuffer *pGstBuf, NX_V4L2D
 	return ret;
 }
 
+//
+//	All hardware decode calls go through the process-wide VPU arbiter, and
+//	are timed for the watchdog. A call which overruns hangTimeout, or a run
+//	of maxErrors failures, schedules a reset before the next frame.
+//
+static gint HwDecodeFrame( NX_VIDEO_DEC_STRUCT *pHDec, NX_V4L2DEC_IN *pDecIn, NX_V4L2DEC_OUT *pDecOut, gboolean bKeyFrame )
+{
+	gint ret;
+	gint64 elapsed;
+	gint64 grantTime;
+
+	grantTime = VpuArbiterAcquire( pHDec->pVpuClient, bKeyFrame );
+
+	pthread_mutex_lock( &pHDec->hwMutex );
+	pHDec->hwCallStart = g_get_monotonic_time();
+	pthread_mutex_unlock( &pHDec->hwMutex );
+
+	ret = NX_V4l2DecDecodeFrame( pHDec->hCodec, pDecIn, pDecOut );
+
+	pthread_mutex_lock( &pHDec->hwMutex );
+	elapsed = g_get_monotonic_time() - pHDec->hwCallStart;
+	pHDec->hwCallStart = 0;
+	pthread_mutex_unlock( &pHDec->hwMutex );
+
+	VpuArbiterRelease( pHDec->pVpuClient, grantTime );
+
+	if( pHDec->hangTimeout && (elapsed > (gint64)pHDec->hangTimeout * 1000) )
+	{
+		GST_ERROR("NX_V4l2DecDecodeFrame() took %" G_GINT64_FORMAT " msec, resetting decoder\n", elapsed / 1000);
+		pHDec->bNeedReset = TRUE;
+		pHDec->resetReason = NX_RESET_TIMEOUT;
+	}
+	else if( 0 != ret )
+	{
+		pHDec->consecErrors++;
+		if( pHDec->maxErrors && (pHDec->consecErrors >= pHDec->maxErrors) )
+		{
+			GST_ERROR("%d consecutive decode errors, resetting decoder\n", pHDec->consecErrors);
+			pHDec->bNeedReset = TRUE;
+			pHDec->resetReason = NX_RESET_ERRORS;
+		}
+	}
+	else
+	{
+		pHDec->consecErrors = 0;
+	}
+
+	return ret;
+}
+
+gint64 GetHwCallElapsed( NX_VIDEO_DEC_STRUCT *pDecHandle )
+{
+	gint64 elapsed = 0;
+
+	pthread_mutex_lock( &pDecHandle->hwMutex );
+	if( pDecHandle->hwCallStart )
+	{
+		elapsed = g_get_monotonic_time() - pDecHandle->hwCallStart;
+	}
+	pthread_mutex_unlock( &pDecHandle->hwMutex );
+
+	return elapsed;
+}
+
+//
+//	Reopens the hardware handle in place. Output still held downstream
+//	belongs to the old generation and is not returned to the new handle.
+//	The stream restarts at the next key frame, re-initialized from codec
+//	data or, failing that, from the sequence headers cached in-band.
+//
+static gint ResetVideoDec( NX_VIDEO_DEC_STRUCT *pHDec )
+{
+	gint64 startTime = g_get_monotonic_time();
+	gint ret = 0;
+
+	FUNC_IN();
+
+	if( pHDec->reqFourcc )
+	{
+		pHDec->imgFourcc = pHDec->reqFourcc;
+		pHDec->reqFourcc = 0;
+	}
+
+	ret = ReopenHandle( pHDec );
+
+	RestartStream( pHDec );
+
+	pHDec->bNeedReset = FALSE;
+	pHDec->consecErrors = 0;
+	pHDec->resetCount++;
+	pHDec->resetTime = g_get_monotonic_time() - startTime;
+
+	GST_WARNING("decoder reset #%u (reason %d) in %" G_GUINT64_FORMAT " usec\n",
+		pHDec->resetCount, pHDec->resetReason, pHDec->resetTime);
+
+	FUNC_OUT();
+
+	return ret;
+}
+
+//
+//	Gives back what an idle decoder holds: the hardware handle with its
+//	frame buffers and the stream staging buffer. Codec data and the cached
+//	sequence headers stay, the next VideoDecodeFrame() reopens the handle
+//	and restarts at a key frame as after a reset. Closing the handle frees
+//	its capture buffers, so only output exported as dmabuf fds may still be
+//	held downstream; it is not returned to the new handle. The caller makes
+//	sure no decode call is running and no other output is held.
+//
+gboolean SuspendVideoDec( NX_VIDEO_DEC_STRUCT *pDecHandle )
+{
+	NX_VIDEO_DEC_STRUCT *pHDec = pDecHandle;
+
+	FUNC_IN();
+
+	pthread_mutex_lock( &pHDec->hwMutex );
+	if( pHDec->bSuspended || pHDec->bClosed || (NULL == pHDec->hCodec) )
+	{
+		pthread_mutex_unlock( &pHDec->hwMutex );
+		return FALSE;
+	}
+
+	pHDec->generation++;
+	WarmPoolClose( pHDec->cfgCodecType, pHDec->hCodec, !pHDec->bInitialized );
+	pHDec->hCodec = NULL;
+
+	if( pHDec->pSem )
+	{
+		VDecSemDestroy( pHDec->pSem );
+		pHDec->pSem = NULL;
+	}
+
+	MemBudgetRelease( pHDec->strmBufMem + pHDec->frameBufMem );
+	pHDec->strmBufMem = 0;
+	pHDec->frameBufMem = 0;
+	pHDec->bSuspended = TRUE;
+	pthread_mutex_unlock( &pHDec->hwMutex );
+
+	g_free( pHDec->pTmpStrmBuf );
+	pHDec->pTmpStrmBuf = NULL;
+	pHDec->tmpStrmBufSize = 0;
+
+	RestartStream( pHDec );
+	pHDec->suspendCount++;
+
+	GST_INFO("decoder suspended #%u\n", pHDec->suspendCount);
+
+	FUNC_OUT();
+
+	return TRUE;
+}
+
+static gint ResumeVideoDec( NX_VIDEO_DEC_STRUCT *pHDec )
+{
+	NX_V4L2DEC_HANDLE hCodec;
+
+	FUNC_IN();
+
+	if( !MemBudgetReserve( MAX_INPUT_BUF_SIZE ) )
+	{
+		GST_ERROR("Decoder memory budget exhausted: no room to resume (used %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT ").\n",
+			MemBudgetGetUsed(), MemBudgetGetLimit());
+		return DEC_BUDGET_ERR;
+	}
+
+	hCodec = WarmPoolOpen( pHDec->codecType );
+	if( NULL == hCodec )
+	{
+		GST_ERROR("%s(%d) NX_V4l2DecOpen() failed.\n", __FILE__, __LINE__);
+		MemBudgetRelease( MAX_INPUT_BUF_SIZE );
+		return DEC_INIT_ERR;
+	}
+
+	pHDec->pTmpStrmBuf = g_malloc( MAX_INPUT_BUF_SIZE );
+	pHDec->tmpStrmBufSize = MAX_INPUT_BUF_SIZE;
+	pHDec->tmpStrmBufIndex = 0;
+
+	pthread_mutex_lock( &pHDec->hwMutex );
+	pHDec->hCodec = hCodec;
+	pHDec->strmBufMem = MAX_INPUT_BUF_SIZE;
+	pHDec->bSuspended = FALSE;
+	pthread_mutex_unlock( &pHDec->hwMutex );
+
+	FUNC_OUT();
+
+	return 0;
+}
+
+//
+//	Replaces the hardware handle by a fresh one of the current codec, with
+//	its capture buffers to be allocated on initialization. The staging
+//	buffer stays.
+//
+static gint ReopenHandle( NX_VIDEO_DEC_STRUCT *pHDec )
+{
+	gint ret = 0;
+
+	pthread_mutex_lock( &pHDec->hwMutex );
+
+	pHDec->generation++;
+	if( pHDec->hCodec )
+	{
+		WarmPoolClose( pHDec->cfgCodecType, pHDec->hCodec, !pHDec->bInitialized );
+	}
+	pHDec->hCodec = WarmPoolOpen( pHDec->codecType );
+
+	if( pHDec->pSem )
+	{
+		VDecSemDestroy( pHDec->pSem );
+		pHDec->pSem = NULL;
+	}
+
+	MemBudgetRelease( pHDec->frameBufMem );
+	pHDec->frameBufMem = 0;
+
+	pthread_mutex_unlock( &pHDec->hwMutex );
+
+	if( NULL == pHDec->hCodec )
+	{
+		GST_ERROR("%s(%d) NX_V4l2DecOpen() failed.\n", __FILE__, __LINE__);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+//
+//	New caps on an open handle. An unchanged configuration keeps
+//	everything, a handle not yet initialized only needs reopening for
+//	another codec. Once initialized, a new size or new codec data needs
+//	new capture buffers, and the hardware only allocates them when a
+//	handle is initialized: the handle is reopened, the staging buffer and
+//	its budget stay. Decoding restarts at the next key frame.
+//
+static gint ReconfigureVideoDec( NX_VIDEO_DEC_STRUCT *pHDec )
+{
+	gboolean bSameCodec = (pHDec->codecType == pHDec->cfgCodecType);
+	gint ret = 0;
+
+	if( bSameCodec && (pHDec->width == pHDec->cfgWidth) && (pHDec->height == pHDec->cfgHeight) &&
+		(pHDec->extraDataSize == pHDec->cfgExtraDataSize) &&
+		((0 == pHDec->extraDataSize) || !memcmp( pHDec->pExtraData, pHDec->pCfgExtraData, pHDec->extraDataSize )) )
+	{
+		GST_INFO("stream configuration unchanged, keeping the decoder\n");
+		return 0;
+	}
+
+	if( bSameCodec && !pHDec->bInitialized )
+	{
+		SaveConfig( pHDec );
+		return 0;
+	}
+
+	GST_INFO("stream configuration changed (%dx%d -> %dx%d%s), reopening the decoder\n",
+		pHDec->cfgWidth, pHDec->cfgHeight, pHDec->width, pHDec->height, bSameCodec ? "" : ", new codec");
+
+	ret = ReopenHandle( pHDec );
+
+	// the cached headers describe the old stream
+	g_free( pHDec->pInbandHdr );
+	pHDec->pInbandHdr = NULL;
+	pHDec->inbandHdrSize = 0;
+	RestartStream( pHDec );
+	SaveConfig( pHDec );
+
+	return ret;
+}
+
+static void SaveConfig( NX_VIDEO_DEC_STRUCT *pHDec )
+{
+	pHDec->cfgCodecType = pHDec->codecType;
+	pHDec->cfgWidth = pHDec->width;
+	pHDec->cfgHeight = pHDec->height;
+
+	g_free( pHDec->pCfgExtraData );
+	pHDec->pCfgExtraData = NULL;
+	pHDec->cfgExtraDataSize = 0;
+	if( pHDec->pExtraData && (0 < pHDec->extraDataSize) )
+	{
+		pHDec->pCfgExtraData = (guint8 *)g_malloc( pHDec->extraDataSize );
+		memcpy( pHDec->pCfgExtraData, pHDec->pExtraData, pHDec->extraDataSize );
+		pHDec->cfgExtraDataSize = pHDec->extraDataSize;
+	}
+}
+
+//
+//	Stream state of a fresh handle: initialization from codec data or the
+//	in-band headers at the next key frame.
+//
+static void RestartStream( NX_VIDEO_DEC_STRUCT *pHDec )
+{
+	if( (0 == pHDec->extraDataSize) && pHDec->pInbandHdr )
+	{
+		pHDec->pExtraData = pHDec->pInbandHdr;
+		pHDec->extraDataSize = pHDec->inbandHdrSize;
+		pHDec->bInbandExtraData = TRUE;
+		pHDec->pInbandHdr = NULL;
+		pHDec->inbandHdrSize = 0;
+	}
+
+	InitVideoTimeStamp( pHDec );
+	pHDec->bInitialized = FALSE;
+	pHDec->bFlush = FALSE;
+	pHDec->bIsFlush = FALSE;
+	pHDec->bNeedKey = TRUE;
+	pHDec->bNeedIframe = TRUE;
+	pHDec->frameCount = 0;
+	pHDec->tmpStrmBufIndex = 0;
+	pHDec->pos = 0;
+	pHDec->size = 0;
+}
+
+//
+//	Keeps the sequence level headers of a stream without codec data:
+//	SPS/PPS of Annex B H.264, or whatever precedes the first picture of
+//	MPEG-2 / MPEG-4. Other codecs carry what they need in every key frame.
+//
+static void SaveInbandHeader( NX_VIDEO_DEC_STRUCT *pHDec, guint8 *pData, gint size )
+{
+	guint8 *pHdr = NULL;
+	gint hdrSize = 0;
+	gint pos;
+
+	if( (NULL == pData) || (4 > size) || pHDec->pInbandHdr )
+		return;
+
+	if( V4L2_PIX_FMT_H264 == pHDec->codecType )
+	{
+		gint nalStart = -1;
+
+		if( (H264_PARSE_ALIGN_NAL == pHDec->h264Alignment) || pHDec->pH264Info )
+			return;
+
+		pHdr = (guint8 *)g_malloc( size + 4 );
+		for( pos=0 ; pos<=size ; pos++ )
+		{
+			gboolean bStart = (pos + 3 <= size) && (pData[pos] == 0) && (pData[pos+1] == 0) && (pData[pos+2] == 1);
+
+			if( !bStart && (pos < size) )
+				continue;
+
+			// end of the previous NAL unit
+			if( 0 <= nalStart )
+			{
+				gint nalType = pData[nalStart] & 0x1f;
+				gint nalEnd = pos;
+
+				while( (nalEnd > nalStart) && (0 == pData[nalEnd-1]) )
+					nalEnd--;
+				if( (7 == nalType) || (8 == nalType) )
+				{
+					pHdr[hdrSize++] = 0; pHdr[hdrSize++] = 0;
+					pHdr[hdrSize++] = 0; pHdr[hdrSize++] = 1;
+					memcpy( pHdr + hdrSize, pData + nalStart, nalEnd - nalStart );
+					hdrSize += nalEnd - nalStart;
+				}
+			}
+
+			nalStart = pos + 3;
+			pos += 2;
+		}
+	}
+	else if( (V4L2_PIX_FMT_MPEG2 == pHDec->codecType) || (V4L2_PIX_FMT_MPEG4 == pHDec->codecType) )
+	{
+		guint8 picCode = (V4L2_PIX_FMT_MPEG2 == pHDec->codecType) ? 0x00 : 0xb6;
+
+		for( pos=0 ; pos+3<size ; pos++ )
+		{
+			if( pData[pos] == 0 && pData[pos+1] == 0 && pData[pos+2] == 1 && pData[pos+3] == picCode )
+				break;
+		}
+		if( (0 < pos) && (pos + 3 < size) )
+		{
+			pHdr = (guint8 *)g_malloc( pos );
+			memcpy( pHdr, pData, pos );
+			hdrSize = pos;
+		}
+	}
+
+	if( 0 < hdrSize )
+	{
+		pHDec->pInbandHdr = pHdr;
+		pHDec->inbandHdrSize = hdrSize;
+	}
+	else if( pHdr )
+	{
+		g_free( pHdr );
+	}
+}
+
 static gint FlushDecoder( NX_VIDEO_DEC_STRUCT *pDecHandle )
 {
 
@@ -711,9 +2063,21 @@ static gint FlushDecoder( NX_VIDEO_DEC_STRUCT *pDecHandle )
 	return 0;
 }
 
+// Size of one capture frame in the layout the VPU writes (see handle_frame).
+static guint64 GetFrameBufferSize( gint width, gint height )
+{
+	guint64 luSize = (guint64)GST_ROUND_UP_32(width) * GST_ROUND_UP_16(height);
+	guint64 cSize = (guint64)(GST_ROUND_UP_32(width) / 2) * GST_ROUND_UP_16(height / 2);
+
+	return luSize + 2 * cSize;
+}
+
 static gint InitializeCodaVpu(NX_VIDEO_DEC_STRUCT *pHDec, guint8 *pSeqInfo, gint seqInfoSize )
 {
 	gint ret = -1;
+	guint64 frameSize;
+	gint outputBufCount;
+	NX_VDEC_SEMAPHORE *pSem;
 
 	FUNC_IN();
 
@@ -734,21 +2098,75 @@ static gint InitializeCodaVpu(NX_VIDEO_DEC_STRUCT *pHDec, guint8 *pSeqInfo, gint
 			return ret;
 		}
 
+		// in-band headers only confirm the crop origin, the caps are set by now
+		pHDec->codedWidth = seqOut.width;
+		pHDec->codedHeight = seqOut.height;
+		ParseVisibleArea( pHDec, pSeqInfo, seqInfoSize, FALSE );
+
+		// Reserve the capture frames from the process-wide budget before
+		// the driver allocates them.
+		frameSize = GetFrameBufferSize( seqOut.width, seqOut.height );
+		MemBudgetRelease( pHDec->frameBufMem );
+		pHDec->frameBufMem = 0;
+		outputBufCount = MAX_OUTPUT_BUF;
+		while( !MemBudgetReserve( frameSize * (seqOut.minBuffers + outputBufCount) ) )
+		{
+			if( (NX_BUDGET_POLICY_DOWNGRADE != pHDec->budgetPolicy) || (MIN_OUTPUT_BUF >= outputBufCount) )
+			{
+				GST_ERROR("Decoder memory budget exhausted: %d frames of %" G_GUINT64_FORMAT " bytes do not fit (used %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT ").\n",
+					seqOut.minBuffers + outputBufCount, frameSize, MemBudgetGetUsed(), MemBudgetGetLimit());
+				return DEC_BUDGET_ERR;
+			}
+			outputBufCount--;
+		}
+		if( MAX_OUTPUT_BUF != outputBufCount )
+		{
+			GST_WARNING("Decoder memory budget: output buffers downgraded to %d.\n", outputBufCount);
+		}
+		pHDec->outputBufCount = outputBufCount;
+		pHDec->frameBufMem = frameSize * (seqOut.minBuffers + outputBufCount);
+
 		seqIn.width = seqOut.width;
 		seqIn.height = seqOut.height;
-		pHDec->bufferCountActual = seqOut.minBuffers + MAX_OUTPUT_BUF;
+		pHDec->bufferCountActual = seqOut.minBuffers + outputBufCount;
 		seqIn.numBuffers = pHDec->bufferCountActual;
 		seqIn.imgPlaneNum = pHDec->imgPlaneNum;
-		seqIn.imgFormat = seqOut.imgFourCC;
+		seqIn.imgFormat = pHDec->imgFourcc;
 		ret = NX_V4l2DecInit( pHDec->hCodec, &seqIn );
+		pHDec->capFourcc = pHDec->imgFourcc;
+
+		// a driver which only writes its own layout gets it, the copies
+		// produce the negotiated one and the caps are looked at again
+		if( (0 != ret) && ((guint32)seqOut.imgFourCC != pHDec->imgFourcc) && IsCaptureFourcc( seqOut.imgFourCC ) )
+		{
+			GST_WARNING("NX_V4l2DecInit() refused %s (ret = %d), retrying with the driver's %s\n",
+				gst_video_format_to_string( FourccToVideoFormat( pHDec->imgFourcc ) ), ret,
+				gst_video_format_to_string( FourccToVideoFormat( seqOut.imgFourCC ) ) );
+			seqIn.imgFormat = seqOut.imgFourCC;
+			ret = NX_V4l2DecInit( pHDec->hCodec, &seqIn );
+			if( 0 == ret )
+			{
+				pHDec->capFourcc = seqOut.imgFourCC;
+				pHDec->cfgSerial++;
+			}
+		}
 
 		if( 0 != ret)
 		{
 			GST_ERROR("NX_V4l2DecInit() is failed!!, ret = %d\n", ret);
+			MemBudgetRelease( pHDec->frameBufMem );
+			pHDec->frameBufMem = 0;
 		}
 
 		pHDec->minRequiredFrameBuffer = seqOut.minBuffers;
-		pHDec->pSem = VDecSemCreate( MAX_OUTPUT_BUF );
+		pSem = VDecSemCreate( outputBufCount );
+		pthread_mutex_lock( &pHDec->hwMutex );
+		if( pHDec->bClosed )
+		{
+			VDecSemClose( pSem );
+		}
+		pHDec->pSem = pSem;
+		pthread_mutex_unlock( &pHDec->hwMutex );
 		g_print("<<<<<<<<<< InitializeCodaVpu(Min=%d, %dx%d) (ret = %d) >>>>>>>>>\n",
 			pHDec->minRequiredFrameBuffer, seqOut.width, seqOut.height, ret );
 
@@ -1025,6 +2443,7 @@ NX_VDEC_SEMAPHORE *VDecSemCreate( int init )
 	NX_VDEC_SEMAPHORE *pSem = (NX_VDEC_SEMAPHORE *)g_malloc(sizeof(NX_VDEC_SEMAPHORE));
 	FUNC_IN();
 	pSem->value = init;
+	pSem->bClosed = FALSE;
 	pthread_mutex_init(&pSem->mutex, NULL);
 	pthread_cond_init(&pSem->cond, NULL);
 	FUNC_OUT();
@@ -1048,9 +2467,14 @@ gboolean VDecSemPend( NX_VDEC_SEMAPHORE *pSem )
 	FUNC_IN();
 	pthread_mutex_lock( &pSem->mutex );
 
-	if( pSem->value == 0 ){
+	while( (pSem->value == 0) && !pSem->bClosed ){
 		pthread_cond_wait( &pSem->cond, &pSem->mutex );
 	}
+	if( pSem->bClosed )
+	{
+		pthread_mutex_unlock( &pSem->mutex );
+		return FALSE;
+	}
 	pSem->value --;
 
 	pthread_mutex_unlock( &pSem->mutex );
@@ -1071,12 +2495,13 @@ gboolean VDecSemPost( NX_VDEC_SEMAPHORE *pSem )
 	return TRUE;
 }
 
-gboolean VDecSemSignal( NX_VDEC_SEMAPHORE *pSem )
+//	Fails every wait from now on, the waiters included.
+void VDecSemClose( NX_VDEC_SEMAPHORE *pSem )
 {
 	FUNC_IN();
 	pthread_mutex_lock( &pSem->mutex );
-	pthread_cond_signal( &pSem->cond );
+	pSem->bClosed = TRUE;
+	pthread_cond_broadcast( &pSem->cond );
 	pthread_mutex_unlock( &pSem->mutex );
 	FUNC_OUT();
-	return TRUE;
 }
@@ -1,8 +1,11 @@
 #include <gst/gst.h>
 #include <gst/base/gstbasetransform.h>
+#include <gst/video/video.h>
 #include <nx_video_api.h>
 #include <gstnxvideodec.h>
 #include <videodev2_nxp_media.h>
+#include "arbiter.h"
+#include "budget.h"
 
 #ifndef __DECODER_H__
 #define __DECODER_H__
@@ -25,6 +28,24 @@ enum
 {
 	DEC_INIT_ERR	= -1,
 	DEC_ERR			= -2,
+	DEC_BUDGET_ERR	= -3,
+};
+
+// why the decoder handle was last reopened
+enum
+{
+	NX_RESET_NONE		= 0,
+	NX_RESET_ERRORS		= 1,	// too many consecutive decode errors
+	NX_RESET_TIMEOUT	= 2,	// a decode call took longer than hangTimeout
+	NX_RESET_FORMAT		= 3,	// another capture layout was requested
+};
+
+// de-interlacing applied while copying interlaced pictures
+enum
+{
+	NX_DEINTERLACE_OFF		= 0,
+	NX_DEINTERLACE_BOB		= 1,	// first field, the other one interpolated
+	NX_DEINTERLACE_BLEND	= 2,
 };
 
 enum
@@ -61,6 +82,7 @@ struct OutBufferTimeInfo{
 
 struct _NX_VDEC_SEMAPHORE{
 	guint				value;
+	gboolean			bClosed;		// pending and later waits fail
 	pthread_cond_t		cond;
 	pthread_mutex_t		mutex;
 };
@@ -68,11 +90,25 @@ struct _NX_VDEC_SEMAPHORE{
 typedef struct _NX_VIDEO_DEC_STRUCT NX_VIDEO_DEC_STRUCT;
 typedef struct _NX_VDEC_SEMAPHORE NX_VDEC_SEMAPHORE;
 
+//
+//	The decoder core is shared by the element and every output buffer that
+//	still holds a capture slot. CloseVideoDec() drops the element's
+//	reference; the hardware is released with the last reference.
+//
 struct _NX_VIDEO_DEC_STRUCT
 {
+	gint refCount;
+	gboolean bClosed;				// owner is gone, slots are no longer recycled
+
 	// input stream informations
 	gint width;
 	gint height;
+	gint outWidth;					// negotiated output, smaller when the copy downscales
+	gint outHeight;
+	gint codedWidth;				// decoded picture, 0 until known; width x height
+	gint codedHeight;				// of it at cropX/cropY are visible
+	gint cropX;
+	gint cropY;
 	guint fpsNum;
 	guint fpsDen;
 
@@ -82,12 +118,22 @@ struct _NX_VIDEO_DEC_STRUCT
 	gint codecType;
 	guint8 *pExtraData;
 	gint extraDataSize;
+	gboolean bInbandExtraData;		// pExtraData holds cached in-band headers, not codec data of the caps
 	gint bufferCountActual;
 	gint minRequiredFrameBuffer;
+	gint outputBufCount;			// frames which may be held outside the decoder
 	gboolean bFlush;
 	gboolean bNeedKey;
 	gboolean bNeedIframe;
 	gint imgPlaneNum;
+	guint32 imgFourcc;				// negotiated layout asked of the hardware: V4L2_PIX_FMT_YUV420, NV12 or NV21
+	guint32 capFourcc;				// layout the hardware writes, its own if it refused imgFourcc; 0 before init
+	guint8 *pConvBuf;				// chroma of the capture layout, rearranged into the negotiated one
+	gsize convBufSize;
+	guint32 reqFourcc;				// layout taken on the next reset, 0 = keep
+	gint deinterlace;				// NX_DEINTERLACE_*
+	gboolean bInterlacedStream;		// caps say every picture is interlaced
+	gboolean bTopFieldFirst;
 	gint pos;
 	gint size;
 
@@ -110,14 +156,50 @@ struct _NX_VIDEO_DEC_STRUCT
 	gint frameCount;
 
 	gboolean bIsFlush;
+	gboolean bKeyUnitsOnly;			// key-unit trick mode, every input stands alone
 
 	NX_VDEC_SEMAPHORE *pSem;
+
+	// process-wide VPU scheduling
+	NX_VPU_CLIENT *pVpuClient;
+
+	// process-wide memory budget
+	gint budgetPolicy;
+	guint64 strmBufMem;
+	guint64 frameBufMem;
+
+	// hardware watchdog
+	pthread_mutex_t hwMutex;		// hwCallStart, generation, handle swap on reset
+	gint64 hwCallStart;				// monotonic start of the running decode call, 0 if idle
+	guint hangTimeout;				// msec, 0 = no timeout
+	gint maxErrors;					// consecutive errors before a reset, 0 = never
+	gint consecErrors;
+	gboolean bNeedReset;
+	gint resetReason;
+	guint resetCount;
+	guint64 resetTime;				// usec the last reset took
+	guint generation;				// bumped on reset, stale output is not returned
+	guint8 *pInbandHdr;				// sequence headers seen in-band, for re-init
+	gint inbandHdrSize;
+
+	// idle reclaim
+	gboolean bSuspended;			// handle and staging memory given back, reopened on decode
+	guint suspendCount;
+
+	// configuration the hardware handle was set up for
+	gint cfgCodecType;
+	gint cfgWidth;
+	gint cfgHeight;
+	guint8 *pCfgExtraData;
+	gint cfgExtraDataSize;
+	guint cfgSerial;				// bumped when an in-band header changes the picture size, or the driver the capture layout
 };
 //
 //////////////////////////////////////////////////////////////////////////////
 
 //Find Codec Matching Codec Information
 gint FindCodecInfo( GstVideoCodecState *pState, NX_VIDEO_DEC_STRUCT *pDecHandle );
+gint FindCodecType( GstStructure *pStructure );
 gboolean GetExtraInfo( NX_VIDEO_DEC_STRUCT *pDecHandle, guint8 *pCodecData, gint codecDataSize );
 
 //Video Decoder
@@ -125,10 +207,29 @@ NX_VIDEO_DEC_STRUCT *OpenVideoDec();
 gint InitVideoDec( NX_VIDEO_DEC_STRUCT *pDecHandle );
 gint VideoDecodeFrame( NX_VIDEO_DEC_STRUCT *pDecHandle, GstBuffer *pGstBuf, NX_V4L2DEC_OUT *pDecOut, gboolean bKeyFrame );
 void CloseVideoDec( NX_VIDEO_DEC_STRUCT *pDecHandle );
-
-gint DisplayDone( NX_VIDEO_DEC_STRUCT *pDecHandle, gint v4l2BufferIdx );
+NX_VIDEO_DEC_STRUCT *VideoDecRef( NX_VIDEO_DEC_STRUCT *pDecHandle );
+void VideoDecUnref( NX_VIDEO_DEC_STRUCT *pDecHandle );
+gint CloneVideoDec( NX_VIDEO_DEC_STRUCT *pSrc, NX_VIDEO_DEC_STRUCT **ppDst );
+gint VideoDecodeDrain( NX_VIDEO_DEC_STRUCT *pDecHandle, NX_V4L2DEC_OUT *pDecOut );
+gboolean SuspendVideoDec( NX_VIDEO_DEC_STRUCT *pDecHandle );
+gboolean IsInbandResizeFrame( NX_VIDEO_DEC_STRUCT *pDecHandle, const guint8 *pData, gint size, gboolean bKeyFrame );
+gboolean IsRandomAccessPoint( NX_VIDEO_DEC_STRUCT *pDecHandle, guint8 *pData, gint size );
+gboolean ParseVisibleArea( NX_VIDEO_DEC_STRUCT *pDecHandle, const guint8 *pData, gint size, gboolean bResize );
+gboolean IsCroppedPicture( NX_VIDEO_DEC_STRUCT *pDecHandle );
+void GetCodedSize( NX_VIDEO_DEC_STRUCT *pDecHandle, gint *pWidth, gint *pHeight );
+gint GetDecodedPlanes( NX_VIDEO_DEC_STRUCT *pDecHandle, NX_V4L2DEC_OUT *pDecOut, guint8 **ppPlane, gint *pStride );
+GstVideoFormat GetDecodedFormat( NX_VIDEO_DEC_STRUCT *pDecHandle );
+GstVideoFormat GetCaptureFormat( NX_VIDEO_DEC_STRUCT *pDecHandle );
+gboolean IsConvertedPicture( NX_VIDEO_DEC_STRUCT *pDecHandle );
+guint32 VideoFormatToFourcc( GstVideoFormat format );
+void RequestDecodedFormat( NX_VIDEO_DEC_STRUCT *pDecHandle, GstVideoFormat format );
+void CopyDecodedPicture( NX_VIDEO_DEC_STRUCT *pDecHandle, NX_V4L2DEC_OUT *pDecOut, GstVideoFrame *pFrame );
+gboolean IsInterlacedPicture( NX_VIDEO_DEC_STRUCT *pDecHandle, NX_V4L2DEC_OUT *pDecOut );
+void SetInterlaceFlags( NX_VIDEO_DEC_STRUCT *pDecHandle, NX_V4L2DEC_OUT *pDecOut, GstBuffer *pBuffer );
+
+gint DisplayDone( NX_VIDEO_DEC_STRUCT *pDecHandle, gint v4l2BufferIdx, guint generation );
+gint64 GetHwCallElapsed( NX_VIDEO_DEC_STRUCT *pDecHandle );
 gint GetTimeStamp( NX_VIDEO_DEC_STRUCT *pDecHandle, gint64 *pTimestamp );
-gint CopyImageToBufferYV12( uint8_t *pSrcY, uint8_t *pSrcU, uint8_t *pSrcV, uint8_t *pDst, uint32_t strideY, uint32_t strideUV, uint32_t width, uint32_t height );
 
 //
 //	Semaphore functions for output buffer.
@@ -137,7 +238,7 @@ NX_VDEC_SEMAPHORE *VDecSemCreate( int init );
 void VDecSemDestroy( NX_VDEC_SEMAPHORE *pSem );
 gboolean VDecSemPend( NX_VDEC_SEMAPHORE *pSem );
 gboolean VDecSemPost( NX_VDEC_SEMAPHORE *pSem );
-gboolean VDecSemSignal( NX_VDEC_SEMAPHORE *pSem );
+void VDecSemClose( NX_VDEC_SEMAPHORE *pSem );
 
 G_END_DECLS
 
@@ -0,0 +1,72 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "gstnxalignedallocator.h"
+
+G_DEFINE_TYPE (GstNxAlignedAllocator, gst_nxaligned_allocator, GST_TYPE_ALLOCATOR);
+
+static GstMemory *
+gst_nxaligned_allocator_alloc (GstAllocator *pAllocator, gsize size, GstAllocationParams *pParams)
+{
+	gsize maxSize = size + pParams->prefix + pParams->padding;
+	gsize align = MAX( pParams->align + 1, NX_ALIGNED_MIN_ALIGN );
+	gpointer pData = NULL;
+	gint err;
+
+	if( NX_ALIGNED_HUGE_PAGE <= maxSize )
+	{
+		align = MAX( align, NX_ALIGNED_HUGE_PAGE );
+	}
+
+	err = posix_memalign( &pData, align, maxSize );
+	if( 0 != err )
+	{
+		GST_ERROR("failed to allocate %" G_GSIZE_FORMAT " bytes(%s)", maxSize, strerror(err));
+		return NULL;
+	}
+
+#ifdef MADV_HUGEPAGE
+	// only whole huge pages inside the memory can be backed, the tail
+	// stays on small pages; a kernel without THP just says no
+	if( (NX_ALIGNED_HUGE_PAGE <= maxSize) && (0 != madvise( pData, maxSize, MADV_HUGEPAGE )) )
+	{
+		GST_DEBUG("no transparent huge pages(%s)", strerror(errno));
+	}
+#endif
+
+	if( pParams->flags & GST_MEMORY_FLAG_ZERO_PREFIXED )
+	{
+		memset( pData, 0, pParams->prefix );
+	}
+	if( pParams->flags & GST_MEMORY_FLAG_ZERO_PADDED )
+	{
+		memset( (guint8 *)pData + pParams->prefix + size, 0, pParams->padding );
+	}
+
+	return gst_memory_new_wrapped( pParams->flags, pData, maxSize, pParams->prefix, size, pData, free );
+}
+
+static void
+gst_nxaligned_allocator_class_init (GstNxAlignedAllocatorClass *pKlass)
+{
+	GstAllocatorClass *pAllocatorClass = GST_ALLOCATOR_CLASS (pKlass);
+
+	pAllocatorClass->alloc = gst_nxaligned_allocator_alloc;
+}
+
+static void
+gst_nxaligned_allocator_init (GstNxAlignedAllocator *pAllocator)
+{
+}
+
+GstAllocator *
+gst_nxaligned_allocator_new (void)
+{
+	return (GstAllocator *)g_object_new( GST_TYPE_NXALIGNED_ALLOCATOR, NULL );
+}
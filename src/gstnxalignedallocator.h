@@ -0,0 +1,39 @@
+#include <gst/gst.h>
+
+#ifndef __GST_NXALIGNEDALLOCATOR_H__
+#define __GST_NXALIGNEDALLOCATOR_H__
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_NXALIGNED_ALLOCATOR   (gst_nxaligned_allocator_get_type())
+
+typedef struct _GstNxAlignedAllocator GstNxAlignedAllocator;
+typedef struct _GstNxAlignedAllocatorClass GstNxAlignedAllocatorClass;
+
+#define	NX_ALIGNED_MIN_ALIGN		64					// bytes, a cache line and any SIMD register
+#define	NX_ALIGNED_HUGE_PAGE		(2 * 1024 * 1024)	// transparent huge page size on arm64 and x86
+
+//
+//	System memory for copied frames: every memory starts on a cache line,
+//	and memories of at least a huge page start on a huge page boundary and
+//	are advised for transparent huge pages, so a 1080p frame is walked
+//	with a couple of TLB entries. The memories themselves are plain
+//	wrapped system memory, anything that maps them keeps working.
+//
+struct _GstNxAlignedAllocator
+{
+	GstAllocator parent;
+};
+
+struct _GstNxAlignedAllocatorClass
+{
+	GstAllocatorClass parent_class;
+};
+
+GType gst_nxaligned_allocator_get_type (void);
+
+GstAllocator *gst_nxaligned_allocator_new (void);
+
+G_END_DECLS
+
+#endif // __GST_NXALIGNEDALLOCATOR_H__
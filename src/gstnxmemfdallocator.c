@@ -0,0 +1,98 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "gstnxmemfdallocator.h"
+
+// older C libraries lack the wrapper and the flags, the kernel has had them since 3.17
+#ifndef MFD_CLOEXEC
+#define	MFD_CLOEXEC				0x0001U
+#define	MFD_ALLOW_SEALING		0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define	F_ADD_SEALS				1033
+#define	F_SEAL_SEAL				0x0001
+#define	F_SEAL_SHRINK			0x0002
+#define	F_SEAL_GROW				0x0004
+#endif
+
+G_DEFINE_TYPE (GstNxMemfdAllocator, gst_nxmemfd_allocator, GST_TYPE_FD_ALLOCATOR);
+
+static gint
+nxmemfd_create (gsize size)
+{
+	gint fd;
+
+	fd = (gint)syscall( SYS_memfd_create, "nxvideodec", MFD_CLOEXEC | MFD_ALLOW_SEALING );
+	if( 0 > fd )
+	{
+		GST_ERROR("memfd_create failed(%s)", strerror(errno));
+		return -1;
+	}
+
+	if( 0 != ftruncate( fd, (off_t)size ) )
+	{
+		GST_ERROR("failed to size memfd to %" G_GSIZE_FORMAT " bytes(%s)", size, strerror(errno));
+		close( fd );
+		return -1;
+	}
+
+	// the contents stay writable, the pool rewrites them for every frame
+	if( 0 != fcntl( fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL ) )
+	{
+		GST_WARNING("failed to seal memfd(%s)", strerror(errno));
+	}
+
+	return fd;
+}
+
+static GstMemory *
+gst_nxmemfd_allocator_alloc (GstAllocator *pAllocator, gsize size, GstAllocationParams *pParams)
+{
+	GstMemory *pMem = NULL;
+	gsize maxSize = size + pParams->prefix + pParams->padding;
+	gint fd;
+
+	// mmap() hands out page aligned memory, which covers any alignment asked for
+	fd = nxmemfd_create( maxSize );
+	if( 0 > fd )
+	{
+		return NULL;
+	}
+
+	pMem = gst_fd_allocator_alloc( pAllocator, fd, maxSize, GST_FD_MEMORY_FLAG_KEEP_MAPPED );
+	if( NULL == pMem )
+	{
+		close( fd );
+		return NULL;
+	}
+	gst_memory_resize( pMem, pParams->prefix, size );
+
+	return pMem;
+}
+
+static void
+gst_nxmemfd_allocator_class_init (GstNxMemfdAllocatorClass *pKlass)
+{
+	GstAllocatorClass *pAllocatorClass = GST_ALLOCATOR_CLASS (pKlass);
+
+	pAllocatorClass->alloc = gst_nxmemfd_allocator_alloc;
+}
+
+// keeps the fd memory type, receivers only look for fd memory
+static void
+gst_nxmemfd_allocator_init (GstNxMemfdAllocator *pAllocator)
+{
+}
+
+GstAllocator *
+gst_nxmemfd_allocator_new (void)
+{
+	return (GstAllocator *)g_object_new( GST_TYPE_NXMEMFD_ALLOCATOR, NULL );
+}
@@ -0,0 +1,38 @@
+#include <gst/gst.h>
+
+#ifndef __GST_NXMEMFDALLOCATOR_H__
+#define __GST_NXMEMFDALLOCATOR_H__
+
+#include <gst/allocators/gstfdmemory.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_NXMEMFD_ALLOCATOR   (gst_nxmemfd_allocator_get_type())
+
+typedef struct _GstNxMemfdAllocator GstNxMemfdAllocator;
+typedef struct _GstNxMemfdAllocatorClass GstNxMemfdAllocatorClass;
+
+//
+//	Fd memories backed by anonymous memfds, for copied frames that other
+//	processes receive by fd (unixfdsink, or anything that passes the fd of
+//	a GstFdMemory). Every memfd is sealed against shrinking and growing,
+//	so a receiver may map it without guarding against SIGBUS. Buffers are
+//	recycled by the buffer pool the allocator is configured on.
+//
+struct _GstNxMemfdAllocator
+{
+	GstFdAllocator parent;
+};
+
+struct _GstNxMemfdAllocatorClass
+{
+	GstFdAllocatorClass parent_class;
+};
+
+GType gst_nxmemfd_allocator_get_type (void);
+
+GstAllocator *gst_nxmemfd_allocator_new (void);
+
+G_END_DECLS
+
+#endif // __GST_NXMEMFDALLOCATOR_H__
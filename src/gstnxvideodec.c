@@ -64,13 +64,16 @@
 #include <gst/gst.h>
 #include <gst/video/video.h>
 #include <gst/video/gstvideodecoder.h>
+#include <gst/allocators/gstdmabuf.h>
 #include <gstmmvideobuffermeta.h>
 #include <linux/videodev2.h>
 #include "gstnxvideodec.h"
-
-// This SUPPORT_NO_MEMORY_COPY function is disabled now.
-// if the video decoder mmap is supported this function, it will be enabled.
-#define SUPPORT_NO_MEMORY_COPY	0
+#include "gstnxvideodecpool.h"
+#include "gstnxmemfdallocator.h"
+#include "gstnxalignedallocator.h"
+#include "gstnxvideomosaic.h"
+#include "copy.h"
+#include "warm.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_nxvideodec_debug_category);
 #define GST_CAT_DEFAULT gst_nxvideodec_debug_category
@@ -81,52 +84,101 @@ static void gst_nxvideodec_set_property (GObject * object,
 static void gst_nxvideodec_get_property (GObject * object,
 		guint property_id, GValue * value, GParamSpec * pspec);
 
+static gboolean gst_nxvideodec_open (GstVideoDecoder * decoder);
+static gboolean gst_nxvideodec_close (GstVideoDecoder * decoder);
 static gboolean gst_nxvideodec_start (GstVideoDecoder * decoder);
 static gboolean gst_nxvideodec_stop (GstVideoDecoder * decoder);
 static gboolean gst_nxvideodec_set_format (GstVideoDecoder * decoder,
 		GstVideoCodecState * state);
 static gboolean gst_nxvideodec_flush (GstVideoDecoder * decoder);
+static GstFlowReturn gst_nxvideodec_finish (GstVideoDecoder * decoder);
+static GstFlowReturn gst_nxvideodec_drain (GstVideoDecoder * decoder);
+static gboolean gst_nxvideodec_decide_allocation (GstVideoDecoder * decoder,
+		GstQuery * query);
 static GstFlowReturn gst_nxvideodec_handle_frame (GstVideoDecoder * decoder,
 		GstVideoCodecFrame * frame);
 static void nxvideodec_base_init (gpointer gclass);
-static void nxvideodec_buffer_finalize(gpointer pData);
-static GstMemory *nxvideodec_mmvideobuf_copy(NX_V4L2DEC_OUT *pDecOut);
+static void nxvideodec_update_stream_thread_attr (GstNxVideoDec *pNxVideoDec);
+static gboolean nxvideodec_can_decode_parallel (GstNxVideoDec *pNxVideoDec);
+static GstFlowReturn nxvideodec_handle_frame_parallel (GstNxVideoDec *pNxVideoDec, GstVideoCodecFrame *pFrame);
+static GstFlowReturn nxvideodec_handle_frame_serial (GstNxVideoDec *pNxVideoDec, GstVideoCodecFrame *pFrame);
+static gpointer nxvideodec_watchdog_thread (gpointer pData);
+static void nxvideodec_check_reset (GstNxVideoDec *pNxVideoDec);
+static void nxvideodec_drop_slot_pool (GstNxVideoDec *pNxVideoDec);
+static gboolean nxvideodec_peer_accepts_dmabuf (GstNxVideoDec *pNxVideoDec);
+static GstVideoFormat nxvideodec_choose_format (GstNxVideoDec *pNxVideoDec, gboolean bDmaBuf);
+static void nxvideodec_choose_size (GstNxVideoDec *pNxVideoDec, GstVideoFormat format, gint *pWidth, gint *pHeight);
+static gboolean nxvideodec_copy_on_hold (GstNxVideoDec *pNxVideoDec);
+static void nxvideodec_set_mixed_interlace (GstNxVideoDec *pNxVideoDec);
+static void nxvideodec_draw_mosaic (GstNxVideoDec *pNxVideoDec, NX_V4L2DEC_OUT *pDecOut, gint64 timeStamp);
+static gboolean nxvideodec_wait_mosaic (GstNxVideoDec *pNxVideoDec, gint64 timeStamp);
+static void nxvideodec_set_mosaic_flushing (GstNxVideoDec *pNxVideoDec, gboolean bFlushing);
+static gboolean gst_nxvideodec_sink_event (GstVideoDecoder *pDecoder, GstEvent *pEvent);
+static GstStateChangeReturn gst_nxvideodec_change_state (GstElement *pElement, GstStateChange transition);
+static void gst_nxvideodec_finalize (GObject *pObject);
+static gboolean nxvideodec_is_decode_only (GstNxVideoDec *pNxVideoDec, GstVideoCodecFrame *pFrame, gint64 timeStamp);
+static gboolean nxvideodec_skip_key_unit_delta (GstNxVideoDec *pNxVideoDec, GstVideoCodecFrame *pFrame);
+static void nxvideodec_set_key_unit_duration (GstNxVideoDec *pNxVideoDec, GstVideoCodecFrame *pFrame, gint64 timeStamp);
+static gboolean nxvideodec_holds_gem_slots (GstNxVideoDec *pNxVideoDec);
+static gboolean nxvideodec_reclaim (GstNxVideoDec *pNxVideoDec, gint64 idleTime);
+static gboolean nxvideodec_set_format (GstNxVideoDec *pNxVideoDec, GstVideoCodecState *pState);
+static gboolean nxvideodec_set_output_state (GstNxVideoDec *pNxVideoDec);
+static GstFlowReturn nxvideodec_output_picture (GstNxVideoDec *pNxVideoDec, GstVideoCodecFrame *pFrame, NX_V4L2DEC_OUT *pDecOut);
+static GstFlowReturn nxvideodec_drain_serial (GstNxVideoDec *pNxVideoDec, GstVideoCodecFrame *pCurrent, gboolean bRestart);
+static gboolean nxvideodec_caps_need_reopen (GstVideoCodecState *pOld, GstVideoCodecState *pNew);
+static gboolean nxvideodec_reclaim_action (GstNxVideoDec *pNxVideoDec);
 
-#if SUPPORT_NO_MEMORY_COPY
-static void nxvideodec_get_offset_stride(gint width, gint height, guint8 *pSrc, gsize *pOffset, gint *pStride );
 enum
 {
 	PROP_0,
+	PROP_TYPE,	//0: 1:MM_VIDEO_BUFFER_TYPE_GEM
+	PROP_SCHED_POLICY,
+	PROP_SCHED_PRIORITY,
+	PROP_CPU_AFFINITY,
+	PROP_VPU_WEIGHT,
+	PROP_VPU_MAX_INFLIGHT,
+	PROP_VPU_STATS,
+	PROP_MEMORY_BUDGET,
+	PROP_MEMORY_BUDGET_POLICY,
+	PROP_PARALLEL_INSTANCES,
+	PROP_PARALLEL_WINDOW,
+	PROP_WATCHDOG_TIMEOUT,
+	PROP_WATCHDOG_MAX_ERRORS,
+	PROP_COPY_WATERMARK,
+	PROP_OUTPUT_STATS,
+	PROP_COPY_THREADS,
+	PROP_COPY_MIN_SIZE,
+	PROP_DEINTERLACE,
+	PROP_COPY_MEMORY,
+	PROP_MOSAIC,
+	PROP_MOSAIC_TILE,
+	PROP_IDLE_RECLAIM,
+	PROP_PREWARM,
 };
-#else
 enum
 {
-	PROP_0,
-	PROP_TYPE	//0: 1:MM_VIDEO_BUFFER_TYPE_GEM
+	SIGNAL_RECLAIM,
+	LAST_SIGNAL
 };
 enum
 {
 	BUFFER_TYPE_NORMAL,
 	BUFFER_TYPE_GEM
 };
-#endif
 
-enum
-{
-	STOP,
-	PLAY
-};
+#define	WATCHDOG_TIMEOUT_DEFAULT		2000	// msec
+#define	WATCHDOG_MAX_ERRORS_DEFAULT		30
+#define	WATCHDOG_POLL_MAX				500		// msec
+
+static guint gstNxVideoDecSignals[LAST_SIGNAL] = { 0 };
+
+#define	COPY_WATERMARK_DEFAULT			1
+#define	REVERSE_WATERMARK				2		// the picture handed out plus one to decode into
 
 #ifndef ALIGN
 #define  ALIGN(X,N) ( (X+N-1) & (~(N-1)) )
 #endif
 
-struct video_meta_mmap_buffer
-{
-	gint v4l2BufferIdx;
-	GstNxVideoDec *pNxVideoDec;
-};
-
 #define	PLUGIN_LONG_NAME		"S5P6818 H/W Video Decoder"
 #define PLUGIN_DESC				"Nexell H/W Video Decoder for S5P6818, Version: 0.1.0"
 #define	PLUGIN_AUTHOR			"Hyun Chul Jun <hcjun@nexell.co.kr>"
@@ -136,8 +188,12 @@ static GstStaticPadTemplate gst_nxvideodec_src_template =
 GST_STATIC_PAD_TEMPLATE ("src",
 		GST_PAD_SRC,
 		GST_PAD_ALWAYS,
-		GST_STATIC_CAPS ("video/x-raw, "
-						 "format = (string) { I420 }, "
+		GST_STATIC_CAPS ("video/x-raw(memory:DMABuf), "
+						 "format = (string) { NV12, NV21, I420 }, "
+						 "width = (int) [ 64, 1920 ], "
+						"height = (int) [ 64, 1088 ]; "
+						"video/x-raw, "
+						 "format = (string) { NV12, NV21, I420 }, "
 						 "width = (int) [ 64, 1920 ], "
 						"height = (int) [ 64, 1088 ] "
 										)
@@ -248,27 +304,174 @@ gst_nxvideodec_class_init (GstNxVideoDecClass * pKlass)
 	FUNC_IN();
 
 	GObjectClass *pGobjectClass = G_OBJECT_CLASS (pKlass);
+	GstElementClass *pElementClass = GST_ELEMENT_CLASS (pKlass);
 	GstVideoDecoderClass *pVideoDecoderClass = GST_VIDEO_DECODER_CLASS (pKlass);
 
 	nxvideodec_base_init(pKlass);
 
 	pGobjectClass->set_property = gst_nxvideodec_set_property;
 	pGobjectClass->get_property = gst_nxvideodec_get_property;
+	pGobjectClass->finalize = gst_nxvideodec_finalize;
 
+	pElementClass->change_state = GST_DEBUG_FUNCPTR (gst_nxvideodec_change_state);
+
+	pVideoDecoderClass->open = GST_DEBUG_FUNCPTR (gst_nxvideodec_open);
+	pVideoDecoderClass->close = GST_DEBUG_FUNCPTR (gst_nxvideodec_close);
 	pVideoDecoderClass->start = GST_DEBUG_FUNCPTR (gst_nxvideodec_start);
 	pVideoDecoderClass->stop = GST_DEBUG_FUNCPTR (gst_nxvideodec_stop);
 
 	pVideoDecoderClass->set_format = GST_DEBUG_FUNCPTR (gst_nxvideodec_set_format);
 	pVideoDecoderClass->flush = GST_DEBUG_FUNCPTR (gst_nxvideodec_flush);
+	pVideoDecoderClass->finish = GST_DEBUG_FUNCPTR (gst_nxvideodec_finish);
+	pVideoDecoderClass->drain = GST_DEBUG_FUNCPTR (gst_nxvideodec_drain);
+	pVideoDecoderClass->decide_allocation = GST_DEBUG_FUNCPTR (gst_nxvideodec_decide_allocation);
 	pVideoDecoderClass->handle_frame = GST_DEBUG_FUNCPTR (gst_nxvideodec_handle_frame);
+	pVideoDecoderClass->sink_event = GST_DEBUG_FUNCPTR (gst_nxvideodec_sink_event);
 
-#if SUPPORT_NO_MEMORY_COPY
-#else
 	g_object_class_install_property (
 		pGobjectClass,
 		PROP_TYPE,
 		g_param_spec_int ("buffer-type", "buffer-type", "Buffer Type(0:NORMAL 1:MM_VIDEO_BUFFER_TYPE_GEM)", 0, 1, BUFFER_TYPE_GEM, G_PARAM_READWRITE));
-#endif
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_SCHED_POLICY,
+		g_param_spec_int ("sched-policy", "sched-policy", "Decoder Thread Scheduling Policy(0:INHERIT 1:OTHER 2:FIFO 3:RR)",
+			NX_SCHED_INHERIT, NX_SCHED_RR, NX_SCHED_INHERIT, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_SCHED_PRIORITY,
+		g_param_spec_int ("sched-priority", "sched-priority", "Decoder Thread Real-Time Priority(used with FIFO and RR)",
+			0, NX_SCHED_PRIORITY_MAX, 0, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_CPU_AFFINITY,
+		g_param_spec_string ("cpu-affinity", "cpu-affinity", "CPUs the decoder threads may run on, e.g. \"4-7\" (empty: no pinning)",
+			"", G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_VPU_WEIGHT,
+		g_param_spec_int ("vpu-weight", "vpu-weight", "Share of VPU time relative to other decoder instances",
+			1, NX_VPU_WEIGHT_MAX, NX_VPU_WEIGHT_DEFAULT, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_VPU_MAX_INFLIGHT,
+		g_param_spec_int ("vpu-max-inflight", "vpu-max-inflight", "Maximum concurrent VPU decode calls of this instance and its parallel-instances(0:unlimited)",
+			0, NX_VPU_MAX_INFLIGHT, 0, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_VPU_STATS,
+		g_param_spec_boxed ("vpu-stats", "vpu-stats", "VPU arbiter statistics of this instance",
+			GST_TYPE_STRUCTURE, G_PARAM_READABLE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_MEMORY_BUDGET,
+		g_param_spec_uint64 ("memory-budget", "memory-budget", "Process-wide decoder memory budget in bytes, shared by all instances(0:unlimited)",
+			0, G_MAXUINT64, 0, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_MEMORY_BUDGET_POLICY,
+		g_param_spec_int ("memory-budget-policy", "memory-budget-policy", "Out of Budget Policy(0:REFUSE 1:DOWNGRADE to fewer output buffers)",
+			NX_BUDGET_POLICY_REFUSE, NX_BUDGET_POLICY_DOWNGRADE, NX_BUDGET_POLICY_DOWNGRADE, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_PARALLEL_INSTANCES,
+		g_param_spec_int ("parallel-instances", "parallel-instances", "Offline Mode: decode closed GOPs concurrently on N hardware instances(0,1:off)",
+			0, NX_GOP_MAX_INSTANCES, 0, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_PARALLEL_WINDOW,
+		g_param_spec_int ("parallel-window", "parallel-window", "Offline Mode: maximum GOPs in flight(0:same as parallel-instances)",
+			0, NX_GOP_MAX_WINDOW, 0, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_WATCHDOG_TIMEOUT,
+		g_param_spec_uint ("watchdog-timeout", "watchdog-timeout", "Reset the decoder when one hardware call takes longer than this, in msec(0:off)",
+			0, G_MAXUINT, WATCHDOG_TIMEOUT_DEFAULT, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_WATCHDOG_MAX_ERRORS,
+		g_param_spec_int ("watchdog-max-errors", "watchdog-max-errors", "Reset the decoder after this many consecutive decode errors(0:off)",
+			0, G_MAXINT, WATCHDOG_MAX_ERRORS_DEFAULT, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_COPY_WATERMARK,
+		g_param_spec_int ("copy-watermark", "copy-watermark", "Copy frames instead of holding capture buffers while fewer than this many are free for downstream(0:never copy)",
+			0, NX_MAX_BUF, COPY_WATERMARK_DEFAULT, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_OUTPUT_STATS,
+		g_param_spec_boxed ("output-stats", "output-stats", "Zero-copy, copied and skipped (decode-only) output frame counts",
+			GST_TYPE_STRUCTURE, G_PARAM_READABLE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_COPY_THREADS,
+		g_param_spec_int ("copy-threads", "copy-threads", "Process-wide helper threads for frame copies, shared by all instances(-1:one per extra CPU 0:copy on the streaming thread)",
+			NX_COPY_THREADS_AUTO, NX_COPY_MAX_THREADS, NX_COPY_THREADS_AUTO, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_COPY_MIN_SIZE,
+		g_param_spec_uint ("copy-min-size", "copy-min-size", "Pictures smaller than this many bytes are copied on the streaming thread alone",
+			0, G_MAXUINT, NX_COPY_MIN_SIZE_DEFAULT, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_DEINTERLACE,
+		g_param_spec_int ("deinterlace", "deinterlace", "De-interlace interlaced pictures while copying them out, applied with the next caps(0:off 1:bob 2:blend)",
+			NX_DEINTERLACE_OFF, NX_DEINTERLACE_BLEND, NX_DEINTERLACE_OFF, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_COPY_MEMORY,
+		g_param_spec_int ("copy-memory", "copy-memory", "Memory copied frames are written to, applied with the next allocation(0:heap 1:sealed memfd, shareable by fd)",
+			NX_COPY_MEMORY_HEAP, NX_COPY_MEMORY_MEMFD, NX_COPY_MEMORY_HEAP, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_MOSAIC,
+		g_param_spec_string ("mosaic", "mosaic", "Name of the nxvideomosaic element to draw pictures into instead of pushing them, applied on start (empty: off)",
+			NULL, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_MOSAIC_TILE,
+		g_param_spec_int ("mosaic-tile", "mosaic-tile", "Tile of the mosaic canvas the pictures go to, row-major",
+			0, NX_MOSAIC_MAX_TILES - 1, 0, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_IDLE_RECLAIM,
+		g_param_spec_uint ("idle-reclaim", "idle-reclaim", "Release the capture buffers and stream staging memory after this many msec in PAUSED without decoding, resuming at the next key frame(0:never)",
+			0, G_MAXUINT, 0, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_PREWARM,
+		g_param_spec_string ("prewarm", "prewarm", "Caps of the codec to keep a hardware handle opened ahead for, shared by all decoders of the process, applied on open (e.g. video/x-h264, empty: off)",
+			NULL, G_PARAM_READWRITE));
+
+	// releases the same memory right away, whatever the state; FALSE while
+	// a picture is being decoded, a GEM picture is held downstream or
+	// nothing is held
+	gstNxVideoDecSignals[SIGNAL_RECLAIM] =
+		g_signal_new_class_handler ("reclaim", G_TYPE_FROM_CLASS (pKlass),
+			G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION, G_CALLBACK (nxvideodec_reclaim_action),
+			NULL, NULL, NULL, G_TYPE_BOOLEAN, 0);
 
 	FUNC_OUT();
 }
@@ -282,17 +485,68 @@ gst_nxvideodec_init (GstNxVideoDec *pNxVideoDec)
 
 	// Initialize variables
 	pNxVideoDec->pNxVideoDecHandle = NULL;
+	pNxVideoDec->cfgSerialSeen = 0;
 	pNxVideoDec->pInputState = NULL;
-	pNxVideoDec->isState = STOP;
-#if SUPPORT_NO_MEMORY_COPY
-#else
+	pNxVideoDec->pSlotPool = NULL;
+	pNxVideoDec->bDmaBufOut = FALSE;
+	pNxVideoDec->bVideoMetaOut = FALSE;
+	pNxVideoDec->bCropMetaOut = FALSE;
+	pNxVideoDec->bScaledOut = FALSE;
+	pNxVideoDec->bInterlacedOut = FALSE;
+	pNxVideoDec->deinterlace = NX_DEINTERLACE_OFF;
+	pNxVideoDec->copyMemory = NX_COPY_MEMORY_HEAP;
+	pNxVideoDec->pMosaicName = NULL;
+	pNxVideoDec->mosaicTile = 0;
+	pNxVideoDec->pMosaic = NULL;
+	pNxVideoDec->copyWatermark = COPY_WATERMARK_DEFAULT;
+	pNxVideoDec->bCopyOnHold = FALSE;
+	pNxVideoDec->zeroCopyFrames = 0;
+	pNxVideoDec->copiedFrames = 0;
+	pNxVideoDec->skippedFrames = 0;
+	pNxVideoDec->lastKeyUnitTime = GST_CLOCK_TIME_NONE;
+	pNxVideoDec->copySwitches = 0;
 	pNxVideoDec->bufferType = BUFFER_TYPE_GEM;
-#endif
-	pthread_mutex_init(&pNxVideoDec->mutex, NULL);
+	ThreadAttrInit( &pNxVideoDec->threadAttr );
+	pNxVideoDec->streamAttrSerial = 0;
+	pNxVideoDec->streamThread = pthread_self();
+	pNxVideoDec->vpuWeight = NX_VPU_WEIGHT_DEFAULT;
+	pNxVideoDec->vpuMaxInFlight = 0;
+	pNxVideoDec->budgetPolicy = NX_BUDGET_POLICY_DOWNGRADE;
+	pNxVideoDec->parallelInstances = 0;
+	pNxVideoDec->parallelWindow = 0;
+	pNxVideoDec->pGopDec = NULL;
+	pNxVideoDec->watchdogTimeout = WATCHDOG_TIMEOUT_DEFAULT;
+	pNxVideoDec->watchdogMaxErrors = WATCHDOG_MAX_ERRORS_DEFAULT;
+	pNxVideoDec->resetCountSeen = 0;
+	pNxVideoDec->pWatchdogThread = NULL;
+	pNxVideoDec->bWatchdogRun = FALSE;
+	g_mutex_init( &pNxVideoDec->watchdogLock );
+	g_cond_init( &pNxVideoDec->watchdogCond );
+	g_mutex_init( &pNxVideoDec->decodeLock );
+	pNxVideoDec->lastDecodeTime = 0;
+	pNxVideoDec->idleReclaim = 0;
+	pNxVideoDec->pPrewarm = NULL;
+	pNxVideoDec->prewarmCodec = -1;
 
 	FUNC_OUT();
 }
 
+static void
+gst_nxvideodec_finalize (GObject *pObject)
+{
+	GstNxVideoDec *pNxVideoDec = GST_NXVIDEODEC (pObject);
+
+	g_free( pNxVideoDec->pMosaicName );
+	pNxVideoDec->pMosaicName = NULL;
+	g_free( pNxVideoDec->pPrewarm );
+	pNxVideoDec->pPrewarm = NULL;
+	g_mutex_clear( &pNxVideoDec->decodeLock );
+	g_mutex_clear( &pNxVideoDec->watchdogLock );
+	g_cond_clear( &pNxVideoDec->watchdogCond );
+
+	G_OBJECT_CLASS (gst_nxvideodec_parent_class)->finalize (pObject);
+}
+
 void
 gst_nxvideodec_set_property (GObject *pObject, guint propertyId,
 		const GValue *pValue, GParamSpec *pPspec)
@@ -304,12 +558,124 @@ gst_nxvideodec_set_property (GObject *pObject, guint propertyId,
 
 	switch (propertyId)
 	{
-#if SUPPORT_NO_MEMORY_COPY
-#else
 		case PROP_TYPE:
 			pNxvideodec->bufferType = g_value_get_int(pValue);
 			break;
-#endif
+		case PROP_SCHED_POLICY:
+			GST_OBJECT_LOCK( pNxvideodec );
+			pNxvideodec->threadAttr.policy = g_value_get_int(pValue);
+			pNxvideodec->threadAttr.serial = ThreadAttrNewSerial();
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			break;
+		case PROP_SCHED_PRIORITY:
+			GST_OBJECT_LOCK( pNxvideodec );
+			pNxvideodec->threadAttr.priority = g_value_get_int(pValue);
+			pNxvideodec->threadAttr.serial = ThreadAttrNewSerial();
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			break;
+		case PROP_CPU_AFFINITY:
+		{
+			guint64 cpuMask = 0;
+			if( !ThreadAttrParseCpuList( g_value_get_string(pValue), &cpuMask ) )
+			{
+				GST_WARNING_OBJECT( pNxvideodec, "invalid cpu-affinity \"%s\"", g_value_get_string(pValue) );
+				break;
+			}
+			GST_OBJECT_LOCK( pNxvideodec );
+			pNxvideodec->threadAttr.cpuMask = cpuMask;
+			pNxvideodec->threadAttr.serial = ThreadAttrNewSerial();
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			break;
+		}
+		case PROP_VPU_WEIGHT:
+			GST_OBJECT_LOCK( pNxvideodec );
+			pNxvideodec->vpuWeight = g_value_get_int(pValue);
+			if( pNxvideodec->pNxVideoDecHandle && pNxvideodec->pNxVideoDecHandle->pVpuClient )
+				VpuArbiterSetWeight( pNxvideodec->pNxVideoDecHandle->pVpuClient, pNxvideodec->vpuWeight );
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			break;
+		case PROP_VPU_MAX_INFLIGHT:
+			GST_OBJECT_LOCK( pNxvideodec );
+			pNxvideodec->vpuMaxInFlight = g_value_get_int(pValue);
+			if( pNxvideodec->pNxVideoDecHandle && pNxvideodec->pNxVideoDecHandle->pVpuClient )
+				VpuArbiterSetMaxInFlight( pNxvideodec->pNxVideoDecHandle->pVpuClient, pNxvideodec->vpuMaxInFlight );
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			break;
+		case PROP_MEMORY_BUDGET:
+			MemBudgetSetLimit( g_value_get_uint64(pValue) );
+			break;
+		case PROP_MEMORY_BUDGET_POLICY:
+			GST_OBJECT_LOCK( pNxvideodec );
+			pNxvideodec->budgetPolicy = g_value_get_int(pValue);
+			if( pNxvideodec->pNxVideoDecHandle )
+				pNxvideodec->pNxVideoDecHandle->budgetPolicy = pNxvideodec->budgetPolicy;
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			break;
+		// both take effect with the next caps
+		case PROP_PARALLEL_INSTANCES:
+			pNxvideodec->parallelInstances = g_value_get_int(pValue);
+			break;
+		case PROP_PARALLEL_WINDOW:
+			pNxvideodec->parallelWindow = g_value_get_int(pValue);
+			break;
+		case PROP_WATCHDOG_TIMEOUT:
+			GST_OBJECT_LOCK( pNxvideodec );
+			pNxvideodec->watchdogTimeout = g_value_get_uint(pValue);
+			if( pNxvideodec->pNxVideoDecHandle )
+				pNxvideodec->pNxVideoDecHandle->hangTimeout = pNxvideodec->watchdogTimeout;
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			break;
+		case PROP_WATCHDOG_MAX_ERRORS:
+			GST_OBJECT_LOCK( pNxvideodec );
+			pNxvideodec->watchdogMaxErrors = g_value_get_int(pValue);
+			if( pNxvideodec->pNxVideoDecHandle )
+				pNxvideodec->pNxVideoDecHandle->maxErrors = pNxvideodec->watchdogMaxErrors;
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			break;
+		case PROP_COPY_WATERMARK:
+			GST_OBJECT_LOCK( pNxvideodec );
+			pNxvideodec->copyWatermark = g_value_get_int(pValue);
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			break;
+		case PROP_COPY_THREADS:
+			CopyPoolSetThreads( g_value_get_int(pValue) );
+			break;
+		case PROP_COPY_MIN_SIZE:
+			CopyPoolSetMinSize( g_value_get_uint(pValue) );
+			break;
+		case PROP_DEINTERLACE:
+			GST_OBJECT_LOCK( pNxvideodec );
+			pNxvideodec->deinterlace = g_value_get_int(pValue);
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			break;
+		case PROP_COPY_MEMORY:
+			GST_OBJECT_LOCK( pNxvideodec );
+			pNxvideodec->copyMemory = g_value_get_int(pValue);
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			gst_pad_mark_reconfigure( GST_VIDEO_DECODER_SRC_PAD (pNxvideodec) );
+			break;
+		case PROP_MOSAIC:
+			GST_OBJECT_LOCK( pNxvideodec );
+			g_free( pNxvideodec->pMosaicName );
+			pNxvideodec->pMosaicName = g_value_dup_string(pValue);
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			break;
+		case PROP_MOSAIC_TILE:
+			GST_OBJECT_LOCK( pNxvideodec );
+			pNxvideodec->mosaicTile = g_value_get_int(pValue);
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			break;
+		case PROP_IDLE_RECLAIM:
+			GST_OBJECT_LOCK( pNxvideodec );
+			pNxvideodec->idleReclaim = g_value_get_uint(pValue);
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			break;
+		case PROP_PREWARM:
+			GST_OBJECT_LOCK( pNxvideodec );
+			g_free( pNxvideodec->pPrewarm );
+			pNxvideodec->pPrewarm = g_value_dup_string(pValue);
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (pObject, propertyId, pPspec);
 			break;
@@ -329,12 +695,109 @@ gst_nxvideodec_get_property (GObject *pObject, guint propertyId,
 
 	switch (propertyId)
 	{
-#if SUPPORT_NO_MEMORY_COPY
-#else
 		case PROP_TYPE:
 			g_value_set_int(pValue, pNxvideodec->bufferType);
 			break;
-#endif
+		case PROP_SCHED_POLICY:
+			g_value_set_int(pValue, pNxvideodec->threadAttr.policy);
+			break;
+		case PROP_SCHED_PRIORITY:
+			g_value_set_int(pValue, pNxvideodec->threadAttr.priority);
+			break;
+		case PROP_CPU_AFFINITY:
+			GST_OBJECT_LOCK( pNxvideodec );
+			g_value_take_string(pValue, ThreadAttrCpuListString( pNxvideodec->threadAttr.cpuMask ));
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			break;
+		case PROP_VPU_WEIGHT:
+			g_value_set_int(pValue, pNxvideodec->vpuWeight);
+			break;
+		case PROP_VPU_MAX_INFLIGHT:
+			g_value_set_int(pValue, pNxvideodec->vpuMaxInFlight);
+			break;
+		case PROP_MEMORY_BUDGET:
+			g_value_set_uint64(pValue, MemBudgetGetLimit());
+			break;
+		case PROP_MEMORY_BUDGET_POLICY:
+			g_value_set_int(pValue, pNxvideodec->budgetPolicy);
+			break;
+		case PROP_PARALLEL_INSTANCES:
+			g_value_set_int(pValue, pNxvideodec->parallelInstances);
+			break;
+		case PROP_PARALLEL_WINDOW:
+			g_value_set_int(pValue, pNxvideodec->parallelWindow);
+			break;
+		case PROP_WATCHDOG_TIMEOUT:
+			g_value_set_uint(pValue, pNxvideodec->watchdogTimeout);
+			break;
+		case PROP_WATCHDOG_MAX_ERRORS:
+			g_value_set_int(pValue, pNxvideodec->watchdogMaxErrors);
+			break;
+		case PROP_COPY_WATERMARK:
+			g_value_set_int(pValue, pNxvideodec->copyWatermark);
+			break;
+		case PROP_COPY_THREADS:
+			g_value_set_int(pValue, CopyPoolGetThreads());
+			break;
+		case PROP_COPY_MIN_SIZE:
+			g_value_set_uint(pValue, CopyPoolGetMinSize());
+			break;
+		case PROP_DEINTERLACE:
+			g_value_set_int(pValue, pNxvideodec->deinterlace);
+			break;
+		case PROP_COPY_MEMORY:
+			g_value_set_int(pValue, pNxvideodec->copyMemory);
+			break;
+		case PROP_MOSAIC:
+			GST_OBJECT_LOCK( pNxvideodec );
+			g_value_set_string(pValue, pNxvideodec->pMosaicName);
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			break;
+		case PROP_MOSAIC_TILE:
+			g_value_set_int(pValue, pNxvideodec->mosaicTile);
+			break;
+		case PROP_IDLE_RECLAIM:
+			g_value_set_uint(pValue, pNxvideodec->idleReclaim);
+			break;
+		case PROP_PREWARM:
+			GST_OBJECT_LOCK( pNxvideodec );
+			g_value_set_string(pValue, pNxvideodec->pPrewarm);
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			break;
+		case PROP_OUTPUT_STATS:
+			GST_OBJECT_LOCK( pNxvideodec );
+			g_value_take_boxed(pValue, gst_structure_new( "nxvideodec-output-stats",
+				"zero-copy", G_TYPE_UINT64, pNxvideodec->zeroCopyFrames,
+				"copied", G_TYPE_UINT64, pNxvideodec->copiedFrames,
+				"skipped", G_TYPE_UINT64, pNxvideodec->skippedFrames,
+				"switches", G_TYPE_UINT, pNxvideodec->copySwitches,
+				"copy-on-hold", G_TYPE_BOOLEAN, pNxvideodec->bCopyOnHold,
+				NULL ));
+			GST_OBJECT_UNLOCK( pNxvideodec );
+			break;
+		case PROP_VPU_STATS:
+		{
+			NX_VPU_STATS stats;
+
+			memset( &stats, 0, sizeof(stats) );
+			GST_OBJECT_LOCK( pNxvideodec );
+			stats.weight = pNxvideodec->vpuWeight;
+			stats.maxInFlight = pNxvideodec->vpuMaxInFlight;
+			if( pNxvideodec->pNxVideoDecHandle && pNxvideodec->pNxVideoDecHandle->pVpuClient )
+				VpuArbiterGetStats( pNxvideodec->pNxVideoDecHandle->pVpuClient, &stats );
+			GST_OBJECT_UNLOCK( pNxvideodec );
+
+			g_value_take_boxed(pValue, gst_structure_new( "nxvideodec-vpu-stats",
+				"weight", G_TYPE_INT, stats.weight,
+				"max-inflight", G_TYPE_INT, stats.maxInFlight,
+				"decoded", G_TYPE_UINT64, stats.decodeCount,
+				"key-frames", G_TYPE_UINT64, stats.keyCount,
+				"busy-time", G_TYPE_UINT64, stats.busyTime,
+				"wait-time", G_TYPE_UINT64, stats.waitTime,
+				"max-wait-time", G_TYPE_UINT64, stats.maxWaitTime,
+				NULL ));
+			break;
+		}
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (pObject, propertyId, pPspec);
 			break;
@@ -343,6 +806,60 @@ gst_nxvideodec_get_property (GObject *pObject, guint propertyId,
 	FUNC_OUT();
 }
 
+// the handle is opened in the background, the first stream of the codec
+// then skips the device open
+static gboolean
+gst_nxvideodec_open (GstVideoDecoder *pDecoder)
+{
+	GstNxVideoDec *pNxVideoDec = GST_NXVIDEODEC (pDecoder);
+	GstCaps *pCaps = NULL;
+	gint codecType = -1;
+
+	GST_OBJECT_LOCK( pNxVideoDec );
+	if( pNxVideoDec->pPrewarm && pNxVideoDec->pPrewarm[0] )
+	{
+		pCaps = gst_caps_from_string( pNxVideoDec->pPrewarm );
+	}
+	GST_OBJECT_UNLOCK( pNxVideoDec );
+
+	if( NULL == pCaps )
+	{
+		return TRUE;
+	}
+
+	if( 0 < gst_caps_get_size( pCaps ) )
+	{
+		codecType = FindCodecType( gst_caps_get_structure( pCaps, 0 ) );
+	}
+	gst_caps_unref( pCaps );
+
+	if( -1 == codecType )
+	{
+		GST_WARNING_OBJECT (pNxVideoDec, "prewarm caps of no supported codec");
+		return TRUE;
+	}
+
+	WarmPoolPrewarm( codecType, 1 );
+	pNxVideoDec->prewarmCodec = codecType;
+
+	return TRUE;
+}
+
+// the handle kept opened for this decoder is not needed any more
+static gboolean
+gst_nxvideodec_close (GstVideoDecoder *pDecoder)
+{
+	GstNxVideoDec *pNxVideoDec = GST_NXVIDEODEC (pDecoder);
+
+	if( -1 != pNxVideoDec->prewarmCodec )
+	{
+		WarmPoolUnprewarm( pNxVideoDec->prewarmCodec, 1 );
+		pNxVideoDec->prewarmCodec = -1;
+	}
+
+	return TRUE;
+}
+
 static gboolean
 gst_nxvideodec_start (GstVideoDecoder *pDecoder)
 {
@@ -365,9 +882,29 @@ gst_nxvideodec_start (GstVideoDecoder *pDecoder)
 		return FALSE;
 	}
 
-	pthread_mutex_lock( &pNxVideoDec->mutex );
-	pNxVideoDec->isState = PLAY;
-	pthread_mutex_unlock( &pNxVideoDec->mutex );
+	GST_OBJECT_LOCK( pNxVideoDec );
+	pNxVideoDec->pNxVideoDecHandle->pVpuClient = VpuArbiterRegister( pNxVideoDec->vpuWeight, pNxVideoDec->vpuMaxInFlight );
+	pNxVideoDec->pNxVideoDecHandle->budgetPolicy = pNxVideoDec->budgetPolicy;
+	pNxVideoDec->pNxVideoDecHandle->hangTimeout = pNxVideoDec->watchdogTimeout;
+	pNxVideoDec->pNxVideoDecHandle->maxErrors = pNxVideoDec->watchdogMaxErrors;
+	GST_OBJECT_UNLOCK( pNxVideoDec );
+
+	pNxVideoDec->resetCountSeen = 0;
+	pNxVideoDec->cfgSerialSeen = 0;
+	pNxVideoDec->lastDecodeTime = g_get_monotonic_time();
+	pNxVideoDec->bWatchdogRun = TRUE;
+	GST_OBJECT_LOCK( pNxVideoDec );
+	pNxVideoDec->bCopyOnHold = FALSE;
+	pNxVideoDec->zeroCopyFrames = 0;
+	pNxVideoDec->copiedFrames = 0;
+	pNxVideoDec->skippedFrames = 0;
+	pNxVideoDec->copySwitches = 0;
+	if( pNxVideoDec->pMosaicName && pNxVideoDec->pMosaicName[0] )
+	{
+		pNxVideoDec->pMosaic = MosaicAcquire( pNxVideoDec->pMosaicName );
+	}
+	GST_OBJECT_UNLOCK( pNxVideoDec );
+	pNxVideoDec->pWatchdogThread = g_thread_new( "nxvideodec-wdog", nxvideodec_watchdog_thread, pNxVideoDec );
 
 	FUNC_OUT();
 
@@ -378,6 +915,7 @@ static gboolean
 gst_nxvideodec_stop (GstVideoDecoder *pDecoder)
 {
 	GstNxVideoDec *pNxVideoDec = GST_NXVIDEODEC (pDecoder);
+	NX_VIDEO_DEC_STRUCT *pDecHandle = NULL;
 	FUNC_IN();
 	if (pNxVideoDec == NULL)
 	{
@@ -387,33 +925,216 @@ gst_nxvideodec_stop (GstVideoDecoder *pDecoder)
 
 	GST_DEBUG_OBJECT (pNxVideoDec, "stop");
 
-	pthread_mutex_lock( &pNxVideoDec->mutex );
-	pNxVideoDec->isState = STOP;
-	pthread_mutex_unlock( &pNxVideoDec->mutex );
+	if( pNxVideoDec->pWatchdogThread )
+	{
+		g_mutex_lock( &pNxVideoDec->watchdogLock );
+		pNxVideoDec->bWatchdogRun = FALSE;
+		g_cond_signal( &pNxVideoDec->watchdogCond );
+		g_mutex_unlock( &pNxVideoDec->watchdogLock );
+		g_thread_join( pNxVideoDec->pWatchdogThread );
+		pNxVideoDec->pWatchdogThread = NULL;
+	}
+
+	if( pNxVideoDec->pGopDec )
+	{
+		GopDecoderDestroy( pNxVideoDec->pGopDec );
+		pNxVideoDec->pGopDec = NULL;
+	}
+
+	nxvideodec_drop_slot_pool( pNxVideoDec );
 
-	if( pNxVideoDec->pNxVideoDecHandle->pSem )
+	MosaicRelease( pNxVideoDec->pMosaic );
+	pNxVideoDec->pMosaic = NULL;
+
+	if( pNxVideoDec->pInputState )
 	{
-		VDecSemSignal( pNxVideoDec->pNxVideoDecHandle->pSem );
-		VDecSemDestroy( pNxVideoDec->pNxVideoDecHandle->pSem );
-		pNxVideoDec->pNxVideoDecHandle->pSem = NULL;
+		gst_video_codec_state_unref( pNxVideoDec->pInputState );
+		pNxVideoDec->pInputState = NULL;
 	}
 
-	CloseVideoDec(pNxVideoDec->pNxVideoDecHandle);
+	GST_OBJECT_LOCK( pNxVideoDec );
+	pDecHandle = pNxVideoDec->pNxVideoDecHandle;
+	pNxVideoDec->pNxVideoDecHandle = NULL;
+	GST_OBJECT_UNLOCK( pNxVideoDec );
 
-	pthread_mutex_destroy( &pNxVideoDec->mutex );
+	// buffers still downstream keep the core alive, the hardware is
+	// released when the last of them comes back
+	CloseVideoDec(pDecHandle);
 
 	FUNC_OUT();
 	return TRUE;
 }
 
+//
+//	Output caps for the current stream configuration: memory, format and
+//	size as downstream and the mosaic allow. Also run when an in-band
+//	sequence header changed the picture size.
+//
+static gboolean
+nxvideodec_set_output_state (GstNxVideoDec *pNxVideoDec)
+{
+	GstVideoDecoder *pDecoder = GST_VIDEO_DECODER (pNxVideoDec);
+	NX_VIDEO_DEC_STRUCT *pDecHandle = pNxVideoDec->pNxVideoDecHandle;
+	GstStructure *pStructure = gst_caps_get_structure( pNxVideoDec->pInputState->caps, 0 );
+	const gchar *pInterlaceMode = gst_structure_get_string( pStructure, "interlace-mode" );
+	const gchar *pFieldOrder = gst_structure_get_string( pStructure, "field-order" );
+	GstVideoCodecState *pOutputState = NULL;
+	GstVideoFormat format;
+	gboolean ret;
+
+	// GOP-parallel decoding hands out copies, never capture buffers, and
+	// so does the de-interlacer
+	pNxVideoDec->bDmaBufOut = !nxvideodec_can_decode_parallel( pNxVideoDec ) &&
+		(NX_DEINTERLACE_OFF == pDecHandle->deinterlace) && !pNxVideoDec->pMosaic &&
+		nxvideodec_peer_accepts_dmabuf( pNxVideoDec );
+
+	// the hardware writes the negotiated layout, or the one of the mosaic
+	// canvas; only when the driver insists on its own layout do the copies
+	// convert, and then there are no capture buffers to export
+	format = nxvideodec_choose_format( pNxVideoDec, pNxVideoDec->bDmaBufOut );
+	if( pNxVideoDec->bDmaBufOut && pDecHandle->capFourcc && (format != GetCaptureFormat( pDecHandle )) )
+	{
+		pNxVideoDec->bDmaBufOut = FALSE;
+		format = nxvideodec_choose_format( pNxVideoDec, FALSE );
+	}
+	if( pNxVideoDec->pMosaic && (GST_VIDEO_FORMAT_UNKNOWN != MosaicGetFormat( pNxVideoDec->pMosaic )) )
+	{
+		format = MosaicGetFormat( pNxVideoDec->pMosaic );
+	}
+	pDecHandle->imgFourcc = VideoFormatToFourcc( format );
+	GST_DEBUG_OBJECT( pNxVideoDec, "output format %s", gst_video_format_to_string (format) );
+
+	// capture buffers have the coded size, a smaller output is scaled by the copy
+	pDecHandle->outWidth = pDecHandle->width;
+	pDecHandle->outHeight = pDecHandle->height;
+	if( !pNxVideoDec->bDmaBufOut )
+	{
+		nxvideodec_choose_size( pNxVideoDec, format, &pDecHandle->outWidth, &pDecHandle->outHeight );
+	}
+	pNxVideoDec->bScaledOut = (pDecHandle->outWidth != pDecHandle->width) || (pDecHandle->outHeight != pDecHandle->height);
+	if( pNxVideoDec->bScaledOut )
+	{
+		GST_INFO_OBJECT( pNxVideoDec, "downscaling %dx%d to %dx%d while copying",
+			pDecHandle->width, pDecHandle->height, pDecHandle->outWidth, pDecHandle->outHeight );
+	}
+
+	pOutputState =	gst_video_decoder_set_output_state (pDecoder, format,
+								pDecHandle->outWidth, pDecHandle->outHeight, pNxVideoDec->pInputState);
+
+	pOutputState->caps = gst_caps_new_simple ("video/x-raw",
+			"format", G_TYPE_STRING, gst_video_format_to_string (format),
+			"width", G_TYPE_INT, pDecHandle->outWidth,
+			"height", G_TYPE_INT, pDecHandle->outHeight,
+			"framerate", GST_TYPE_FRACTION, pDecHandle->fpsNum, pDecHandle->fpsDen, NULL);
+
+	pNxVideoDec->bInterlacedOut = FALSE;
+	// a scaled copy is de-interlaced on the way
+	if( (NX_DEINTERLACE_OFF == pDecHandle->deinterlace) && !pNxVideoDec->bScaledOut &&
+		pInterlaceMode && strcmp( pInterlaceMode, "progressive" ) )
+	{
+		GST_VIDEO_INFO_INTERLACE_MODE( &pOutputState->info ) = gst_video_interlace_mode_from_string( pInterlaceMode );
+		gst_caps_set_simple( pOutputState->caps, "interlace-mode", G_TYPE_STRING, pInterlaceMode, NULL );
+		if( pFieldOrder )
+		{
+			gst_caps_set_simple( pOutputState->caps, "field-order", G_TYPE_STRING, pFieldOrder, NULL );
+		}
+		pNxVideoDec->bInterlacedOut = TRUE;
+	}
+
+	if( pNxVideoDec->bDmaBufOut )
+	{
+		gst_caps_set_features( pOutputState->caps, 0, gst_caps_features_new( GST_CAPS_FEATURE_MEMORY_DMABUF, NULL ) );
+		GST_INFO_OBJECT( pNxVideoDec, "exporting capture buffers as dmabuf" );
+	}
+
+	gst_video_codec_state_unref( pOutputState );
+
+	pNxVideoDec->pNxVideoDecHandle->imgPlaneNum = 1;
+	if( BUFFER_TYPE_GEM == pNxVideoDec->bufferType )
+	{
+		GST_DEBUG_OBJECT( pNxVideoDec, ">>>>> Accelerable.");
+	}
+
+	// the source pad only carries caps while drawing into a mosaic
+	ret = gst_video_decoder_negotiate( pDecoder ) || (NULL != pNxVideoDec->pMosaic);
+
+	if( FALSE == ret)
+	{
+		GST_ERROR( "Fail Negotiate !\n");
+	}
+
+	return ret;
+}
+
+//
+//	TRUE when the new caps make ReconfigureVideoDec() reopen an initialized
+//	handle: another codec, picture size or codec data.
+//
+static gboolean
+nxvideodec_caps_need_reopen (GstVideoCodecState *pOld, GstVideoCodecState *pNew)
+{
+	GstBuffer *pOldData = pOld->codec_data;
+	GstBuffer *pNewData = pNew->codec_data;
+	GstMapInfo mapInfo;
+	gboolean bSame;
+
+	if( (FindCodecType( gst_caps_get_structure( pOld->caps, 0 ) ) != FindCodecType( gst_caps_get_structure( pNew->caps, 0 ) )) ||
+		(GST_VIDEO_INFO_WIDTH( &pOld->info ) != GST_VIDEO_INFO_WIDTH( &pNew->info )) ||
+		(GST_VIDEO_INFO_HEIGHT( &pOld->info ) != GST_VIDEO_INFO_HEIGHT( &pNew->info )) )
+	{
+		return TRUE;
+	}
+
+	if( (NULL == pOldData) || (NULL == pNewData) )
+	{
+		return pOldData != pNewData;
+	}
+
+	if( gst_buffer_get_size( pOldData ) != gst_buffer_get_size( pNewData ) )
+	{
+		return TRUE;
+	}
+	if( !gst_buffer_map( pNewData, &mapInfo, GST_MAP_READ ) )
+	{
+		return TRUE;
+	}
+	bSame = (0 == gst_buffer_memcmp( pOldData, 0, mapInfo.data, mapInfo.size ));
+	gst_buffer_unmap( pNewData, &mapInfo );
+
+	return !bSame;
+}
+
+//
+//	A reclaim must not suspend the handle while it is being configured.
+//	New caps which reopen the handle drain it first, the pictures it holds
+//	for reordering belong to frames already pending.
+//
 static gboolean
 gst_nxvideodec_set_format (GstVideoDecoder *pDecoder, GstVideoCodecState *pState)
 {
 	GstNxVideoDec *pNxVideoDec = GST_NXVIDEODEC (pDecoder);
+	gboolean ret;
+
+	if( pNxVideoDec->pInputState && nxvideodec_caps_need_reopen( pNxVideoDec->pInputState, pState ) )
+	{
+		nxvideodec_drain_serial( pNxVideoDec, NULL, FALSE );
+	}
+
+	g_mutex_lock( &pNxVideoDec->decodeLock );
+	ret = nxvideodec_set_format( pNxVideoDec, pState );
+	g_mutex_unlock( &pNxVideoDec->decodeLock );
+
+	return ret;
+}
+
+static gboolean
+nxvideodec_set_format (GstNxVideoDec *pNxVideoDec, GstVideoCodecState *pState)
+{
 	GstStructure *pStructure = NULL;
 	const gchar *pMimeType = NULL;
+	const gchar *pInterlaceMode = NULL;
+	const gchar *pFieldOrder = NULL;
 	GstBuffer *pCodecData = NULL;
-	GstVideoCodecState *pOutputState = NULL;
 	NX_VIDEO_DEC_STRUCT *pDecHandle = NULL;
 	gint ret = FALSE;
 
@@ -421,6 +1142,13 @@ gst_nxvideodec_set_format (GstVideoDecoder *pDecoder, GstVideoCodecState *pState
 
 	GST_DEBUG_OBJECT (pNxVideoDec, "set_format");
 
+	// repeated caps, e.g. on every key frame of some payloaders
+	if( pNxVideoDec->pInputState && gst_caps_is_equal( pNxVideoDec->pInputState->caps, pState->caps ) )
+	{
+		GST_DEBUG_OBJECT( pNxVideoDec, "caps unchanged, keeping the configuration" );
+		return TRUE;
+	}
+
 	if (pNxVideoDec->pInputState)
 	{
 		gst_video_codec_state_unref (pNxVideoDec->pInputState);
@@ -455,6 +1183,7 @@ gst_nxvideodec_set_format (GstVideoDecoder *pDecoder, GstVideoCodecState *pState
 		pDecHandle->pExtraData = NULL;
 		pDecHandle->extraDataSize = 0;
 	}
+	pDecHandle->bInbandExtraData = FALSE;
 
 	pCodecData = pNxVideoDec->pInputState->codec_data;
 
@@ -509,269 +1238,1321 @@ gst_nxvideodec_set_format (GstVideoDecoder *pDecoder, GstVideoCodecState *pState
 		}
 	}
 
-	pOutputState =	gst_video_decoder_set_output_state (pDecoder, GST_VIDEO_FORMAT_I420,
-								pDecHandle->width, pDecHandle->height, pNxVideoDec->pInputState);
-
-	pOutputState->caps = gst_caps_new_simple ("video/x-raw",
-			"format", G_TYPE_STRING, gst_video_format_to_string (GST_VIDEO_FORMAT_I420),
-			"width", G_TYPE_INT, pDecHandle->width,
-			"height", G_TYPE_INT, pDecHandle->height,
-			"framerate", GST_TYPE_FRACTION, pDecHandle->fpsNum, pDecHandle->fpsDen, NULL);
+	// the caps may carry the coded size; the SPS or sequence headers in the
+	// codec data know the visible area before the output caps are set
+	if( pDecHandle->pH264Info )
+	{
+		ParseVisibleArea( pDecHandle, pDecHandle->pH264Info->spsppsData, pDecHandle->pH264Info->spsppsSize, TRUE );
+	}
+	else if( pDecHandle->pExtraData )
+	{
+		ParseVisibleArea( pDecHandle, pDecHandle->pExtraData, pDecHandle->extraDataSize, TRUE );
+	}
+
+	// field structure as the parser reports it, the hardware flags
+	// interlaced pictures of mixed streams on its own
+	pInterlaceMode = gst_structure_get_string( pStructure, "interlace-mode" );
+	pFieldOrder = gst_structure_get_string( pStructure, "field-order" );
+	pDecHandle->bInterlacedStream = pInterlaceMode && !strcmp( pInterlaceMode, "interleaved" );
+	pDecHandle->bTopFieldFirst = !(pFieldOrder && !strcmp( pFieldOrder, "bottom-field-first" ));
+	GST_OBJECT_LOCK( pNxVideoDec );
+	pDecHandle->deinterlace = pNxVideoDec->deinterlace;
+	GST_OBJECT_UNLOCK( pNxVideoDec );
+
+	ret = nxvideodec_set_output_state( pNxVideoDec );
+	if( FALSE == ret )
+	{
+		return ret;
+	}
+
+	if( pNxVideoDec->pGopDec )
+	{
+		GopDecoderDestroy( pNxVideoDec->pGopDec );
+		pNxVideoDec->pGopDec = NULL;
+	}
+	nxvideodec_drop_slot_pool( pNxVideoDec );
+
+	if( nxvideodec_can_decode_parallel( pNxVideoDec ) )
+	{
+		// the GOP decoder opens its own instances, this handle only
+		// keeps the stream configuration
+		pNxVideoDec->pGopDec = GopDecoderCreate( pDecHandle, pNxVideoDec->parallelInstances, pNxVideoDec->parallelWindow, &ret );
+		if( pNxVideoDec->pGopDec )
+		{
+			GST_INFO_OBJECT( pNxVideoDec, "GOP-parallel decoding on %d instances", pNxVideoDec->parallelInstances );
+			// a handle opened for frames in front of a GOP is reconfigured
+			// as it would be without the GOP decoder
+			if( pDecHandle->hCodec && (0 != InitVideoDec( pDecHandle )) )
+			{
+				return FALSE;
+			}
+			FUNC_OUT();
+			return TRUE;
+		}
+		GST_WARNING_OBJECT( pNxVideoDec, "GOP-parallel decoding unavailable (ret = %d), decoding serially", ret );
+	}
+
+	ret = InitVideoDec(pNxVideoDec->pNxVideoDecHandle);
+	if( DEC_BUDGET_ERR == ret )
+	{
+		GST_ELEMENT_ERROR( pNxVideoDec, RESOURCE, NO_SPACE_LEFT,
+			("Decoder memory budget exhausted."), ("Cannot reserve the stream buffer."));
+		return FALSE;
+	}
+	else if( 0 != ret )
+	{
+		return FALSE;
+	}
+	ret = TRUE;
+
+	FUNC_OUT();
+
+	return ret;
+}
+
+static gboolean
+gst_nxvideodec_flush (GstVideoDecoder *pDecoder)
+{
+	GstNxVideoDec *pNxvideodec = GST_NXVIDEODEC (pDecoder);
+
+	FUNC_IN();
+
+	GST_DEBUG_OBJECT (pNxvideodec, "flush");
+
+	if( pNxvideodec->pGopDec )
+	{
+		GopDecoderCancel( pNxvideodec->pGopDec );
+	}
+
+	if( pNxvideodec->pNxVideoDecHandle )
+	{
+		pNxvideodec->pNxVideoDecHandle->bFlush = TRUE;
+	}
+	pNxvideodec->lastKeyUnitTime = GST_CLOCK_TIME_NONE;
+
+	FUNC_OUT();
+
+	return TRUE;
+}
+
+void
+gst_nxvideodec_get_thread_attr (GstNxVideoDec *pNxVideoDec, NX_THREAD_ATTR *pAttr)
+{
+	GST_OBJECT_LOCK( pNxVideoDec );
+	*pAttr = pNxVideoDec->threadAttr;
+	GST_OBJECT_UNLOCK( pNxVideoDec );
+}
+
+// handle_frame runs on the upstream streaming thread, which may change
+// across flushes, so the thread identity is tracked as well as the serial.
+static void
+nxvideodec_update_stream_thread_attr (GstNxVideoDec *pNxVideoDec)
+{
+	NX_THREAD_ATTR attr;
+	pthread_t self = pthread_self();
+
+	gst_nxvideodec_get_thread_attr( pNxVideoDec, &attr );
+
+	if( (attr.serial == pNxVideoDec->streamAttrSerial) && pthread_equal(self, pNxVideoDec->streamThread) )
+	{
+		return;
+	}
+
+	pNxVideoDec->streamAttrSerial = attr.serial;
+	pNxVideoDec->streamThread = self;
+
+	// never configured, keep whatever the application gave us
+	if( 0 == attr.serial )
+	{
+		return;
+	}
+
+	GST_DEBUG_OBJECT( pNxVideoDec, "streaming thread: policy=%d, priority=%d, cpus=0x%" G_GINT64_MODIFIER "x",
+		attr.policy, attr.priority, attr.cpuMask );
+	ThreadAttrApply( &attr );
+}
+
+//
+//	Buffers already downstream keep the old pool (and its decoder core)
+//	alive until they come back.
+//
+static void
+nxvideodec_drop_slot_pool (GstNxVideoDec *pNxVideoDec)
+{
+	if( NULL == pNxVideoDec->pSlotPool )
+	{
+		return;
+	}
+
+	gst_buffer_pool_set_active( pNxVideoDec->pSlotPool, FALSE );
+	gst_object_unref( pNxVideoDec->pSlotPool );
+	pNxVideoDec->pSlotPool = NULL;
+}
+
+//
+//	First of NV12, NV21 and I420 the peer takes, in that order; every one
+//	of them is written by the hardware directly. A driver which refused
+//	the layout asked for and writes its own has that one tried first, it
+//	needs no conversion.
+//
+static GstVideoFormat
+nxvideodec_choose_format (GstNxVideoDec *pNxVideoDec, gboolean bDmaBuf)
+{
+	GstVideoFormat formats[] = { GST_VIDEO_FORMAT_UNKNOWN, GST_VIDEO_FORMAT_NV12, GST_VIDEO_FORMAT_NV21, GST_VIDEO_FORMAT_I420 };
+	GstVideoFormat format = GST_VIDEO_FORMAT_I420;
+	GstCaps *pPeerCaps = NULL;
+	GstCaps *pCaps = NULL;
+	gboolean bMatch;
+	guint i;
+
+	if( pNxVideoDec->pNxVideoDecHandle->capFourcc )
+	{
+		formats[0] = GetCaptureFormat( pNxVideoDec->pNxVideoDecHandle );
+	}
+
+	pPeerCaps = gst_pad_peer_query_caps( GST_VIDEO_DECODER_SRC_PAD (pNxVideoDec), NULL );
+	if( NULL == pPeerCaps )
+	{
+		return format;
+	}
+
+	for( i=0 ; i<G_N_ELEMENTS(formats) ; i++ )
+	{
+		if( GST_VIDEO_FORMAT_UNKNOWN == formats[i] )
+		{
+			continue;
+		}
+		pCaps = gst_caps_new_simple( "video/x-raw",
+			"format", G_TYPE_STRING, gst_video_format_to_string (formats[i]), NULL );
+		if( bDmaBuf )
+		{
+			gst_caps_set_features( pCaps, 0, gst_caps_features_new( GST_CAPS_FEATURE_MEMORY_DMABUF, NULL ) );
+		}
+		bMatch = gst_caps_can_intersect( pPeerCaps, pCaps );
+		gst_caps_unref( pCaps );
+
+		if( bMatch )
+		{
+			format = formats[i];
+			break;
+		}
+	}
+	gst_caps_unref( pPeerCaps );
+
+	return format;
+}
+
+//
+//	The caps said progressive but the hardware reports an interlaced
+//	picture: switch to mixed, after which downstream follows the buffer
+//	flags.
+//
+static void
+nxvideodec_set_mixed_interlace (GstNxVideoDec *pNxVideoDec)
+{
+	GstVideoCodecState *pState = NULL;
+
+	pNxVideoDec->bInterlacedOut = TRUE;
+
+	pState = gst_video_decoder_get_output_state( GST_VIDEO_DECODER (pNxVideoDec) );
+	if( NULL == pState )
+	{
+		return;
+	}
+
+	GST_VIDEO_INFO_INTERLACE_MODE( &pState->info ) = GST_VIDEO_INTERLACE_MODE_MIXED;
+	if( pState->caps )
+	{
+		pState->caps = gst_caps_make_writable( pState->caps );
+		gst_caps_set_simple( pState->caps, "interlace-mode", G_TYPE_STRING, "mixed", NULL );
+	}
+	gst_video_codec_state_unref( pState );
+
+	GST_INFO_OBJECT( pNxVideoDec, "interlaced pictures in a progressive stream, output is now mixed" );
+	if( !gst_video_decoder_negotiate( GST_VIDEO_DECODER (pNxVideoDec) ) )
+	{
+		GST_WARNING_OBJECT( pNxVideoDec, "downstream refused interlaced caps" );
+	}
+}
+
+//
+//	The coded size unless the peer only takes something smaller, down to
+//	1/NX_COPY_MAX_SCALE per axis. A width-only constraint keeps the aspect
+//	ratio for the height.
+//
+static void
+nxvideodec_choose_size (GstNxVideoDec *pNxVideoDec, GstVideoFormat format, gint *pWidth, gint *pHeight)
+{
+	GstCaps *pFilter = NULL;
+	GstCaps *pPeerCaps = NULL;
+	GstStructure *pStructure = NULL;
+	gint width = *pWidth;
+	gint height = *pHeight;
+
+	pFilter = gst_caps_new_simple( "video/x-raw",
+		"format", G_TYPE_STRING, gst_video_format_to_string (format),
+		"width", GST_TYPE_INT_RANGE, MAX( 1, (width + NX_COPY_MAX_SCALE - 1) / NX_COPY_MAX_SCALE ), width,
+		"height", GST_TYPE_INT_RANGE, MAX( 1, (height + NX_COPY_MAX_SCALE - 1) / NX_COPY_MAX_SCALE ), height, NULL );
+	pPeerCaps = gst_pad_peer_query_caps( GST_VIDEO_DECODER_SRC_PAD (pNxVideoDec), pFilter );
+	gst_caps_unref( pFilter );
+
+	if( (NULL == pPeerCaps) || gst_caps_is_empty( pPeerCaps ) || gst_caps_is_any( pPeerCaps ) )
+	{
+		if( pPeerCaps )
+			gst_caps_unref( pPeerCaps );
+		return;
+	}
+
+	pPeerCaps = gst_caps_truncate( pPeerCaps );
+	pStructure = gst_caps_get_structure( pPeerCaps, 0 );
+	gst_structure_fixate_field_nearest_int( pStructure, "width", *pWidth );
+	gst_structure_get_int( pStructure, "width", &width );
+	gst_structure_fixate_field_nearest_int( pStructure, "height",
+		(gint)gst_util_uint64_scale_int( *pHeight, width, *pWidth ) );
+	gst_structure_get_int( pStructure, "height", &height );
+	gst_caps_unref( pPeerCaps );
+
+	*pWidth = width;
+	*pHeight = height;
+}
+
+//
+//	Only a peer that lists the memory:DMABuf feature gets dmabuf memory;
+//	ANY caps (fakesink, appsink) keep the existing output types.
+//
+static gboolean
+nxvideodec_peer_accepts_dmabuf (GstNxVideoDec *pNxVideoDec)
+{
+	GstCaps *pFilter = NULL;
+	GstCaps *pPeerCaps = NULL;
+	gboolean bAccept = FALSE;
+	guint i;
+
+	pFilter = gst_caps_from_string( "video/x-raw(" GST_CAPS_FEATURE_MEMORY_DMABUF "), format = (string) { NV12, NV21, I420 }" );
+	pPeerCaps = gst_pad_peer_query_caps( GST_VIDEO_DECODER_SRC_PAD (pNxVideoDec), NULL );
+	if( pPeerCaps && !gst_caps_is_any( pPeerCaps ) )
+	{
+		for( i=0 ; i<gst_caps_get_size( pPeerCaps ) ; i++ )
+		{
+			if( gst_caps_features_contains( gst_caps_get_features( pPeerCaps, i ), GST_CAPS_FEATURE_MEMORY_DMABUF ) )
+			{
+				bAccept = gst_caps_can_intersect( pPeerCaps, pFilter );
+				break;
+			}
+		}
+	}
+
+	if( pPeerCaps )
+	{
+		gst_caps_unref( pPeerCaps );
+	}
+	gst_caps_unref( pFilter );
+
+	return bAccept;
+}
+
+//
+//	Capture buffers held downstream beyond outputBufCount starve the
+//	decoder. Below the watermark frames are copied and their slot goes
+//	straight back; zero-copy resumes once one more slot than that is free.
+//
+static gboolean
+nxvideodec_copy_on_hold (GstNxVideoDec *pNxVideoDec)
+{
+	gint watermark;
+	gint numFree;
+	gboolean bCopy;
+
+	numFree = pNxVideoDec->pNxVideoDecHandle->outputBufCount;
+	if( pNxVideoDec->pSlotPool )
+	{
+		numFree -= gst_nxvideodec_pool_get_num_out( pNxVideoDec->pSlotPool );
+	}
+
+	GST_OBJECT_LOCK( pNxVideoDec );
+	watermark = pNxVideoDec->copyWatermark;
+	// playing backwards, the base class keeps every picture of a GOP until
+	// the whole GOP is decoded; none of them comes back before that
+	if( 0.0 > GST_VIDEO_DECODER_INPUT_SEGMENT (pNxVideoDec).rate )
+	{
+		watermark = MAX( watermark, REVERSE_WATERMARK );
+	}
+	if( pNxVideoDec->bCopyOnHold )
+	{
+		if( (0 == watermark) || (numFree > watermark) )
+		{
+			pNxVideoDec->bCopyOnHold = FALSE;
+			GST_INFO_OBJECT( pNxVideoDec, "%d capture buffers free, back to zero-copy", numFree );
+		}
+	}
+	else if( numFree < watermark )
+	{
+		pNxVideoDec->bCopyOnHold = TRUE;
+		pNxVideoDec->copySwitches++;
+		GST_INFO_OBJECT( pNxVideoDec, "only %d capture buffers free, copying frames", numFree );
+	}
+	bCopy = pNxVideoDec->bCopyOnHold;
+	GST_OBJECT_UNLOCK( pNxVideoDec );
+
+	return bCopy;
+}
+
+static gboolean
+nxvideodec_can_decode_parallel (GstNxVideoDec *pNxVideoDec)
+{
+	NX_VIDEO_DEC_STRUCT *pDecHandle = pNxVideoDec->pNxVideoDecHandle;
+
+	// the mosaic takes pictures in display order from this thread
+	if( (2 > pNxVideoDec->parallelInstances) || pNxVideoDec->pMosaic )
+	{
+		return FALSE;
+	}
+
+	// GOPs are cut where IsRandomAccessPoint() can prove a clean start;
+	// NAL aligned H.264 splits an access unit over several frames.
+	if( V4L2_PIX_FMT_H264 == pDecHandle->codecType )
+	{
+		return (H264_PARSE_ALIGN_NAL != pDecHandle->h264Alignment);
+	}
+
+	return (V4L2_PIX_FMT_MPEG2 == pDecHandle->codecType);
+}
+
+static GstFlowReturn
+nxvideodec_output_gop_job (GstNxVideoDec *pNxVideoDec, NX_GOP_JOB *pJob)
+{
+	GstVideoDecoder *pDecoder = GST_VIDEO_DECODER (pNxVideoDec);
+	GstVideoCodecFrame *pFrame = NULL;
+	GstBuffer *pPicture = NULL;
+	GstFlowReturn flowRet = GST_FLOW_OK;
+
+	if( DEC_BUDGET_ERR == pJob->error )
+	{
+		GST_ELEMENT_ERROR( pNxVideoDec, RESOURCE, NO_SPACE_LEFT,
+			("Decoder memory budget exhausted."), ("Cannot reserve the frame buffers for this stream."));
+		flowRet = GST_FLOW_ERROR;
+	}
+	else if( DEC_INIT_ERR == pJob->error )
+	{
+		flowRet = GST_FLOW_ERROR;
+	}
+
+	// pictures come out in presentation order and carry their own PTS, so
+	// they are matched to the pending frames by position only
+	while( (pFrame = (GstVideoCodecFrame *)g_queue_pop_head( &pJob->frames )) )
+	{
+		pPicture = (GstBuffer *)g_queue_pop_head( &pJob->pictures );
+		if( (NULL == pPicture) || (GST_FLOW_OK != flowRet) )
+		{
+			if( pPicture )
+				gst_buffer_unref( pPicture );
+			gst_video_decoder_drop_frame( pDecoder, pFrame );
+			continue;
+		}
+
+		pFrame->output_buffer = pPicture;
+		pFrame->pts = GST_BUFFER_PTS( pPicture );
+		flowRet = gst_video_decoder_finish_frame( pDecoder, pFrame );
+	}
+
+	GopJobFree( pJob );
+
+	return flowRet;
+}
+
+//
+//	Opens the serial handle for the frames which cannot go to the GOP
+//	decoder. Set up in nxvideodec_set_format(), it has no hardware handle
+//	yet; a suspended one reopens in VideoDecodeFrame().
+//
+static gboolean
+nxvideodec_start_serial (GstNxVideoDec *pNxVideoDec)
+{
+	NX_VIDEO_DEC_STRUCT *pDecHandle = pNxVideoDec->pNxVideoDecHandle;
+	gint ret;
+
+	if( pDecHandle->hCodec || pDecHandle->bSuspended )
+	{
+		return TRUE;
+	}
+
+	ret = InitVideoDec( pDecHandle );
+	if( DEC_BUDGET_ERR == ret )
+	{
+		GST_ELEMENT_ERROR( pNxVideoDec, RESOURCE, NO_SPACE_LEFT,
+			("Decoder memory budget exhausted."), ("Cannot reserve the stream buffer."));
+	}
+
+	return (0 == ret);
+}
+
+//
+//	Outputs what the serial handle still holds once GOPs take over and
+//	gives its hardware back, unless GEM slots of it are still out.
+//
+static GstFlowReturn
+nxvideodec_stop_serial (GstNxVideoDec *pNxVideoDec, GstVideoCodecFrame *pCurrent)
+{
+	NX_VIDEO_DEC_STRUCT *pDecHandle = pNxVideoDec->pNxVideoDecHandle;
+	GstFlowReturn flowRet;
+
+	if( (NULL == pDecHandle->hCodec) || pDecHandle->bSuspended )
+	{
+		return GST_FLOW_OK;
+	}
+
+	flowRet = nxvideodec_drain_serial( pNxVideoDec, pCurrent, FALSE );
+
+	g_mutex_lock( &pNxVideoDec->decodeLock );
+	if( !nxvideodec_holds_gem_slots( pNxVideoDec ) && SuspendVideoDec( pDecHandle ) )
+	{
+		nxvideodec_drop_slot_pool( pNxVideoDec );
+	}
+	g_mutex_unlock( &pNxVideoDec->decodeLock );
+
+	return flowRet;
+}
+
+static GstFlowReturn
+nxvideodec_fail_frame (GstNxVideoDec *pNxVideoDec, GstVideoCodecFrame *pFrame)
+{
+	gst_video_codec_frame_unref( pFrame );
+
+	return GST_FLOW_ERROR;
+}
+
+//
+//	Gives up on GOP-parallel decoding for the rest of the stream: the GOPs
+//	already dispatched go out, then the one being collected, pFrame and
+//	everything after it is decoded on the serial handle.
+//
+static GstFlowReturn
+nxvideodec_leave_parallel (GstNxVideoDec *pNxVideoDec, GstVideoCodecFrame *pFrame)
+{
+	NX_GOP_DECODER *pGop = pNxVideoDec->pGopDec;
+	NX_GOP_JOB *pJob = NULL;
+	NX_GOP_JOB *pCurJob = NULL;
+	GstVideoCodecFrame *pGopFrame = NULL;
+	GstFlowReturn flowRet = GST_FLOW_OK;
+
+	GST_INFO_OBJECT( pNxVideoDec, "stream cannot be cut into GOPs, decoding serially" );
+
+	pCurJob = GopDecoderTakeGop( pGop );
+	while( (pJob = GopDecoderPopDone( pGop, TRUE )) )
+	{
+		if( GST_FLOW_OK == flowRet )
+		{
+			flowRet = nxvideodec_output_gop_job( pNxVideoDec, pJob );
+		}
+		else
+		{
+			GopJobFree( pJob );
+		}
+	}
+
+	GopDecoderDestroy( pGop );
+	pNxVideoDec->pGopDec = NULL;
+
+	if( (GST_FLOW_OK == flowRet) && !nxvideodec_start_serial( pNxVideoDec ) )
+	{
+		flowRet = GST_FLOW_ERROR;
+	}
+
+	// the collected GOP starts at a random access point
+	if( pCurJob )
+	{
+		while( (pGopFrame = (GstVideoCodecFrame *)g_queue_pop_head( &pCurJob->frames )) )
+		{
+			if( GST_FLOW_OK == flowRet )
+			{
+				flowRet = nxvideodec_handle_frame_serial( pNxVideoDec, pGopFrame );
+			}
+			else
+			{
+				gst_video_codec_frame_unref( pGopFrame );
+			}
+		}
+		GopJobFree( pCurJob );
+	}
+
+	if( GST_FLOW_OK != flowRet )
+	{
+		gst_video_codec_frame_unref( pFrame );
+		return flowRet;
+	}
+
+	return nxvideodec_handle_frame_serial( pNxVideoDec, pFrame );
+}
+
+static GstFlowReturn
+nxvideodec_handle_frame_parallel (GstNxVideoDec *pNxVideoDec, GstVideoCodecFrame *pFrame)
+{
+	NX_GOP_DECODER *pGop = pNxVideoDec->pGopDec;
+	NX_GOP_JOB *pJob = NULL;
+	NX_THREAD_ATTR attr;
+	GstFlowReturn flowRet = GST_FLOW_OK;
+	gint window;
+
+	FUNC_IN();
+
+	nxvideodec_update_stream_thread_attr( pNxVideoDec );
+	gst_nxvideodec_get_thread_attr( pNxVideoDec, &attr );
+
+	switch( GopDecoderAddFrame( pGop, pFrame, &attr ) )
+	{
+		case NX_GOP_SERIAL:
+			GST_LOG_OBJECT( pNxVideoDec, "decoding serially up to the first random access point" );
+			return nxvideodec_start_serial( pNxVideoDec ) ?
+				nxvideodec_handle_frame_serial( pNxVideoDec, pFrame ) : nxvideodec_fail_frame( pNxVideoDec, pFrame );
+		case NX_GOP_FALLBACK:
+			return nxvideodec_leave_parallel( pNxVideoDec, pFrame );
+		default:
+			break;
+	}
+
+	// the frames in front of this GOP go out first
+	flowRet = nxvideodec_stop_serial( pNxVideoDec, pFrame );
+
+	// keep at most `window` GOPs in flight, then hand out whatever is done
+	window = (0 < pNxVideoDec->parallelWindow) ? pNxVideoDec->parallelWindow : pNxVideoDec->parallelInstances;
+	while( (GST_FLOW_OK == flowRet) && (GopDecoderNumPending( pGop ) > window) )
+	{
+		flowRet = nxvideodec_output_gop_job( pNxVideoDec, GopDecoderPopDone( pGop, TRUE ) );
+	}
+
+	while( (GST_FLOW_OK == flowRet) && (pJob = GopDecoderPopDone( pGop, FALSE )) )
+	{
+		flowRet = nxvideodec_output_gop_job( pNxVideoDec, pJob );
+	}
+
+	FUNC_OUT();
+
+	return flowRet;
+}
+
+static GstFlowReturn
+gst_nxvideodec_finish (GstVideoDecoder *pDecoder)
+{
+	GstNxVideoDec *pNxVideoDec = GST_NXVIDEODEC (pDecoder);
+	NX_GOP_JOB *pJob = NULL;
+	NX_THREAD_ATTR attr;
+	GstFlowReturn flowRet = GST_FLOW_OK;
+
+	FUNC_IN();
+
+	GST_DEBUG_OBJECT (pNxVideoDec, "finish");
+
+	if( NULL == pNxVideoDec->pGopDec )
+	{
+		return nxvideodec_drain_serial( pNxVideoDec, NULL, TRUE );
+	}
+
+	// frames in front of the first GOP after a start or a flush
+	flowRet = nxvideodec_drain_serial( pNxVideoDec, NULL, TRUE );
+
+	gst_nxvideodec_get_thread_attr( pNxVideoDec, &attr );
+	GopDecoderEndGop( pNxVideoDec->pGopDec, &attr );
+
+	while( (pJob = GopDecoderPopDone( pNxVideoDec->pGopDec, TRUE )) )
+	{
+		if( GST_FLOW_OK == flowRet )
+		{
+			flowRet = nxvideodec_output_gop_job( pNxVideoDec, pJob );
+		}
+		else
+		{
+			GopJobFree( pJob );
+		}
+	}
+
+	FUNC_OUT();
+
+	return flowRet;
+}
+
+//
+//	Called by the base class whenever everything decoded so far has to be
+//	out, notably after each GOP of reverse playback, before it pushes the
+//	GOP in reverse, and on gaps. A gap continues the stream where it was,
+//	the next GOP of reverse playback lies before this one and starts over.
+//
+static GstFlowReturn
+gst_nxvideodec_drain (GstVideoDecoder *pDecoder)
+{
+	GstNxVideoDec *pNxVideoDec = GST_NXVIDEODEC (pDecoder);
+
+	GST_DEBUG_OBJECT (pDecoder, "drain");
+
+	if( NULL == pNxVideoDec->pGopDec )
+	{
+		return nxvideodec_drain_serial( pNxVideoDec, NULL, 0.0 > GST_VIDEO_DECODER_INPUT_SEGMENT (pDecoder).rate );
+	}
+
+	return gst_nxvideodec_finish( pDecoder );
+}
+
+//
+//	Pushes the pictures the hardware still holds for reordering as the
+//	output of the oldest pending frames, pCurrent (the frame being handled,
+//	if any) excepted. bRestart flushes the hardware before the next frame
+//	and restarts decoding at a key frame, which only an end of stream or a
+//	jump back in reverse playback calls for; a drain before a reopen gets
+//	a fresh handle anyway.
+//
+static GstFlowReturn
+nxvideodec_drain_serial (GstNxVideoDec *pNxVideoDec, GstVideoCodecFrame *pCurrent, gboolean bRestart)
+{
+	NX_VIDEO_DEC_STRUCT *pDecHandle = pNxVideoDec->pNxVideoDecHandle;
+	GstVideoCodecFrame *pFrame = NULL;
+	NX_V4L2DEC_OUT decOut;
+	GstFlowReturn flowRet = GST_FLOW_OK;
+
+	if( (NULL == pDecHandle) || (FALSE == pDecHandle->bInitialized) )
+	{
+		return GST_FLOW_OK;
+	}
+
+	while( GST_FLOW_OK == flowRet )
+	{
+		g_mutex_lock( &pNxVideoDec->decodeLock );
+		if( (0 != VideoDecodeDrain( pDecHandle, &decOut )) || (0 > decOut.dispIdx) )
+		{
+			g_mutex_unlock( &pNxVideoDec->decodeLock );
+			break;
+		}
+
+		pFrame = gst_video_decoder_get_oldest_frame( GST_VIDEO_DECODER (pNxVideoDec) );
+		if( (NULL == pFrame) || (pCurrent == pFrame) )
+		{
+			DisplayDone( pDecHandle, decOut.dispIdx, pDecHandle->generation );
+			g_mutex_unlock( &pNxVideoDec->decodeLock );
+			if( pFrame )
+			{
+				gst_video_codec_frame_unref( pFrame );
+			}
+			continue;
+		}
+
+		flowRet = nxvideodec_output_picture( pNxVideoDec, pFrame, &decOut );
+	}
+
+	if( bRestart )
+	{
+		pDecHandle->bFlush = TRUE;
+	}
+
+	return flowRet;
+}
+
+//
+//	A hardware call which never returns cannot be interrupted from here;
+//	the watchdog reports it on the bus, and the decoder is reset as soon
+//	as the call comes back (see HwDecodeFrame()).
+//
+static gpointer
+nxvideodec_watchdog_thread (gpointer pData)
+{
+	GstNxVideoDec *pNxVideoDec = GST_NXVIDEODEC (pData);
+	gboolean bReported = FALSE;
+	gint64 elapsed;
+	guint timeout;
+	guint period;
+	guint idle;
+	gboolean bPaused;
+
+	g_mutex_lock( &pNxVideoDec->watchdogLock );
+	while( pNxVideoDec->bWatchdogRun )
+	{
+		elapsed = 0;
+		GST_OBJECT_LOCK( pNxVideoDec );
+		timeout = pNxVideoDec->watchdogTimeout;
+		idle = pNxVideoDec->idleReclaim;
+		bPaused = (GST_STATE_PAUSED == GST_STATE (pNxVideoDec)) && (GST_STATE_VOID_PENDING == GST_STATE_PENDING (pNxVideoDec));
+		if( pNxVideoDec->pNxVideoDecHandle )
+			elapsed = GetHwCallElapsed( pNxVideoDec->pNxVideoDecHandle );
+		GST_OBJECT_UNLOCK( pNxVideoDec );
+
+		// a channel left paused gives its memory back, a busy streaming
+		// thread just defers it to the next round
+		if( idle && bPaused )
+		{
+			nxvideodec_reclaim( pNxVideoDec, (gint64)idle * 1000 );
+		}
+
+		if( timeout && (elapsed > (gint64)timeout * 1000) )
+		{
+			if( FALSE == bReported )
+			{
+				GST_ERROR_OBJECT( pNxVideoDec, "hardware call stuck for %" G_GINT64_FORMAT " msec", elapsed / 1000 );
+				gst_element_post_message( GST_ELEMENT (pNxVideoDec),
+					gst_message_new_element( GST_OBJECT (pNxVideoDec),
+						gst_structure_new( "nxvideodec-watchdog",
+							"event", G_TYPE_STRING, "hang",
+							"elapsed", G_TYPE_UINT64, (guint64)elapsed,
+							NULL ) ) );
+				bReported = TRUE;
+			}
+		}
+		else
+		{
+			bReported = FALSE;
+		}
+
+		period = timeout ? CLAMP( timeout / 4, 10, WATCHDOG_POLL_MAX ) : WATCHDOG_POLL_MAX;
+		if( idle )
+		{
+			period = MIN( period, MAX( idle / 4, 10 ) );
+		}
+		g_cond_wait_until( &pNxVideoDec->watchdogCond, &pNxVideoDec->watchdogLock,
+			g_get_monotonic_time() + (gint64)period * 1000 );
+	}
+	g_mutex_unlock( &pNxVideoDec->watchdogLock );
+
+	return NULL;
+}
+
+//
+//	Suspends the handle once no picture has been decoded for idleTime usec.
+//	The capture buffers and the stream staging memory are given back; the
+//	codec data and cached sequence headers stay, so the next frame reopens
+//	the handle and decoding restarts at a key frame. GOP-parallel decoding
+//	keeps its instances.
+//
+//	Only dmabuf slots keep their pages alive on their own (dup'd fds). GEM
+//	slots carry the flink names and the mapping of the handle, both gone
+//	once it is closed, so the reclaim waits until downstream returned them;
+//	a prerolled sink holding one may redraw it at any time.
+//
+static gboolean
+nxvideodec_holds_gem_slots (GstNxVideoDec *pNxVideoDec)
+{
+	if( (NULL == pNxVideoDec->pSlotPool) || GST_NXVIDEODEC_POOL (pNxVideoDec->pSlotPool)->bDmaBuf )
+	{
+		return FALSE;
+	}
+
+	if( 0 < gst_nxvideodec_pool_get_num_out( pNxVideoDec->pSlotPool ) )
+	{
+		GST_DEBUG_OBJECT( pNxVideoDec, "GEM slots held downstream, not reclaiming" );
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static gboolean
+nxvideodec_reclaim (GstNxVideoDec *pNxVideoDec, gint64 idleTime)
+{
+	NX_VIDEO_DEC_STRUCT *pDecHandle = NULL;
+	gboolean bReclaimed = FALSE;
+
+	// held by the streaming thread from decoding until the picture is out
+	if( !g_mutex_trylock( &pNxVideoDec->decodeLock ) )
+	{
+		return FALSE;
+	}
+
+	GST_OBJECT_LOCK( pNxVideoDec );
+	if( pNxVideoDec->pNxVideoDecHandle )
+	{
+		pDecHandle = VideoDecRef( pNxVideoDec->pNxVideoDecHandle );
+	}
+	GST_OBJECT_UNLOCK( pNxVideoDec );
+
+	if( pDecHandle && (NULL == pNxVideoDec->pGopDec) &&
+		(g_get_monotonic_time() - pNxVideoDec->lastDecodeTime >= idleTime) &&
+		!nxvideodec_holds_gem_slots( pNxVideoDec ) )
+	{
+		bReclaimed = SuspendVideoDec( pDecHandle );
+	}
+	if( bReclaimed )
+	{
+		// the prebuilt slots wrap capture buffers of the closed handle
+		nxvideodec_drop_slot_pool( pNxVideoDec );
+		GST_INFO_OBJECT( pNxVideoDec, "idle, decoder memory released (#%u)", pDecHandle->suspendCount );
+	}
+	g_mutex_unlock( &pNxVideoDec->decodeLock );
+
+	if( pDecHandle )
+	{
+		VideoDecUnref( pDecHandle );
+	}
+
+	return bReclaimed;
+}
+
+static gboolean
+nxvideodec_reclaim_action (GstNxVideoDec *pNxVideoDec)
+{
+	return nxvideodec_reclaim( pNxVideoDec, 0 );
+}
+
+static void
+nxvideodec_check_reset (GstNxVideoDec *pNxVideoDec)
+{
+	NX_VIDEO_DEC_STRUCT *pDecHandle = pNxVideoDec->pNxVideoDecHandle;
+
+	if( pDecHandle->resetCount == pNxVideoDec->resetCountSeen )
+	{
+		return;
+	}
+	pNxVideoDec->resetCountSeen = pDecHandle->resetCount;
+
+	gst_element_post_message( GST_ELEMENT (pNxVideoDec),
+		gst_message_new_element( GST_OBJECT (pNxVideoDec),
+			gst_structure_new( "nxvideodec-watchdog",
+				"event", G_TYPE_STRING, "reset",
+				"reason", G_TYPE_STRING, (NX_RESET_TIMEOUT == pDecHandle->resetReason) ? "timeout" :
+					(NX_RESET_FORMAT == pDecHandle->resetReason) ? "format" : "errors",
+				"count", G_TYPE_UINT, pDecHandle->resetCount,
+				"reset-time", G_TYPE_UINT64, pDecHandle->resetTime,
+				NULL ) ) );
+}
+
+//
+//	Points the copy fallback at sealed memfd memory: the allocator replaces
+//	the one downstream proposed and a plain video pool replaces its pool, so
+//	buffers are recycled instead of creating a memfd per frame. The size and
+//	counts downstream asked for are kept.
+//
+static void
+nxvideodec_use_memfd( GstNxVideoDec *pNxVideoDec, GstQuery *pQuery )
+{
+	GstAllocator *pAllocator = gst_nxmemfd_allocator_new();
+	GstBufferPool *pPool = gst_video_buffer_pool_new();
+	GstAllocationParams params;
+	guint size = 0, min = 0, max = 0;
+
+	gst_allocation_params_init( &params );
+	if( gst_query_get_n_allocation_params( pQuery ) > 0 )
+		gst_query_set_nth_allocation_param( pQuery, 0, pAllocator, &params );
+	else
+		gst_query_add_allocation_param( pQuery, pAllocator, &params );
+
+	if( gst_query_get_n_allocation_pools( pQuery ) > 0 )
+	{
+		gst_query_parse_nth_allocation_pool( pQuery, 0, NULL, &size, &min, &max );
+		gst_query_set_nth_allocation_pool( pQuery, 0, pPool, size, min, max );
+	}
+	else
+	{
+		gst_query_add_allocation_pool( pQuery, pPool, size, min, max );
+	}
+
+	GST_DEBUG_OBJECT( pNxVideoDec, "copying into sealed memfd buffers" );
+
+	gst_object_unref( pPool );
+	gst_object_unref( pAllocator );
+}
+
+//
+//	Pictures the base class would throw away anyway: the frame is marked
+//	decode-only (ahead of the target of an accurate seek), or the picture
+//	ends before the output segment starts. The hardware has already used
+//	them as references, so there is nothing left to do but free the slot.
+//
+static gboolean
+nxvideodec_is_decode_only (GstNxVideoDec *pNxVideoDec, GstVideoCodecFrame *pFrame, gint64 timeStamp)
+{
+	NX_VIDEO_DEC_STRUCT *pDecHandle = pNxVideoDec->pNxVideoDecHandle;
+	GstSegment *pSegment = &GST_VIDEO_DECODER_OUTPUT_SEGMENT (pNxVideoDec);
+	GstClockTime duration;
+
+	if( GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY( pFrame ) )
+	{
+		return TRUE;
+	}
+
+	if( (GST_FORMAT_TIME != pSegment->format) || (0 > timeStamp) ||
+		!GST_CLOCK_TIME_IS_VALID( pSegment->start ) || (0 == pDecHandle->fpsNum) )
+	{
+		return FALSE;
+	}
+
+	duration = gst_util_uint64_scale( GST_SECOND, pDecHandle->fpsDen, pDecHandle->fpsNum );
+	return ((GstClockTime)timeStamp + duration <= pSegment->start);
+}
+
+//
+//	Key-unit trick mode (a seek with GST_SEEK_FLAG_TRICKMODE_KEY_UNITS):
+//	demuxers honouring it only send sync points, whatever else still
+//	arrives is released undecoded. The mode is handed to the decoder, which
+//	then decodes each key unit on its own.
+//
+static gboolean
+nxvideodec_skip_key_unit_delta (GstNxVideoDec *pNxVideoDec, GstVideoCodecFrame *pFrame)
+{
+	GstSegment *pSegment = &GST_VIDEO_DECODER_INPUT_SEGMENT (pNxVideoDec);
+	gboolean bKeyUnits = (0 != (pSegment->flags & GST_SEGMENT_FLAG_TRICKMODE_KEY_UNITS));
+
+	if( NULL == pNxVideoDec->pNxVideoDecHandle )
+	{
+		return FALSE;
+	}
+
+	if( bKeyUnits != pNxVideoDec->pNxVideoDecHandle->bKeyUnitsOnly )
+	{
+		GST_INFO_OBJECT( pNxVideoDec, "key-unit trick mode %s, rate %f", bKeyUnits ? "on" : "off", pSegment->rate );
+		pNxVideoDec->pNxVideoDecHandle->bKeyUnitsOnly = bKeyUnits;
+		pNxVideoDec->lastKeyUnitTime = GST_CLOCK_TIME_NONE;
+	}
+
+	if( !bKeyUnits || GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT( pFrame ) )
+	{
+		return FALSE;
+	}
+
+	GST_OBJECT_LOCK( pNxVideoDec );
+	pNxVideoDec->skippedFrames++;
+	GST_OBJECT_UNLOCK( pNxVideoDec );
+
+	return TRUE;
+}
 
-	gst_video_codec_state_unref( pOutputState );
+//
+//	A key unit stands for the whole GOP behind it: it lasts until the next
+//	one in stream time, which the sink scales by the segment rate. The
+//	spacing of the previous two key units stands in for the next one, the
+//	first key unit of a scan keeps the frame duration.
+//
+static void
+nxvideodec_set_key_unit_duration (GstNxVideoDec *pNxVideoDec, GstVideoCodecFrame *pFrame, gint64 timeStamp)
+{
+	GstClockTime last = pNxVideoDec->lastKeyUnitTime;
 
-	pNxVideoDec->pNxVideoDecHandle->imgPlaneNum = 1;
-#if SUPPORT_NO_MEMORY_COPY
-	GST_DEBUG_OBJECT( pNxVideoDec, ">>>>> Accelerable.");
-#else
-	if( BUFFER_TYPE_GEM == pNxVideoDec->bufferType )
+	if( 0 > timeStamp )
 	{
-		GST_DEBUG_OBJECT( pNxVideoDec, ">>>>> Accelerable.");
+		return;
 	}
-#endif
 
-	ret = gst_video_decoder_negotiate( pDecoder );
-
-	if( FALSE == ret)
+	if( GST_CLOCK_TIME_IS_VALID( last ) && ((GstClockTime)timeStamp != last) )
 	{
-		GST_ERROR( "Fail Negotiate !\n");
-		return ret;
+		pFrame->duration = ((GstClockTime)timeStamp > last) ? ((GstClockTime)timeStamp - last) : (last - (GstClockTime)timeStamp);
 	}
+	pNxVideoDec->lastKeyUnitTime = (GstClockTime)timeStamp;
+}
+
+//
+//	Scales the picture into this decoder's tile of the mosaic canvas; the
+//	caller releases the frame without output. The picture waits for its
+//	running time on the mosaic's clock first. Nothing is drawn while the
+//	mosaic element is not running. A decoder that started before the
+//	mosaic was configured may have picked another format than the canvas:
+//	the canvas wins, the handle is reopened in its format and drawing
+//	resumes at the next key frame.
+//
+static void
+nxvideodec_draw_mosaic (GstNxVideoDec *pNxVideoDec, NX_V4L2DEC_OUT *pDecOut, gint64 timeStamp)
+{
+	NX_VIDEO_DEC_STRUCT *pDecHandle = pNxVideoDec->pNxVideoDecHandle;
+	GstVideoFormat format = MosaicGetFormat( pNxVideoDec->pMosaic );
+	gint tile;
 
-	if( 0 != InitVideoDec(pNxVideoDec->pNxVideoDecHandle) )
+	GST_OBJECT_LOCK( pNxVideoDec );
+	tile = pNxVideoDec->mosaicTile;
+	GST_OBJECT_UNLOCK( pNxVideoDec );
+
+	if( (GST_VIDEO_FORMAT_UNKNOWN != format) && (format != GetDecodedFormat( pDecHandle )) )
 	{
-		return FALSE;
+		if( pDecHandle->reqFourcc != VideoFormatToFourcc( format ) )
+		{
+			GST_WARNING_OBJECT( pNxVideoDec, "decoding %s into a %s mosaic, reopening the decoder in the canvas format",
+				gst_video_format_to_string( GetDecodedFormat( pDecHandle ) ), gst_video_format_to_string( format ) );
+			RequestDecodedFormat( pDecHandle, format );
+		}
 	}
+	else if( !nxvideodec_wait_mosaic( pNxVideoDec, timeStamp ) )
+	{
+		GST_LOG_OBJECT( pNxVideoDec, "flushing, tile %d not drawn", tile );
+	}
+	else if( !MosaicWriteTile( pNxVideoDec->pMosaic, tile, pDecHandle, pDecOut ) )
+	{
+		GST_LOG_OBJECT( pNxVideoDec, "no canvas to draw tile %d into", tile );
+	}
+	DisplayDone( pDecHandle, pDecOut->dispIdx, pDecHandle->generation );
 
-	FUNC_OUT();
-
-	return ret;
+	GST_OBJECT_LOCK( pNxVideoDec );
+	pNxVideoDec->copiedFrames++;
+	GST_OBJECT_UNLOCK( pNxVideoDec );
 }
 
+//
+//	Nothing downstream syncs the pictures drawn into a mosaic: without
+//	waiting, a decoder fed faster than real time overwrites its tile many
+//	times per canvas. Blocks until the mosaic's running time reaches the
+//	picture's, on the mosaic's clock and base time, the decoder need not
+//	share its pipeline. Pictures without a time, or while the mosaic does
+//	not tick, go through at once. FALSE when unscheduled by a flush.
+//
 static gboolean
-gst_nxvideodec_flush (GstVideoDecoder *pDecoder)
+nxvideodec_wait_mosaic (GstNxVideoDec *pNxVideoDec, gint64 timeStamp)
 {
-	GstNxVideoDec *pNxvideodec = GST_NXVIDEODEC (pDecoder);
+	GstSegment *pSegment = &GST_VIDEO_DECODER_OUTPUT_SEGMENT (pNxVideoDec);
+	GstClockTime runningTime;
+	GstClockID clockId;
+	GstClockReturn clockRet;
 
-	FUNC_IN();
+	if( (GST_FORMAT_TIME != pSegment->format) || (0 > timeStamp) )
+	{
+		return TRUE;
+	}
+	runningTime = gst_segment_to_running_time( pSegment, GST_FORMAT_TIME, (GstClockTime)timeStamp );
+	if( !GST_CLOCK_TIME_IS_VALID( runningTime ) )
+	{
+		return TRUE;
+	}
 
-	GST_DEBUG_OBJECT (pNxvideodec, "flush");
+	clockId = MosaicNewClockId( pNxVideoDec->pMosaic, runningTime );
+	if( NULL == clockId )
+	{
+		return TRUE;
+	}
 
-	if( pNxvideodec->pNxVideoDecHandle )
+	GST_OBJECT_LOCK( pNxVideoDec );
+	if( pNxVideoDec->bMosaicFlushing )
 	{
-		pNxvideodec->pNxVideoDecHandle->bFlush = TRUE;
+		GST_OBJECT_UNLOCK( pNxVideoDec );
+		gst_clock_id_unref( clockId );
+		return FALSE;
 	}
+	pNxVideoDec->mosaicClockId = clockId;
+	GST_OBJECT_UNLOCK( pNxVideoDec );
 
-	FUNC_OUT();
+	clockRet = gst_clock_id_wait( clockId, NULL );
 
-	return TRUE;
+	GST_OBJECT_LOCK( pNxVideoDec );
+	pNxVideoDec->mosaicClockId = NULL;
+	GST_OBJECT_UNLOCK( pNxVideoDec );
+	gst_clock_id_unref( clockId );
+
+	return (GST_CLOCK_UNSCHEDULED != clockRet);
 }
 
-#if SUPPORT_NO_MEMORY_COPY
+// wakes a streaming thread waiting for the mosaic, which would hold up a flush or a stop
 static void
-nxvideodec_get_offset_stride(gint width, gint height, guint8 *pSrc, gsize *pOffset, gint *pStride )
+nxvideodec_set_mosaic_flushing (GstNxVideoDec *pNxVideoDec, gboolean bFlushing)
 {
-	guint8 *plu = NULL;
-	guint8 *pcb = NULL;
-	guint8 *pcr = NULL;
-	gint luStride = 0;
-	gint luVStride = 0;
-	gint cStride = 0;
-	gint cVStride = 0;
-
-	luStride = ALIGN(width, 32);
-	luVStride = ALIGN(height, 16);
-	cStride = luStride/2;
-	cVStride = ALIGN(height/2, 16);
-	plu = pSrc;
-	pcb = plu + luStride * luVStride;
-	pcr = pcb + cStride * cVStride;
-
-	pOffset[0] = 0;
-	pOffset[1] = pcb - plu;
-	pOffset[2] = pcr - plu;
-
-	pStride[0] = luStride;
-	pStride[1] = cStride;
-	pStride[2] = cStride;
+	GST_OBJECT_LOCK( pNxVideoDec );
+	pNxVideoDec->bMosaicFlushing = bFlushing;
+	if( bFlushing && pNxVideoDec->mosaicClockId )
+	{
+		gst_clock_id_unschedule( pNxVideoDec->mosaicClockId );
+	}
+	GST_OBJECT_UNLOCK( pNxVideoDec );
 }
 
-static GstFlowReturn
-gst_nxvideodec_handle_frame (GstVideoDecoder *pDecoder, GstVideoCodecFrame *pFrame)
+static gboolean
+gst_nxvideodec_sink_event (GstVideoDecoder *pDecoder, GstEvent *pEvent)
 {
 	GstNxVideoDec *pNxVideoDec = GST_NXVIDEODEC (pDecoder);
-	NX_V4L2DEC_OUT decOut;
-	gint64 timeStamp = 0;
-	GstMapInfo mapInfo;
-	gint ret = 0;
-	gboolean bKeyFrame = FALSE;
-
-	GstMemory *pGstmem = NULL;
-	GstBuffer *pGstbuf = NULL;
-	struct video_meta_mmap_buffer *pMeta = NULL;
-
-	NX_VID_MEMORY_INFO *pImg = NULL;
-	GstVideoCodecState *pState = NULL;
-
-	unsigned char *pVadd = NULL;
-	GstVideoMeta *pVmeta = NULL;
-	gint videoImgSize = 0;
 
-	guint n_planes = 0;
-	gsize offset[3] = {0, };
-	gint stride[3] = {0, };
+	switch( GST_EVENT_TYPE( pEvent ) )
+	{
+		case GST_EVENT_FLUSH_START:
+			nxvideodec_set_mosaic_flushing( pNxVideoDec, TRUE );
+			break;
+		case GST_EVENT_FLUSH_STOP:
+			nxvideodec_set_mosaic_flushing( pNxVideoDec, FALSE );
+			break;
+		default:
+			break;
+	}
 
-	GstMemory *pMemMMVideoData = NULL;
+	return GST_VIDEO_DECODER_CLASS (gst_nxvideodec_parent_class)->sink_event (pDecoder, pEvent);
+}
 
-	FUNC_IN();
+// the sink pad is deactivated under the stream lock, a waiting picture has to let go first
+static GstStateChangeReturn
+gst_nxvideodec_change_state (GstElement *pElement, GstStateChange transition)
+{
+	GstNxVideoDec *pNxVideoDec = GST_NXVIDEODEC (pElement);
 
-	if (!gst_buffer_map (pFrame->input_buffer, &mapInfo, GST_MAP_READ))
+	if( GST_STATE_CHANGE_READY_TO_PAUSED == transition )
 	{
-		GST_ERROR("Cannot map input buffer!");
-		gst_video_codec_frame_unref (pFrame);
-		return GST_FLOW_ERROR;
+		nxvideodec_set_mosaic_flushing( pNxVideoDec, FALSE );
+	}
+	else if( GST_STATE_CHANGE_PAUSED_TO_READY == transition )
+	{
+		nxvideodec_set_mosaic_flushing( pNxVideoDec, TRUE );
 	}
 
-	bKeyFrame = GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT(pFrame);
+	return GST_ELEMENT_CLASS (gst_nxvideodec_parent_class)->change_state (pElement, transition);
+}
 
-	ret = VideoDecodeFrame(pNxVideoDec->pNxVideoDecHandle, pFrame->input_buffer, &decOut, bKeyFrame);
+//
+//	Downstream without a pool, or offering a plain pool over system
+//	memory, has no preference of its own: the copies then go to a video
+//	pool over cache line aligned, huge page backed memory, which recycles
+//	its buffers like any other pool.
+//
+static gboolean
+nxvideodec_use_aligned_pool( GstNxVideoDec *pNxVideoDec, GstQuery *pQuery )
+{
+	GstBufferPool *pPool = NULL;
+	GstAllocator *pAllocator = NULL;
+	GstAllocationParams params;
+	guint size = 0, min = 0, max = 0;
+	gboolean bPlain = TRUE;
 
-	gst_buffer_unmap (pFrame->input_buffer, &mapInfo);
-	if( DEC_ERR == ret )
+	if( gst_query_get_n_allocation_pools( pQuery ) > 0 )
 	{
-		GetTimeStamp(pNxVideoDec->pNxVideoDecHandle, &timeStamp);
-		return gst_video_decoder_drop_frame(pDecoder, pFrame);
+		gst_query_parse_nth_allocation_pool( pQuery, 0, &pPool, &size, &min, &max );
+		if( pPool )
+		{
+			bPlain = (GST_TYPE_BUFFER_POOL == G_OBJECT_TYPE( pPool )) || (GST_TYPE_VIDEO_BUFFER_POOL == G_OBJECT_TYPE( pPool ));
+			gst_object_unref( pPool );
+		}
 	}
-	else if( DEC_INIT_ERR == ret )
+	if( bPlain && (gst_query_get_n_allocation_params( pQuery ) > 0) )
 	{
-		return GST_FLOW_ERROR;
+		gst_query_parse_nth_allocation_param( pQuery, 0, &pAllocator, NULL );
+		if( pAllocator )
+		{
+			bPlain = pAllocator->mem_type && !strcmp( pAllocator->mem_type, GST_ALLOCATOR_SYSMEM );
+			gst_object_unref( pAllocator );
+		}
 	}
-
-	if( decOut.dispIdx < 0 )
+	if( !bPlain )
 	{
-		return GST_FLOW_OK;
+		return FALSE;
 	}
 
-	GST_DEBUG_OBJECT( pNxVideoDec, " decOut.dispIdx: %d\n",decOut.dispIdx );
-
-	pMeta = (struct video_meta_mmap_buffer *)g_malloc(sizeof(struct video_meta_mmap_buffer));
+	pAllocator = gst_nxaligned_allocator_new();
+	gst_allocation_params_init( &params );
+	params.align = NX_ALIGNED_MIN_ALIGN - 1;
+	if( gst_query_get_n_allocation_params( pQuery ) > 0 )
+		gst_query_set_nth_allocation_param( pQuery, 0, pAllocator, &params );
+	else
+		gst_query_add_allocation_param( pQuery, pAllocator, &params );
 
-	if (!pMeta)
-	{
-		GST_ERROR_OBJECT(pNxVideoDec, "failed to malloc for meta");
-		gst_video_codec_frame_unref (pFrame);
-		return GST_FLOW_ERROR;
-	}
+	pPool = gst_video_buffer_pool_new();
+	if( gst_query_get_n_allocation_pools( pQuery ) > 0 )
+		gst_query_set_nth_allocation_pool( pQuery, 0, pPool, size, min, max );
+	else
+		gst_query_add_allocation_pool( pQuery, pPool, size, min, max );
 
-	pImg = &decOut.hImg;
-	pMeta->v4l2BufferIdx = decOut.dispIdx;
-	pVadd = pImg->pBuffer[0];
-	pMeta->pNxVideoDec = pNxVideoDec;
+	gst_object_unref( pPool );
+	gst_object_unref( pAllocator );
 
-	videoImgSize = pNxVideoDec->pNxVideoDecHandle->width * pNxVideoDec->pNxVideoDecHandle->height * 1.5;
+	return TRUE;
+}
 
-	pGstmem = gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY,
-				pVadd,
-				videoImgSize,
-				0,
-				videoImgSize,
-				pMeta,
-				nxvideodec_buffer_finalize);
+//
+//	With GstVideoMeta downstream, pads the rows of the pool set up by the
+//	base class to a multiple of 128 luma bytes: every row of every plane
+//	then starts on a cache line and the copy kernels never split a store.
+//
+static void
+nxvideodec_pad_pool_strides( GstNxVideoDec *pNxVideoDec, GstQuery *pQuery )
+{
+	GstVideoCodecState *pState = NULL;
+	GstBufferPool *pPool = NULL;
+	GstStructure *pConfig;
+	GstVideoAlignment align;
+	gint width;
 
-	if (!pGstmem)
+	if( !pNxVideoDec->bVideoMetaOut || (0 == gst_query_get_n_allocation_pools( pQuery )) )
 	{
-		GST_ERROR_OBJECT(pNxVideoDec, "failed to gst_memory_new_wrapped for mmap buffer");
-		gst_video_codec_frame_unref (pFrame);
-		goto HANDLE_ERROR;
+		return;
 	}
 
-	pGstbuf = gst_buffer_new();
-	if (!pGstbuf)
+	pState = gst_video_decoder_get_output_state( GST_VIDEO_DECODER (pNxVideoDec) );
+	gst_query_parse_nth_allocation_pool( pQuery, 0, &pPool, NULL, NULL, NULL );
+	if( (NULL == pState) || (NULL == pPool) )
 	{
-		GST_ERROR_OBJECT(pNxVideoDec, "failed to gst_buffer_new");
-		gst_video_codec_frame_unref (pFrame);
-		goto HANDLE_ERROR;
+		goto done;
 	}
-	gst_buffer_append_memory(pGstbuf, pGstmem);
-
-	n_planes = 3;
-	nxvideodec_get_offset_stride(pNxVideoDec->pNxVideoDecHandle->width, pNxVideoDec->pNxVideoDecHandle->height,
-									(guint8 *)pImg->pBuffer[0], offset, stride );
 
-	pState = gst_video_decoder_get_output_state (pDecoder);
+	width = GST_VIDEO_INFO_WIDTH( &pState->info );
+	gst_video_alignment_reset( &align );
+	align.padding_right = GST_ROUND_UP_128( width ) - width;
 
-	pVmeta = gst_buffer_add_video_meta_full (pGstbuf, GST_VIDEO_FRAME_FLAG_NONE, GST_VIDEO_INFO_FORMAT (&pState->info),
-											GST_VIDEO_INFO_WIDTH (&pState->info), GST_VIDEO_INFO_HEIGHT (&pState->info),
-											n_planes, offset, stride);
-	if (!pVmeta)
+	pConfig = gst_buffer_pool_get_config( pPool );
+	gst_buffer_pool_config_add_option( pConfig, GST_BUFFER_POOL_OPTION_VIDEO_META );
+	gst_buffer_pool_config_add_option( pConfig, GST_BUFFER_POOL_OPTION_VIDEO_ALIGNMENT );
+	gst_buffer_pool_config_set_video_alignment( pConfig, &align );
+	if( !gst_buffer_pool_set_config( pPool, pConfig ) )
 	{
-		GST_ERROR_OBJECT(pNxVideoDec, "failed to gst_buffer_add_video_meta_full");
-		gst_video_codec_state_unref (pState);
-		gst_video_codec_frame_unref (pFrame);
-		goto HANDLE_ERROR;
+		GST_WARNING_OBJECT( pNxVideoDec, "pool refused padded strides" );
 	}
 
-	pMemMMVideoData = nxvideodec_mmvideobuf_copy(&decOut);
-	if (!pMemMMVideoData)
-	{
-		GST_ERROR("failed to get zero copy data");
-		gst_video_codec_state_unref (pState);
-		gst_video_codec_frame_unref (pFrame);
-		goto HANDLE_ERROR;
-	}
-	else
-	{
-		gst_buffer_append_memory(pGstbuf, pMemMMVideoData);
-	}
-	gst_buffer_add_mmvideobuffer_meta( pGstbuf, 1 );
+done:
+	if( pPool )
+		gst_object_unref( pPool );
+	if( pState )
+		gst_video_codec_state_unref( pState );
+}
 
-	pFrame->output_buffer = pGstbuf;
+static gboolean
+gst_nxvideodec_decide_allocation (GstVideoDecoder *pDecoder, GstQuery *pQuery)
+{
+	GstNxVideoDec *pNxVideoDec = GST_NXVIDEODEC (pDecoder);
+	gboolean bAligned = FALSE;
+	gint copyMemory;
 
-	if( -1 == GetTimeStamp(pNxVideoDec->pNxVideoDecHandle, &timeStamp) )
-	{
-		GST_DEBUG_OBJECT (pNxVideoDec, "Cannot Found Time Stamp!!!");
-	}
-	pFrame->pts = timeStamp;
-	GST_BUFFER_PTS(pFrame->output_buffer) = timeStamp;
+	FUNC_IN();
 
-	gst_video_codec_state_unref (pState);
+	pNxVideoDec->bVideoMetaOut = gst_query_find_allocation_meta( pQuery, GST_VIDEO_META_API_TYPE, NULL );
+	pNxVideoDec->bCropMetaOut = gst_query_find_allocation_meta( pQuery, GST_VIDEO_CROP_META_API_TYPE, NULL );
+	GST_DEBUG_OBJECT( pNxVideoDec, "downstream %s GstVideoMeta, %s GstVideoCropMeta",
+		pNxVideoDec->bVideoMetaOut ? "supports" : "does not support",
+		pNxVideoDec->bCropMetaOut ? "supports" : "does not support" );
 
-	ret = gst_video_decoder_finish_frame (pDecoder, pFrame);
+	GST_OBJECT_LOCK( pNxVideoDec );
+	copyMemory = pNxVideoDec->copyMemory;
+	GST_OBJECT_UNLOCK( pNxVideoDec );
 
-	FUNC_OUT();
+	if( NX_COPY_MEMORY_MEMFD == copyMemory )
+		nxvideodec_use_memfd( pNxVideoDec, pQuery );
+	else if( !pNxVideoDec->bDmaBufOut )
+		bAligned = nxvideodec_use_aligned_pool( pNxVideoDec, pQuery );
 
-	return ret;
+	// the base class still sets up the pool the copy fallback draws from
+	if( !GST_VIDEO_DECODER_CLASS (gst_nxvideodec_parent_class)->decide_allocation (pDecoder, pQuery) )
+	{
+		return FALSE;
+	}
 
-HANDLE_ERROR:
-	if (pGstbuf)
+	if( bAligned )
 	{
-		g_free(pGstbuf);
+		GST_DEBUG_OBJECT( pNxVideoDec, "copying into aligned huge page buffers" );
+		nxvideodec_pad_pool_strides( pNxVideoDec, pQuery );
 	}
-	if (pGstmem)
+
+	FUNC_OUT();
+
+	return TRUE;
+}
+
+static GstFlowReturn
+gst_nxvideodec_handle_frame (GstVideoDecoder *pDecoder, GstVideoCodecFrame *pFrame)
+{
+	GstNxVideoDec *pNxVideoDec = GST_NXVIDEODEC (pDecoder);
+
+	if( nxvideodec_skip_key_unit_delta( pNxVideoDec, pFrame ) )
 	{
-		g_free(pGstmem);
+		gst_video_decoder_release_frame( pDecoder, pFrame );
+		return GST_FLOW_OK;
 	}
-	if (pMeta)
+
+	if( pNxVideoDec->pGopDec )
 	{
-		nxvideodec_buffer_finalize(pMeta);
+		return nxvideodec_handle_frame_parallel( pNxVideoDec, pFrame );
 	}
 
-	return GST_FLOW_ERROR;
+	return nxvideodec_handle_frame_serial( pNxVideoDec, pFrame );
 }
-#else
+
 static GstFlowReturn
-gst_nxvideodec_handle_frame (GstVideoDecoder *pDecoder, GstVideoCodecFrame *pFrame)
+nxvideodec_handle_frame_serial (GstNxVideoDec *pNxVideoDec, GstVideoCodecFrame *pFrame)
 {
-	GstNxVideoDec *pNxVideoDec = GST_NXVIDEODEC (pDecoder);
+	GstVideoDecoder *pDecoder = GST_VIDEO_DECODER (pNxVideoDec);
 	NX_V4L2DEC_OUT decOut;
 	gint64 timeStamp = 0;
 	GstMapInfo mapInfo;
 	gint ret = 0;
+	GstFlowReturn flowRet;
 	gboolean bKeyFrame = FALSE;
-	GstMemory *pGstmem = NULL;
-	GstBuffer *pGstbuf = NULL;
-	struct video_meta_mmap_buffer *pMeta = NULL;
-	GstMemory *pMemMMVideoData = NULL;
 
 	FUNC_IN();
 
@@ -782,104 +2563,214 @@ gst_nxvideodec_handle_frame (GstVideoDecoder *pDecoder, GstVideoCodecFrame *pFra
 		return GST_FLOW_ERROR;
 	}
 
+	nxvideodec_update_stream_thread_attr( pNxVideoDec );
+
 	bKeyFrame = GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT(pFrame);
 
+	// keeps a reclaim from closing the handle until the picture is out;
+	// released before anything is pushed, a prerolled sink blocks there
+	g_mutex_lock( &pNxVideoDec->decodeLock );
+
+	// a new size in-band reopens the handle, the pictures it still holds
+	// for reordering go out first
+	if( IsInbandResizeFrame( pNxVideoDec->pNxVideoDecHandle, mapInfo.data, mapInfo.size, bKeyFrame ) )
+	{
+		g_mutex_unlock( &pNxVideoDec->decodeLock );
+		flowRet = nxvideodec_drain_serial( pNxVideoDec, pFrame, FALSE );
+		if( GST_FLOW_OK != flowRet )
+		{
+			gst_buffer_unmap (pFrame->input_buffer, &mapInfo);
+			gst_video_codec_frame_unref (pFrame);
+			return flowRet;
+		}
+		g_mutex_lock( &pNxVideoDec->decodeLock );
+	}
+	pNxVideoDec->lastDecodeTime = g_get_monotonic_time();
+
 	ret = VideoDecodeFrame(pNxVideoDec->pNxVideoDecHandle, pFrame->input_buffer, &decOut, bKeyFrame);
+	nxvideodec_check_reset( pNxVideoDec );
+
+	if( pNxVideoDec->cfgSerialSeen != pNxVideoDec->pNxVideoDecHandle->cfgSerial )
+	{
+		pNxVideoDec->cfgSerialSeen = pNxVideoDec->pNxVideoDecHandle->cfgSerial;
+		if( !nxvideodec_set_output_state( pNxVideoDec ) )
+		{
+			GST_WARNING_OBJECT( pNxVideoDec, "cannot renegotiate %dx%d", pNxVideoDec->pNxVideoDecHandle->width,
+				pNxVideoDec->pNxVideoDecHandle->height );
+		}
+	}
 
 	gst_buffer_unmap (pFrame->input_buffer, &mapInfo);
 	if( DEC_ERR == ret )
 	{
 		GetTimeStamp(pNxVideoDec->pNxVideoDecHandle, &timeStamp);
+		g_mutex_unlock( &pNxVideoDec->decodeLock );
 		gst_video_codec_frame_unref (pFrame);
 		return gst_video_decoder_drop_frame(pDecoder, pFrame);
 	}
+	else if( DEC_BUDGET_ERR == ret )
+	{
+		g_mutex_unlock( &pNxVideoDec->decodeLock );
+		GST_ELEMENT_ERROR( pNxVideoDec, RESOURCE, NO_SPACE_LEFT,
+			("Decoder memory budget exhausted."), ("Cannot reserve the frame buffers for this stream."));
+		gst_video_codec_frame_unref (pFrame);
+		return GST_FLOW_ERROR;
+	}
 	else if( DEC_INIT_ERR == ret )
 	{
+		g_mutex_unlock( &pNxVideoDec->decodeLock );
 		gst_video_codec_frame_unref (pFrame);
 		return GST_FLOW_ERROR;
 	}
 
 	if( decOut.dispIdx < 0 )
 	{
+		g_mutex_unlock( &pNxVideoDec->decodeLock );
 		gst_video_codec_frame_unref (pFrame);
 		return GST_FLOW_OK;
 	}
 
-	GST_DEBUG_OBJECT( pNxVideoDec, " decOut.dispIdx: %d\n",decOut.dispIdx );
+	ret = nxvideodec_output_picture( pNxVideoDec, pFrame, &decOut );
 
-	if( BUFFER_TYPE_GEM == pNxVideoDec->bufferType )
+	FUNC_OUT();
+
+	return ret;
+}
+
+
+//
+//	Hands a decoded picture out as the output of pFrame: wrapped in its
+//	capture buffer, copied, drawn into the mosaic or only released.
+//	Called with decodeLock held, which is released before anything is
+//	pushed.
+//
+static GstFlowReturn
+nxvideodec_output_picture (GstNxVideoDec *pNxVideoDec, GstVideoCodecFrame *pFrame, NX_V4L2DEC_OUT *pDecOut)
+{
+	GstVideoDecoder *pDecoder = GST_VIDEO_DECODER (pNxVideoDec);
+	gint64 timeStamp = 0;
+	gboolean bFdSlots = FALSE;
+	gboolean bFiltered = FALSE;
+	GstBuffer *pGstbuf = NULL;
+
+	GST_DEBUG_OBJECT( pNxVideoDec, " decOut.dispIdx: %d\n", pDecOut->dispIdx );
+
+	if( -1 == GetTimeStamp(pNxVideoDec->pNxVideoDecHandle, &timeStamp) )
+	{
+		GST_DEBUG_OBJECT (pNxVideoDec, "Cannot Found Time Stamp!!!");
+	}
+
+	if( pNxVideoDec->pNxVideoDecHandle->bKeyUnitsOnly )
+	{
+		nxvideodec_set_key_unit_duration( pNxVideoDec, pFrame, timeStamp );
+	}
+
+	// the picture only served as a reference on the way to a seek target
+	if( nxvideodec_is_decode_only( pNxVideoDec, pFrame, timeStamp ) )
+	{
+		GST_LOG_OBJECT( pNxVideoDec, "decode-only picture %" GST_TIME_FORMAT ", slot %d released",
+			GST_TIME_ARGS( timeStamp ), pDecOut->dispIdx );
+		DisplayDone( pNxVideoDec->pNxVideoDecHandle, pDecOut->dispIdx, pNxVideoDec->pNxVideoDecHandle->generation );
+		g_mutex_unlock( &pNxVideoDec->decodeLock );
+
+		GST_OBJECT_LOCK( pNxVideoDec );
+		pNxVideoDec->skippedFrames++;
+		GST_OBJECT_UNLOCK( pNxVideoDec );
+
+		gst_video_decoder_release_frame( pDecoder, pFrame );
+		return GST_FLOW_OK;
+	}
+
+	if( pNxVideoDec->pMosaic )
+	{
+		nxvideodec_draw_mosaic( pNxVideoDec, pDecOut, timeStamp );
+		g_mutex_unlock( &pNxVideoDec->decodeLock );
+		gst_video_decoder_release_frame( pDecoder, pFrame );
+		return GST_FLOW_OK;
+	}
+
+	// scaled, de-interlaced and converted pictures only exist as copies
+	bFiltered = pNxVideoDec->bScaledOut || IsConvertedPicture( pNxVideoDec->pNxVideoDecHandle ) ||
+		((NX_DEINTERLACE_OFF != pNxVideoDec->pNxVideoDecHandle->deinterlace) &&
+		 IsInterlacedPicture( pNxVideoDec->pNxVideoDecHandle, pDecOut ));
+
+	// A NORMAL buffer type only copies when downstream cannot take strided
+	// planes; the dmabuf fds keep the pages alive across a decoder reset.
+	bFdSlots = pNxVideoDec->bDmaBufOut ||
+		((BUFFER_TYPE_NORMAL == pNxVideoDec->bufferType) && pNxVideoDec->bVideoMetaOut && (0 <= pDecOut->hImg.dmaFd[0]) &&
+		 !bFiltered);
+
+	// system memory frames can always be copied instead, GEM and
+	// memory:DMABuf consumers need the capture buffer itself
+	if( bFdSlots && !pNxVideoDec->bDmaBufOut && nxvideodec_copy_on_hold( pNxVideoDec ) )
 	{
-		pGstbuf = gst_buffer_new();
-		if (!pGstbuf)
+		bFdSlots = FALSE;
+	}
+
+	// the same backwards, where GEM and memory:DMABuf output cannot fall
+	// back to copies: the rest of the GOP is dropped rather than waiting
+	// forever for a capture buffer to decode into
+	if( (0.0 > GST_VIDEO_DECODER_INPUT_SEGMENT (pNxVideoDec).rate) &&
+		(pNxVideoDec->bDmaBufOut || ((BUFFER_TYPE_GEM == pNxVideoDec->bufferType) && !bFiltered)) &&
+		nxvideodec_copy_on_hold( pNxVideoDec ) )
+	{
+		GST_LOG_OBJECT( pNxVideoDec, "no capture buffer left for reverse playback, dropping %" GST_TIME_FORMAT,
+			GST_TIME_ARGS( timeStamp ) );
+		DisplayDone( pNxVideoDec->pNxVideoDecHandle, pDecOut->dispIdx, pNxVideoDec->pNxVideoDecHandle->generation );
+		g_mutex_unlock( &pNxVideoDec->decodeLock );
+		return gst_video_decoder_drop_frame( pDecoder, pFrame );
+	}
+
+	if( bFdSlots || ((BUFFER_TYPE_GEM == pNxVideoDec->bufferType) && !bFiltered) )
+	{
+		GstNxVideoDecPoolAcquireParams params;
+
+		// a reset, a new sequence or a new output mode invalidates the prebuilt slots
+		if( pNxVideoDec->pSlotPool &&
+			((GST_NXVIDEODEC_POOL (pNxVideoDec->pSlotPool)->generation != pNxVideoDec->pNxVideoDecHandle->generation) ||
+			 (GST_NXVIDEODEC_POOL (pNxVideoDec->pSlotPool)->bDmaBuf != bFdSlots) ||
+			 (GST_NXVIDEODEC_POOL (pNxVideoDec->pSlotPool)->bCropMeta != pNxVideoDec->bCropMetaOut)) )
 		{
-			GST_ERROR_OBJECT(pNxVideoDec, "failed to gst_buffer_new");
-			gst_video_codec_frame_unref (pFrame);
-			goto HANDLE_ERROR;
+			nxvideodec_drop_slot_pool( pNxVideoDec );
 		}
-
-		pMemMMVideoData = nxvideodec_mmvideobuf_copy(&decOut);
-		if (!pMemMMVideoData)
+		if( NULL == pNxVideoDec->pSlotPool )
 		{
-			GST_ERROR("failed to get zero copy data");
-			gst_video_codec_frame_unref (pFrame);
-			goto HANDLE_ERROR;
+			pNxVideoDec->pSlotPool = gst_nxvideodec_pool_new( pNxVideoDec->pNxVideoDecHandle, bFdSlots, pNxVideoDec->bCropMetaOut );
 		}
-		gst_buffer_append_memory(pGstbuf, pMemMMVideoData);
 
-		pMeta = (struct video_meta_mmap_buffer *)g_malloc(sizeof(struct video_meta_mmap_buffer));
-		if (!pMeta)
+		memset( &params, 0, sizeof(params) );
+		params.pDecOut = pDecOut;
+		if( (NULL == pNxVideoDec->pSlotPool) ||
+			(GST_FLOW_OK != gst_buffer_pool_acquire_buffer( pNxVideoDec->pSlotPool, &pGstbuf, (GstBufferPoolAcquireParams *)&params )) )
 		{
-			GST_ERROR_OBJECT(pNxVideoDec, "failed to malloc for meta");
+			GST_ERROR_OBJECT(pNxVideoDec, "failed to acquire output buffer for slot %d", pDecOut->dispIdx);
+			DisplayDone( pNxVideoDec->pNxVideoDecHandle, pDecOut->dispIdx, pNxVideoDec->pNxVideoDecHandle->generation );
+			g_mutex_unlock( &pNxVideoDec->decodeLock );
 			gst_video_codec_frame_unref (pFrame);
 			return GST_FLOW_ERROR;
 		}
-		pMeta->v4l2BufferIdx = decOut.dispIdx;
-		pMeta->pNxVideoDec = pNxVideoDec;
-		pGstmem = gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY,
-										pMeta,
-										sizeof(struct video_meta_mmap_buffer),
-										0,
-										sizeof(struct video_meta_mmap_buffer),
-										pMeta,
-										nxvideodec_buffer_finalize);
-		if (!pGstmem)
-		{
-			GST_ERROR_OBJECT(pNxVideoDec, "failed to gst_memory_new_wrapped for mmap buffer");
-			gst_video_codec_frame_unref (pFrame);
-			goto HANDLE_ERROR;
-		}
-		gst_buffer_append_memory(pGstbuf, pGstmem);
-
-		gst_buffer_add_mmvideobuffer_meta( pGstbuf, 0 );
 
 		pFrame->output_buffer = pGstbuf;
+		g_mutex_unlock( &pNxVideoDec->decodeLock );
+
+		GST_OBJECT_LOCK( pNxVideoDec );
+		pNxVideoDec->zeroCopyFrames++;
+		GST_OBJECT_UNLOCK( pNxVideoDec );
 
-		if( -1 == GetTimeStamp(pNxVideoDec->pNxVideoDecHandle, &timeStamp) )
-		{
-			GST_DEBUG_OBJECT (pNxVideoDec, "Cannot Found Time Stamp!!!");
-		}
 		pFrame->pts = timeStamp;
 		GST_BUFFER_PTS(pFrame->output_buffer) = timeStamp;
 	}
 	else
 	{
 		GstVideoFrame videoFrame;
-		NX_VID_MEMORY_INFO *pImg = NULL;
-		guint8 *pPtr = NULL;;
 		GstVideoCodecState *pState = NULL;
 		GstFlowReturn flowRet;
-		guint8 *plu = NULL;
-		guint8 *pcb = NULL;
-		guint8 *pcr = NULL;
-		gint luStride = 0;
-		gint luVStride = 0;
-		gint cStride = 0;
-		gint cVStride = 0;
 
 		flowRet = gst_video_decoder_allocate_output_frame (pDecoder, pFrame);
 		pState = gst_video_decoder_get_output_state (pDecoder);
 		if (flowRet != GST_FLOW_OK)
 		{
+			g_mutex_unlock( &pNxVideoDec->decodeLock );
 			gst_video_codec_state_unref (pState);
 			gst_video_codec_frame_unref (pFrame);
 			return flowRet;
@@ -888,162 +2779,35 @@ gst_nxvideodec_handle_frame (GstVideoDecoder *pDecoder, GstVideoCodecFrame *pFra
 		if (!gst_video_frame_map (&videoFrame, &pState->info, pFrame->output_buffer, GST_MAP_WRITE))
 		{
 			GST_ERROR ("Cannot video frame map!\n");
+			g_mutex_unlock( &pNxVideoDec->decodeLock );
 			gst_video_codec_state_unref (pState);
 			gst_video_codec_frame_unref (pFrame);
 			return GST_FLOW_ERROR;
 		}
 
-		if( -1 == GetTimeStamp(pNxVideoDec->pNxVideoDecHandle, &timeStamp) )
-		{
-			GST_DEBUG_OBJECT (pNxVideoDec, "Cannot Found Time Stamp!!!");
-		}
 		pFrame->pts = timeStamp;
 		GST_BUFFER_PTS(pFrame->output_buffer) = timeStamp;
 
-		pImg = &decOut.hImg;
-		pPtr = GST_VIDEO_FRAME_COMP_DATA (&videoFrame, 0);
-
-		luStride = ALIGN(pNxVideoDec->pNxVideoDecHandle->width, 32);
-		luVStride = ALIGN(pNxVideoDec->pNxVideoDecHandle->height, 16);
-		cStride = luStride/2;
-		cVStride = ALIGN(pNxVideoDec->pNxVideoDecHandle->height/2, 16);
-		plu = (guint8 *)pImg->pBuffer[0];
-		pcb = plu + luStride * luVStride;
-		pcr = pcb + cStride * cVStride;
+		CopyDecodedPicture( pNxVideoDec->pNxVideoDecHandle, pDecOut, &videoFrame );
 
-		CopyImageToBufferYV12( (guint8*)plu, (guint8*)pcb, (guint8*)pcr,
-				pPtr, luStride, cStride, pNxVideoDec->pNxVideoDecHandle->width, pNxVideoDec->pNxVideoDecHandle->height );
-
-		DisplayDone( pNxVideoDec->pNxVideoDecHandle, decOut.dispIdx );
+		DisplayDone( pNxVideoDec->pNxVideoDecHandle, pDecOut->dispIdx, pNxVideoDec->pNxVideoDecHandle->generation );
+		g_mutex_unlock( &pNxVideoDec->decodeLock );
 
 		gst_video_frame_unmap (&videoFrame);
 		gst_video_codec_state_unref (pState);
-	}
-
-	ret = gst_video_decoder_finish_frame (pDecoder, pFrame);
-
-	FUNC_OUT();
-
-	return ret;
-
-HANDLE_ERROR:
-	if (pGstbuf)
-	{
-		g_free(pGstbuf);
-	}
-	if (pMeta)
-	{
-		nxvideodec_buffer_finalize(pMeta);
-	}
-
-	return GST_FLOW_ERROR;
-}
-#endif
-
-static void nxvideodec_buffer_finalize(gpointer pData)
-{
-	gint ret = 0;
-
-	FUNC_IN();
-
-	struct video_meta_mmap_buffer *pMeta = (struct video_meta_mmap_buffer *)pData;
-
-	if( !pMeta )
-	{
-		GST_ERROR("Error: pData is null !");
-		return;
-	}
 
-	if ( ( pMeta->pNxVideoDec) && ( pMeta->pNxVideoDec->pNxVideoDecHandle ) )
-	{
-		pthread_mutex_lock( &pMeta->pNxVideoDec->mutex );
-		if( PLAY == pMeta->pNxVideoDec->isState )
-		{
-			GST_DEBUG_OBJECT( pMeta->pNxVideoDec, "v4l2BufferIdx: %d\n",pMeta->v4l2BufferIdx );
-			ret = DisplayDone( pMeta->pNxVideoDec->pNxVideoDecHandle, pMeta->v4l2BufferIdx );
-			if ( ret )
-			{
-				g_print("Fail: DisplayDone !");
-			}
-		}
-		pthread_mutex_unlock( &pMeta->pNxVideoDec->mutex );
-	}
-	else
-	{
-		GST_ERROR("Error: hCodec is null !");
+		GST_OBJECT_LOCK( pNxVideoDec );
+		pNxVideoDec->copiedFrames++;
+		GST_OBJECT_UNLOCK( pNxVideoDec );
 	}
 
-	if( pMeta )
+	SetInterlaceFlags( pNxVideoDec->pNxVideoDecHandle, pDecOut, pFrame->output_buffer );
+	if( !pNxVideoDec->bInterlacedOut && GST_BUFFER_FLAG_IS_SET( pFrame->output_buffer, GST_VIDEO_BUFFER_FLAG_INTERLACED ) )
 	{
-		g_free(pMeta);
+		nxvideodec_set_mixed_interlace( pNxVideoDec );
 	}
-}
 
-static GstMemory *nxvideodec_mmvideobuf_copy(NX_V4L2DEC_OUT *pDecOut)
-{
-	GstMemory *pMeta = NULL;
-	MMVideoBuffer *pMMVideoBuf = NULL;
-
-	pMMVideoBuf = (MMVideoBuffer *)g_malloc(sizeof(MMVideoBuffer));
-	if (!pMMVideoBuf)
-	{
-		GST_ERROR("failed to alloc MMVideoBuffer");
-		return NULL;
-	}
-
-	memset((void*)pMMVideoBuf, 0, sizeof(MMVideoBuffer));
-
-	if( 1 == pDecOut->hImg.planes)
-	{
-		pMMVideoBuf->type = MM_VIDEO_BUFFER_TYPE_GEM;
-		pMMVideoBuf->format = MM_PIXEL_FORMAT_I420;
-		pMMVideoBuf->plane_num = 3;
-		pMMVideoBuf->width[0] = pDecOut->hImg.width;
-		pMMVideoBuf->height[0] = pDecOut->hImg.height;
-		pMMVideoBuf->stride_width[0] = GST_ROUND_UP_32(pDecOut->hImg.stride[0]);
-		pMMVideoBuf->stride_width[1] = GST_ROUND_UP_16(pMMVideoBuf->stride_width[0] >> 1);
-		pMMVideoBuf->stride_width[2] = pMMVideoBuf->stride_width[1];
-		pMMVideoBuf->stride_height[0] = GST_ROUND_UP_16(pDecOut->hImg.height);
-		pMMVideoBuf->stride_height[1] = GST_ROUND_UP_16(pDecOut->hImg.height >> 1);
-		pMMVideoBuf->stride_height[2] = pMMVideoBuf->stride_height[1];
-		pMMVideoBuf->size[0] = pDecOut->hImg.size[0];
-		pMMVideoBuf->data[0] = pDecOut->hImg.pBuffer[0];
-		pMMVideoBuf->handle_num = 1;
-		pMMVideoBuf->handle.gem[0] = pDecOut->hImg.flink[0];
-		pMMVideoBuf->buffer_index = pDecOut->dispIdx;
-	}
-	else if( 3 == pDecOut->hImg.planes)
-	{
-		pMMVideoBuf->type = MM_VIDEO_BUFFER_TYPE_GEM;
-		pMMVideoBuf->format = MM_PIXEL_FORMAT_I420;
-		pMMVideoBuf->plane_num = 3;
-		pMMVideoBuf->width[0] = pDecOut->hImg.width;
-		pMMVideoBuf->height[0] = pDecOut->hImg.height;
-		pMMVideoBuf->stride_width[0] = pDecOut->hImg.stride[0];
-		pMMVideoBuf->stride_width[1] = pDecOut->hImg.stride[1];
-		pMMVideoBuf->stride_width[2] = pDecOut->hImg.stride[2];
-		pMMVideoBuf->size[0] = pDecOut->hImg.size[0];
-		pMMVideoBuf->size[1] = pDecOut->hImg.size[1];
-		pMMVideoBuf->size[2] = pDecOut->hImg.size[2];
-		pMMVideoBuf->data[0] = pDecOut->hImg.pBuffer[0];
-		pMMVideoBuf->data[1] = pDecOut->hImg.pBuffer[1];
-		pMMVideoBuf->data[2] = pDecOut->hImg.pBuffer[2];
-		pMMVideoBuf->handle_num = 3;
-		pMMVideoBuf->handle.gem[0] = pDecOut->hImg.flink[0];
-		pMMVideoBuf->handle.gem[1] = pDecOut->hImg.flink[1];
-		pMMVideoBuf->handle.gem[2] = pDecOut->hImg.flink[2];
-		pMMVideoBuf->buffer_index = pDecOut->dispIdx;
-	}
-
-	pMeta = gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY,
-						pMMVideoBuf,
-						sizeof(MMVideoBuffer),
-						0,
-						sizeof(MMVideoBuffer),
-						pMMVideoBuf,
-						g_free);
-
-	return pMeta;
+	return gst_video_decoder_finish_frame (pDecoder, pFrame);
 }
 
 static gboolean
@@ -1056,7 +2820,9 @@ plugin_init (GstPlugin * plugin)
 	/* FIXME Remember to set the rank if it's an element that is meant
 		 to be autoplugged by decodebin. */
 	ret = gst_element_register (plugin, "nxvideodec", GST_RANK_NONE,
-			GST_TYPE_NXVIDEODEC);
+			GST_TYPE_NXVIDEODEC) &&
+		gst_element_register (plugin, "nxvideomosaic", GST_RANK_NONE,
+			GST_TYPE_NXVIDEOMOSAIC);
 	FUNC_OUT();
 
 	return ret;
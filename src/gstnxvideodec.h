@@ -63,6 +63,13 @@
 
 G_BEGIN_DECLS
 
+// memory the copy fallback writes into
+enum
+{
+	NX_COPY_MEMORY_HEAP		= 0,
+	NX_COPY_MEMORY_MEMFD	= 1,	// sealed memfd, shareable across processes by fd
+};
+
 #define GST_TYPE_NXVIDEODEC   (gst_nxvideodec_get_type())
 #define GST_NXVIDEODEC(obj)   (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_NXVIDEODEC,GstNxVideoDec))
 #define GST_NXVIDEODEC_CLASS(klass)   (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_NXVIDEODEC,GstNxVideoDecClass))
@@ -77,6 +84,9 @@ typedef struct _GstNxDecOutBuffer GstNxDecOutBuffer;
 
 #include <mm_types.h>
 #include "decoder.h"
+#include "thread.h"
+#include "parallel.h"
+#include "mosaic.h"
 
 struct _GstNxDecOutBuffer
 {
@@ -89,11 +99,62 @@ struct _GstNxVideoDec
 {
 	GstVideoDecoder base_nxvideodec;
 	NX_VIDEO_DEC_STRUCT *pNxVideoDecHandle;
+	guint cfgSerialSeen;				// in-band resizes the output caps follow
 	gint bufferType;
 	// video state
 	GstVideoCodecState *pInputState;
-	gint	isState;
-	pthread_mutex_t		mutex;
+	// zero-copy output slots of the current decoder generation
+	GstBufferPool		*pSlotPool;
+	gboolean			bDmaBufOut;		// negotiated memory:DMABuf
+	gboolean			bVideoMetaOut;	// downstream reads GstVideoMeta
+	gboolean			bCropMetaOut;	// downstream applies GstVideoCropMeta
+	gboolean			bScaledOut;		// negotiated size below the coded one, copies only
+	gboolean			bInterlacedOut;	// caps carry an interlaced mode
+	gint				deinterlace;	// NX_DEINTERLACE_*, applied with the next caps
+	gint				copyMemory;		// NX_COPY_MEMORY_*, applied with the next allocation
+	// tile of an nxvideomosaic canvas instead of output buffers
+	gchar				*pMosaicName;	// protected by the object lock, applied on start
+	gint				mosaicTile;		// protected by the object lock
+	NX_MOSAIC			*pMosaic;
+	GstClockID			mosaicClockId;	// protected by the object lock, pending wait for the mosaic
+	gboolean			bMosaicFlushing;	// protected by the object lock
+	// copy-on-hold fallback (counters protected by the object lock)
+	gint				copyWatermark;
+	gboolean			bCopyOnHold;
+	guint64				zeroCopyFrames;
+	guint64				copiedFrames;
+	guint64				skippedFrames;	// decode-only, never built
+	// key-unit trick mode
+	GstClockTime		lastKeyUnitTime;	// PTS of the previous key unit, spacing of the scan
+	guint				copySwitches;
+	// decoder thread scheduling (protected by the object lock)
+	NX_THREAD_ATTR		threadAttr;
+	guint				streamAttrSerial;
+	pthread_t			streamThread;
+	// VPU arbiter settings
+	gint				vpuWeight;
+	gint				vpuMaxInFlight;
+	// memory budget
+	gint				budgetPolicy;
+	// offline GOP-parallel decoding
+	gint				parallelInstances;
+	gint				parallelWindow;
+	NX_GOP_DECODER		*pGopDec;
+	// hardware watchdog
+	guint				watchdogTimeout;
+	gint				watchdogMaxErrors;
+	guint				resetCountSeen;
+	GThread				*pWatchdogThread;
+	GMutex				watchdogLock;
+	GCond				watchdogCond;
+	gboolean			bWatchdogRun;
+	// idle reclaim
+	GMutex				decodeLock;		// held while the handle decodes or its capture memory is read
+	gint64				lastDecodeTime;	// monotonic, protected by decodeLock
+	guint				idleReclaim;	// msec in PAUSED, 0 = never; protected by the object lock
+	// warm handles
+	gchar				*pPrewarm;		// caps string, protected by the object lock, applied on open
+	gint				prewarmCodec;	// codec prewarmed since open, -1 if none
 };
 
 struct _GstNxVideoDecClass
@@ -104,6 +165,8 @@ struct _GstNxVideoDecClass
 
 GType gst_nxvideodec_get_type (void);
 
+void gst_nxvideodec_get_thread_attr (GstNxVideoDec *pNxVideoDec, NX_THREAD_ATTR *pAttr);
+
 G_END_DECLS
 
 #endif // __GST_NXVIDEODEC_H__
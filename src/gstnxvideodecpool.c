@@ -0,0 +1,455 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <unistd.h>
+#include <gst/allocators/gstdmabuf.h>
+#include <gstmmvideobuffermeta.h>
+
+#include "gstnxvideodecpool.h"
+#include "gstnxvideodec.h"
+
+typedef struct
+{
+	gint v4l2BufferIdx;
+	guint generation;
+} NX_POOL_SLOT;
+
+G_DEFINE_TYPE (GstNxVideoDecPool, gst_nxvideodec_pool, GST_TYPE_BUFFER_POOL);
+
+//
+//	The memories own dups of the decoder's fds, so a sink may keep them
+//	(e.g. as imported framebuffers) for as long as it likes.
+//
+static GstBuffer *
+nxvideodec_pool_build_dmabuf_slot (GstNxVideoDecPool *pPool, NX_V4L2DEC_OUT *pDecOut)
+{
+	NX_VIDEO_DEC_STRUCT *pDec = pPool->pDecHandle;
+	GstBuffer *pBuf = NULL;
+	const GstVideoFormatInfo *pFormatInfo = gst_video_format_get_info( GetDecodedFormat( pDec ) );
+	gsize offset[GST_VIDEO_MAX_PLANES] = { 0, };
+	gint stride[GST_VIDEO_MAX_PLANES] = { 0, };
+	gint width = pDec->width;
+	gint height = pDec->height;
+	gint numPlanes;
+	gint i, fd;
+
+	if( (1 > pDecOut->hImg.planes) || (3 < pDecOut->hImg.planes) )
+	{
+		GST_ERROR("unsupported number of planes(%d)", pDecOut->hImg.planes);
+		return NULL;
+	}
+
+	pBuf = gst_buffer_new();
+	for( i=0 ; i<pDecOut->hImg.planes ; i++ )
+	{
+		fd = dup( pDecOut->hImg.dmaFd[i] );
+		if( 0 > fd )
+		{
+			GST_ERROR("failed to dup dmabuf fd(%d) of slot %d", pDecOut->hImg.dmaFd[i], pDecOut->dispIdx);
+			gst_buffer_unref( pBuf );
+			return NULL;
+		}
+		gst_buffer_append_memory( pBuf, gst_dmabuf_allocator_alloc( pPool->pAllocator, fd, pDecOut->hImg.size[i] ) );
+	}
+
+	if( 1 == pDecOut->hImg.planes )
+	{
+		guint8 *pPlane[3] = { NULL, };
+
+		// same layout the copy path reads from
+		numPlanes = GetDecodedPlanes( pDec, pDecOut, pPlane, stride );
+		for( i=1 ; i<numPlanes ; i++ )
+		{
+			offset[i] = pPlane[i] - pPlane[0];
+		}
+	}
+	else
+	{
+		numPlanes = pDecOut->hImg.planes;
+		for( i=0 ; i<numPlanes ; i++ )
+		{
+			offset[i] = (0 < i) ? (offset[i-1] + pDecOut->hImg.size[i-1]) : 0;
+			stride[i] = pDecOut->hImg.stride[i];
+		}
+	}
+
+	if( IsCroppedPicture( pDec ) )
+	{
+		if( pPool->bCropMeta )
+		{
+			GstVideoCropMeta *pCrop = gst_buffer_add_video_crop_meta( pBuf );
+
+			pCrop->x = pDec->cropX;
+			pCrop->y = pDec->cropY;
+			pCrop->width = pDec->width;
+			pCrop->height = pDec->height;
+			GetCodedSize( pDec, &width, &height );
+		}
+		else
+		{
+			for( i=0 ; i<numPlanes ; i++ )
+			{
+				offset[i] += (gsize)(pDec->cropY >> GST_VIDEO_FORMAT_INFO_H_SUB( pFormatInfo, i )) * stride[i] +
+					(pDec->cropX >> GST_VIDEO_FORMAT_INFO_W_SUB( pFormatInfo, i )) * GST_VIDEO_FORMAT_INFO_PSTRIDE( pFormatInfo, i );
+			}
+		}
+	}
+
+	gst_buffer_add_video_meta_full( pBuf, GST_VIDEO_FRAME_FLAG_NONE, GetDecodedFormat( pDec ),
+		width, height, numPlanes, offset, stride );
+
+	return pBuf;
+}
+
+static GstBuffer *
+nxvideodec_pool_build_slot (GstNxVideoDecPool *pPool, NX_V4L2DEC_OUT *pDecOut)
+{
+	GstBuffer *pBuf = NULL;
+	GstMemory *pMem = NULL;
+	NX_POOL_SLOT *pSlot = NULL;
+
+	pMem = nxvideodec_mmvideobuf_copy( pDecOut, GetDecodedFormat( pPool->pDecHandle ) );
+	if( !pMem )
+	{
+		GST_ERROR("failed to get zero copy data");
+		return NULL;
+	}
+
+	pBuf = gst_buffer_new();
+	gst_buffer_append_memory( pBuf, pMem );
+
+	// same layout as before pooling: MMVideoBuffer, then the slot info
+	pSlot = (NX_POOL_SLOT *)g_malloc( sizeof(NX_POOL_SLOT) );
+	pSlot->v4l2BufferIdx = pDecOut->dispIdx;
+	pSlot->generation = pPool->generation;
+	gst_buffer_append_memory( pBuf, gst_memory_new_wrapped( GST_MEMORY_FLAG_READONLY,
+		pSlot, sizeof(NX_POOL_SLOT), 0, sizeof(NX_POOL_SLOT), pSlot, g_free ) );
+
+	gst_buffer_add_mmvideobuffer_meta( pBuf, 0 );
+
+	// MMVideoBuffer describes the whole coded picture
+	if( IsCroppedPicture( pPool->pDecHandle ) )
+	{
+		GstVideoCropMeta *pCrop = gst_buffer_add_video_crop_meta( pBuf );
+
+		pCrop->x = pPool->pDecHandle->cropX;
+		pCrop->y = pPool->pDecHandle->cropY;
+		pCrop->width = pPool->pDecHandle->width;
+		pCrop->height = pPool->pDecHandle->height;
+	}
+
+	return pBuf;
+}
+
+// the metas a slot is built with belong to it, as in the default pool
+static gboolean
+nxvideodec_pool_mark_meta (GstBuffer *pBuffer, GstMeta **ppMeta, gpointer pUserData)
+{
+	GST_META_FLAG_SET( *ppMeta, GST_META_FLAG_POOLED );
+	GST_META_FLAG_SET( *ppMeta, GST_META_FLAG_LOCKED );
+
+	return TRUE;
+}
+
+// anything added downstream, or copied over from the input, goes
+static gboolean
+nxvideodec_pool_remove_meta (GstBuffer *pBuffer, GstMeta **ppMeta, gpointer pUserData)
+{
+	if( !GST_META_FLAG_IS_SET( *ppMeta, GST_META_FLAG_POOLED ) )
+	{
+		GST_META_FLAG_UNSET( *ppMeta, GST_META_FLAG_LOCKED );
+		*ppMeta = NULL;
+	}
+
+	return TRUE;
+}
+
+static GstFlowReturn
+gst_nxvideodec_pool_acquire_buffer (GstBufferPool *pBufferPool, GstBuffer **ppBuffer,
+		GstBufferPoolAcquireParams *pParams)
+{
+	GstNxVideoDecPool *pPool = GST_NXVIDEODEC_POOL (pBufferPool);
+	NX_V4L2DEC_OUT *pDecOut = NULL;
+	GstBuffer *pBuf = NULL;
+	gint idx;
+
+	if( NULL == pParams )
+	{
+		return GST_FLOW_ERROR;
+	}
+
+	pDecOut = ((GstNxVideoDecPoolAcquireParams *)pParams)->pDecOut;
+	idx = pDecOut->dispIdx;
+	if( (0 > idx) || (NX_MAX_BUF <= idx) )
+	{
+		return GST_FLOW_ERROR;
+	}
+
+	GST_OBJECT_LOCK( pPool );
+	if( pPool->bSlotOut[idx] )
+	{
+		GST_OBJECT_UNLOCK( pPool );
+		GST_ERROR("capture slot %d is already downstream", idx);
+		return GST_FLOW_ERROR;
+	}
+	if( NULL == pPool->pSlot[idx] )
+	{
+		pPool->pSlot[idx] = pPool->bDmaBuf ?
+			nxvideodec_pool_build_dmabuf_slot( pPool, pDecOut ) :
+			nxvideodec_pool_build_slot( pPool, pDecOut );
+		if( pPool->pSlot[idx] )
+		{
+			gst_buffer_foreach_meta( pPool->pSlot[idx], nxvideodec_pool_mark_meta, NULL );
+		}
+	}
+	pBuf = pPool->pSlot[idx];
+	if( pBuf )
+	{
+		pPool->bSlotOut[idx] = TRUE;
+		pPool->numOut++;
+	}
+	GST_OBJECT_UNLOCK( pPool );
+
+	if( NULL == pBuf )
+	{
+		return GST_FLOW_ERROR;
+	}
+
+	GST_BUFFER_FLAGS( pBuf ) = 0;
+	GST_BUFFER_PTS( pBuf ) = GST_CLOCK_TIME_NONE;
+	GST_BUFFER_DTS( pBuf ) = GST_CLOCK_TIME_NONE;
+	GST_BUFFER_DURATION( pBuf ) = GST_CLOCK_TIME_NONE;
+
+	*ppBuffer = pBuf;
+
+	return GST_FLOW_OK;
+}
+
+// the memories and the slot's own metas stay with the slot
+static void
+gst_nxvideodec_pool_reset_buffer (GstBufferPool *pBufferPool, GstBuffer *pBuffer)
+{
+	gst_buffer_foreach_meta( pBuffer, nxvideodec_pool_remove_meta, NULL );
+
+	GST_BUFFER_FLAGS( pBuffer ) = 0;
+	GST_BUFFER_PTS( pBuffer ) = GST_CLOCK_TIME_NONE;
+	GST_BUFFER_DTS( pBuffer ) = GST_CLOCK_TIME_NONE;
+	GST_BUFFER_DURATION( pBuffer ) = GST_CLOCK_TIME_NONE;
+	GST_BUFFER_OFFSET( pBuffer ) = GST_BUFFER_OFFSET_NONE;
+	GST_BUFFER_OFFSET_END( pBuffer ) = GST_BUFFER_OFFSET_NONE;
+}
+
+static void
+gst_nxvideodec_pool_release_buffer (GstBufferPool *pBufferPool, GstBuffer *pBuffer)
+{
+	GstNxVideoDecPool *pPool = GST_NXVIDEODEC_POOL (pBufferPool);
+	gint idx;
+
+	for( idx=0 ; idx<NX_MAX_BUF ; idx++ )
+	{
+		if( pPool->pSlot[idx] == pBuffer )
+			break;
+	}
+
+	if( NX_MAX_BUF == idx )
+	{
+		GST_ERROR("released buffer %p does not belong to the pool", pBuffer);
+		gst_buffer_unref( pBuffer );
+		return;
+	}
+
+	DisplayDone( pPool->pDecHandle, idx, pPool->generation );
+
+	GST_OBJECT_LOCK( pPool );
+	pPool->bSlotOut[idx] = FALSE;
+	pPool->numOut--;
+	GST_OBJECT_UNLOCK( pPool );
+}
+
+static void
+gst_nxvideodec_pool_finalize (GObject *pObject)
+{
+	GstNxVideoDecPool *pPool = GST_NXVIDEODEC_POOL (pObject);
+	gint idx;
+
+	// every outstanding buffer holds a pool reference, so all are home
+	for( idx=0 ; idx<NX_MAX_BUF ; idx++ )
+	{
+		if( pPool->pSlot[idx] )
+		{
+			gst_buffer_unref( pPool->pSlot[idx] );
+			pPool->pSlot[idx] = NULL;
+		}
+	}
+
+	if( pPool->pAllocator )
+	{
+		gst_object_unref( pPool->pAllocator );
+		pPool->pAllocator = NULL;
+	}
+
+	if( pPool->pDecHandle )
+	{
+		VideoDecUnref( pPool->pDecHandle );
+		pPool->pDecHandle = NULL;
+	}
+
+	G_OBJECT_CLASS (gst_nxvideodec_pool_parent_class)->finalize (pObject);
+}
+
+static void
+gst_nxvideodec_pool_class_init (GstNxVideoDecPoolClass *pKlass)
+{
+	GObjectClass *pGobjectClass = G_OBJECT_CLASS (pKlass);
+	GstBufferPoolClass *pPoolClass = GST_BUFFER_POOL_CLASS (pKlass);
+
+	pGobjectClass->finalize = gst_nxvideodec_pool_finalize;
+
+	pPoolClass->acquire_buffer = gst_nxvideodec_pool_acquire_buffer;
+	pPoolClass->reset_buffer = gst_nxvideodec_pool_reset_buffer;
+	pPoolClass->release_buffer = gst_nxvideodec_pool_release_buffer;
+}
+
+static void
+gst_nxvideodec_pool_init (GstNxVideoDecPool *pPool)
+{
+	pPool->pDecHandle = NULL;
+	pPool->generation = 0;
+	pPool->bDmaBuf = FALSE;
+	pPool->bCropMeta = FALSE;
+	pPool->pAllocator = NULL;
+	memset( pPool->pSlot, 0, sizeof(pPool->pSlot) );
+	memset( pPool->bSlotOut, 0, sizeof(pPool->bSlotOut) );
+	pPool->numOut = 0;
+}
+
+GstBufferPool *
+gst_nxvideodec_pool_new (NX_VIDEO_DEC_STRUCT *pDecHandle, gboolean bDmaBuf, gboolean bCropMeta)
+{
+	GstNxVideoDecPool *pPool = NULL;
+	GstStructure *pConfig = NULL;
+
+	pPool = (GstNxVideoDecPool *)g_object_new( GST_TYPE_NXVIDEODEC_POOL, NULL );
+	pPool->pDecHandle = VideoDecRef( pDecHandle );
+	pPool->generation = pDecHandle->generation;
+	pPool->bDmaBuf = bDmaBuf;
+	pPool->bCropMeta = bCropMeta;
+	if( bDmaBuf )
+	{
+		pPool->pAllocator = gst_dmabuf_allocator_new();
+	}
+
+	// buffers are built on demand, nothing to preallocate
+	pConfig = gst_buffer_pool_get_config( GST_BUFFER_POOL_CAST (pPool) );
+	gst_buffer_pool_config_set_params( pConfig, NULL, 0, 0, 0 );
+	gst_buffer_pool_set_config( GST_BUFFER_POOL_CAST (pPool), pConfig );
+
+	if( !gst_buffer_pool_set_active( GST_BUFFER_POOL_CAST (pPool), TRUE ) )
+	{
+		GST_ERROR("failed to activate the output buffer pool");
+		gst_object_unref( pPool );
+		return NULL;
+	}
+
+	return GST_BUFFER_POOL_CAST (pPool);
+}
+
+// slots currently held downstream
+gint
+gst_nxvideodec_pool_get_num_out (GstBufferPool *pBufferPool)
+{
+	GstNxVideoDecPool *pPool = GST_NXVIDEODEC_POOL (pBufferPool);
+	gint numOut;
+
+	GST_OBJECT_LOCK( pPool );
+	numOut = pPool->numOut;
+	GST_OBJECT_UNLOCK( pPool );
+
+	return numOut;
+}
+
+GstMemory *nxvideodec_mmvideobuf_copy(NX_V4L2DEC_OUT *pDecOut, GstVideoFormat format)
+{
+	GstMemory *pMeta = NULL;
+	MMVideoBuffer *pMMVideoBuf = NULL;
+
+	pMMVideoBuf = (MMVideoBuffer *)g_malloc(sizeof(MMVideoBuffer));
+	if (!pMMVideoBuf)
+	{
+		GST_ERROR("failed to alloc MMVideoBuffer");
+		return NULL;
+	}
+
+	memset((void*)pMMVideoBuf, 0, sizeof(MMVideoBuffer));
+
+	if( (1 == pDecOut->hImg.planes) && (GST_VIDEO_FORMAT_I420 != format) )
+	{
+		pMMVideoBuf->type = MM_VIDEO_BUFFER_TYPE_GEM;
+		pMMVideoBuf->format = (GST_VIDEO_FORMAT_NV21 == format) ? MM_PIXEL_FORMAT_NV21 : MM_PIXEL_FORMAT_NV12;
+		pMMVideoBuf->plane_num = 2;
+		pMMVideoBuf->width[0] = pDecOut->hImg.width;
+		pMMVideoBuf->height[0] = pDecOut->hImg.height;
+		pMMVideoBuf->stride_width[0] = GST_ROUND_UP_32(pDecOut->hImg.stride[0]);
+		pMMVideoBuf->stride_width[1] = pMMVideoBuf->stride_width[0];
+		pMMVideoBuf->stride_height[0] = GST_ROUND_UP_16(pDecOut->hImg.height);
+		pMMVideoBuf->stride_height[1] = GST_ROUND_UP_16(pDecOut->hImg.height >> 1);
+		pMMVideoBuf->size[0] = pDecOut->hImg.size[0];
+		pMMVideoBuf->data[0] = pDecOut->hImg.pBuffer[0];
+		pMMVideoBuf->handle_num = 1;
+		pMMVideoBuf->handle.gem[0] = pDecOut->hImg.flink[0];
+		pMMVideoBuf->buffer_index = pDecOut->dispIdx;
+	}
+	else if( 1 == pDecOut->hImg.planes)
+	{
+		pMMVideoBuf->type = MM_VIDEO_BUFFER_TYPE_GEM;
+		pMMVideoBuf->format = MM_PIXEL_FORMAT_I420;
+		pMMVideoBuf->plane_num = 3;
+		pMMVideoBuf->width[0] = pDecOut->hImg.width;
+		pMMVideoBuf->height[0] = pDecOut->hImg.height;
+		pMMVideoBuf->stride_width[0] = GST_ROUND_UP_32(pDecOut->hImg.stride[0]);
+		pMMVideoBuf->stride_width[1] = GST_ROUND_UP_16(pMMVideoBuf->stride_width[0] >> 1);
+		pMMVideoBuf->stride_width[2] = pMMVideoBuf->stride_width[1];
+		pMMVideoBuf->stride_height[0] = GST_ROUND_UP_16(pDecOut->hImg.height);
+		pMMVideoBuf->stride_height[1] = GST_ROUND_UP_16(pDecOut->hImg.height >> 1);
+		pMMVideoBuf->stride_height[2] = pMMVideoBuf->stride_height[1];
+		pMMVideoBuf->size[0] = pDecOut->hImg.size[0];
+		pMMVideoBuf->data[0] = pDecOut->hImg.pBuffer[0];
+		pMMVideoBuf->handle_num = 1;
+		pMMVideoBuf->handle.gem[0] = pDecOut->hImg.flink[0];
+		pMMVideoBuf->buffer_index = pDecOut->dispIdx;
+	}
+	else if( 3 == pDecOut->hImg.planes)
+	{
+		pMMVideoBuf->type = MM_VIDEO_BUFFER_TYPE_GEM;
+		pMMVideoBuf->format = MM_PIXEL_FORMAT_I420;
+		pMMVideoBuf->plane_num = 3;
+		pMMVideoBuf->width[0] = pDecOut->hImg.width;
+		pMMVideoBuf->height[0] = pDecOut->hImg.height;
+		pMMVideoBuf->stride_width[0] = pDecOut->hImg.stride[0];
+		pMMVideoBuf->stride_width[1] = pDecOut->hImg.stride[1];
+		pMMVideoBuf->stride_width[2] = pDecOut->hImg.stride[2];
+		pMMVideoBuf->size[0] = pDecOut->hImg.size[0];
+		pMMVideoBuf->size[1] = pDecOut->hImg.size[1];
+		pMMVideoBuf->size[2] = pDecOut->hImg.size[2];
+		pMMVideoBuf->data[0] = pDecOut->hImg.pBuffer[0];
+		pMMVideoBuf->data[1] = pDecOut->hImg.pBuffer[1];
+		pMMVideoBuf->data[2] = pDecOut->hImg.pBuffer[2];
+		pMMVideoBuf->handle_num = 3;
+		pMMVideoBuf->handle.gem[0] = pDecOut->hImg.flink[0];
+		pMMVideoBuf->handle.gem[1] = pDecOut->hImg.flink[1];
+		pMMVideoBuf->handle.gem[2] = pDecOut->hImg.flink[2];
+		pMMVideoBuf->buffer_index = pDecOut->dispIdx;
+	}
+
+	pMeta = gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY,
+						pMMVideoBuf,
+						sizeof(MMVideoBuffer),
+						0,
+						sizeof(MMVideoBuffer),
+						pMMVideoBuf,
+						g_free);
+
+	return pMeta;
+}
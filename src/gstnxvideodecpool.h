@@ -0,0 +1,62 @@
+#include <gst/gst.h>
+
+#ifndef __GST_NXVIDEODECPOOL_H__
+#define __GST_NXVIDEODECPOOL_H__
+
+#include "decoder.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_NXVIDEODEC_POOL   (gst_nxvideodec_pool_get_type())
+#define GST_NXVIDEODEC_POOL(obj)   (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_NXVIDEODEC_POOL,GstNxVideoDecPool))
+
+typedef struct _GstNxVideoDecPool GstNxVideoDecPool;
+typedef struct _GstNxVideoDecPoolClass GstNxVideoDecPoolClass;
+typedef struct _GstNxVideoDecPoolAcquireParams GstNxVideoDecPoolAcquireParams;
+
+//
+//	One prebuilt output buffer per V4L2 capture slot, either a GEM
+//	(MMVideoBuffer) buffer or dmabuf memories described by a GstVideoMeta.
+//	Padding around the visible area is described by a GstVideoCropMeta, or
+//	for dmabuf slots of a peer without crop support, left out of the video
+//	meta by starting its planes at the visible area.
+//
+//	A slot buffer is built the first time the decoder displays that slot and
+//	is handed out again every time the same slot comes back; releasing it
+//	returns the slot to the hardware. A pool serves one decoder generation,
+//	so a new pool is needed after a reset or a new sequence.
+//
+struct _GstNxVideoDecPool
+{
+	GstBufferPool parent;
+
+	NX_VIDEO_DEC_STRUCT *pDecHandle;	// holds a reference
+	guint generation;
+	gboolean bDmaBuf;
+	gboolean bCropMeta;					// downstream applies GstVideoCropMeta
+	GstAllocator *pAllocator;			// dmabuf allocator, bDmaBuf only
+	GstBuffer *pSlot[NX_MAX_BUF];
+	gboolean bSlotOut[NX_MAX_BUF];		// protected by the object lock
+	gint numOut;						// protected by the object lock
+};
+
+struct _GstNxVideoDecPoolClass
+{
+	GstBufferPoolClass parent_class;
+};
+
+struct _GstNxVideoDecPoolAcquireParams
+{
+	GstBufferPoolAcquireParams parent;
+	NX_V4L2DEC_OUT *pDecOut;			// picture to hand out
+};
+
+GType gst_nxvideodec_pool_get_type (void);
+
+GstBufferPool *gst_nxvideodec_pool_new (NX_VIDEO_DEC_STRUCT *pDecHandle, gboolean bDmaBuf, gboolean bCropMeta);
+gint gst_nxvideodec_pool_get_num_out (GstBufferPool *pBufferPool);
+GstMemory *nxvideodec_mmvideobuf_copy (NX_V4L2DEC_OUT *pDecOut, GstVideoFormat format);
+
+G_END_DECLS
+
+#endif // __GST_NXVIDEODECPOOL_H__
@@ -0,0 +1,398 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/video/gstvideopool.h>
+
+#include "gstnxvideomosaic.h"
+#include "gstnxvideodec.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_nxvideomosaic_debug_category);
+#define GST_CAT_DEFAULT gst_nxvideomosaic_debug_category
+
+#define	MOSAIC_COLUMNS_DEFAULT		2
+#define	MOSAIC_ROWS_DEFAULT			2
+#define	MOSAIC_MIN_BUFFERS			3		// being filled, pushed, and the previous one
+
+enum
+{
+	PROP_0,
+	PROP_COLUMNS,
+	PROP_ROWS,
+};
+
+static GstStaticPadTemplate gst_nxvideomosaic_src_template =
+GST_STATIC_PAD_TEMPLATE ("src",
+		GST_PAD_SRC,
+		GST_PAD_ALWAYS,
+		GST_STATIC_CAPS ("video/x-raw, "
+						 "format = (string) { I420, NV12, NV21 }, "
+						 "width = (int) [ 64, 4096 ], "
+						 "height = (int) [ 64, 4096 ], "
+						 "framerate = (fraction) [ 1/1, 120/1 ]")
+		);
+
+G_DEFINE_TYPE_WITH_CODE (GstNxVideoMosaic, gst_nxvideomosaic, GST_TYPE_PUSH_SRC,
+	GST_DEBUG_CATEGORY_INIT (gst_nxvideomosaic_debug_category, "nxvideomosaic", 0,
+	"debug category for nxvideomosaic element"));
+
+static void
+gst_nxvideomosaic_set_property (GObject *pObject, guint propertyId, const GValue *pValue, GParamSpec *pPspec)
+{
+	GstNxVideoMosaic *pMosaicSrc = GST_NXVIDEOMOSAIC (pObject);
+
+	switch (propertyId)
+	{
+		case PROP_COLUMNS:
+			GST_OBJECT_LOCK( pMosaicSrc );
+			pMosaicSrc->columns = g_value_get_int(pValue);
+			GST_OBJECT_UNLOCK( pMosaicSrc );
+			break;
+		case PROP_ROWS:
+			GST_OBJECT_LOCK( pMosaicSrc );
+			pMosaicSrc->rows = g_value_get_int(pValue);
+			GST_OBJECT_UNLOCK( pMosaicSrc );
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (pObject, propertyId, pPspec);
+			break;
+	}
+}
+
+static void
+gst_nxvideomosaic_get_property (GObject *pObject, guint propertyId, GValue *pValue, GParamSpec *pPspec)
+{
+	GstNxVideoMosaic *pMosaicSrc = GST_NXVIDEOMOSAIC (pObject);
+
+	switch (propertyId)
+	{
+		case PROP_COLUMNS:
+			g_value_set_int(pValue, pMosaicSrc->columns);
+			break;
+		case PROP_ROWS:
+			g_value_set_int(pValue, pMosaicSrc->rows);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (pObject, propertyId, pPspec);
+			break;
+	}
+}
+
+// takes the canvas out of the decoders' reach and drops what the pool handed out
+static void
+nxvideomosaic_drop_canvas (GstNxVideoMosaic *pMosaicSrc)
+{
+	GstBuffer *pBuffer;
+	guint64 written;
+
+	if( pMosaicSrc->pMosaic )
+	{
+		pBuffer = MosaicSwapCanvas( pMosaicSrc->pMosaic, NULL, &written );
+		if( pBuffer )
+		{
+			gst_buffer_unref( pBuffer );
+		}
+		MosaicSetClock( pMosaicSrc->pMosaic, NULL, GST_CLOCK_TIME_NONE );
+	}
+	gst_buffer_replace( &pMosaicSrc->pLast, NULL );
+
+	if( pMosaicSrc->pPool )
+	{
+		gst_buffer_pool_set_active( pMosaicSrc->pPool, FALSE );
+		gst_object_unref( pMosaicSrc->pPool );
+		pMosaicSrc->pPool = NULL;
+	}
+}
+
+static gboolean
+gst_nxvideomosaic_start (GstBaseSrc *pBaseSrc)
+{
+	GstNxVideoMosaic *pMosaicSrc = GST_NXVIDEOMOSAIC (pBaseSrc);
+	gchar *pName = gst_object_get_name( GST_OBJECT (pMosaicSrc) );
+
+	pMosaicSrc->pMosaic = MosaicAcquire( pName );
+	GST_INFO_OBJECT( pMosaicSrc, "decoders with mosaic=%s write into this canvas", pName );
+	g_free( pName );
+
+	pMosaicSrc->tick = 0;
+	GST_OBJECT_LOCK( pMosaicSrc );
+	pMosaicSrc->bFlushing = FALSE;
+	GST_OBJECT_UNLOCK( pMosaicSrc );
+
+	return (NULL != pMosaicSrc->pMosaic);
+}
+
+static gboolean
+gst_nxvideomosaic_stop (GstBaseSrc *pBaseSrc)
+{
+	GstNxVideoMosaic *pMosaicSrc = GST_NXVIDEOMOSAIC (pBaseSrc);
+
+	nxvideomosaic_drop_canvas( pMosaicSrc );
+	MosaicRelease( pMosaicSrc->pMosaic );
+	pMosaicSrc->pMosaic = NULL;
+
+	return TRUE;
+}
+
+static GstCaps *
+gst_nxvideomosaic_fixate (GstBaseSrc *pBaseSrc, GstCaps *pCaps)
+{
+	GstStructure *pStructure;
+
+	pCaps = gst_caps_make_writable( pCaps );
+	pStructure = gst_caps_get_structure( pCaps, 0 );
+	gst_structure_fixate_field_nearest_int( pStructure, "width", 1920 );
+	gst_structure_fixate_field_nearest_int( pStructure, "height", 1080 );
+	gst_structure_fixate_field_nearest_fraction( pStructure, "framerate", 30, 1 );
+
+	return GST_BASE_SRC_CLASS (gst_nxvideomosaic_parent_class)->fixate (pBaseSrc, pCaps);
+}
+
+//
+//	A new geometry starts from a black canvas; the pool keeps the pushed,
+//	the previous and the installed canvas apart.
+//
+static gboolean
+gst_nxvideomosaic_set_caps (GstBaseSrc *pBaseSrc, GstCaps *pCaps)
+{
+	GstNxVideoMosaic *pMosaicSrc = GST_NXVIDEOMOSAIC (pBaseSrc);
+	GstStructure *pConfig;
+	GstBuffer *pCanvas = NULL;
+	gint columns, rows;
+	guint64 written;
+
+	if( !gst_video_info_from_caps( &pMosaicSrc->info, pCaps ) ||
+		(0 >= GST_VIDEO_INFO_FPS_N( &pMosaicSrc->info )) )
+	{
+		GST_ERROR_OBJECT( pMosaicSrc, "invalid caps %" GST_PTR_FORMAT, pCaps );
+		return FALSE;
+	}
+
+	nxvideomosaic_drop_canvas( pMosaicSrc );
+
+	pMosaicSrc->pPool = gst_video_buffer_pool_new();
+	pConfig = gst_buffer_pool_get_config( pMosaicSrc->pPool );
+	gst_buffer_pool_config_set_params( pConfig, pCaps, GST_VIDEO_INFO_SIZE( &pMosaicSrc->info ), MOSAIC_MIN_BUFFERS, 0 );
+	if( !gst_buffer_pool_set_config( pMosaicSrc->pPool, pConfig ) ||
+		!gst_buffer_pool_set_active( pMosaicSrc->pPool, TRUE ) )
+	{
+		GST_ERROR_OBJECT( pMosaicSrc, "cannot set up the canvas pool" );
+		gst_object_unref( pMosaicSrc->pPool );
+		pMosaicSrc->pPool = NULL;
+		return FALSE;
+	}
+
+	GST_OBJECT_LOCK( pMosaicSrc );
+	columns = pMosaicSrc->columns;
+	rows = pMosaicSrc->rows;
+	GST_OBJECT_UNLOCK( pMosaicSrc );
+
+	MosaicConfigure( pMosaicSrc->pMosaic, &pMosaicSrc->info, columns, rows );
+
+	if( GST_FLOW_OK != gst_buffer_pool_acquire_buffer( pMosaicSrc->pPool, &pCanvas, NULL ) )
+	{
+		return FALSE;
+	}
+	MosaicSwapCanvas( pMosaicSrc->pMosaic, pCanvas, &written );
+
+	return TRUE;
+}
+
+static gboolean
+gst_nxvideomosaic_query (GstBaseSrc *pBaseSrc, GstQuery *pQuery)
+{
+	GstNxVideoMosaic *pMosaicSrc = GST_NXVIDEOMOSAIC (pBaseSrc);
+	GstClockTime period;
+
+	if( (GST_QUERY_LATENCY == GST_QUERY_TYPE( pQuery )) && (0 < GST_VIDEO_INFO_FPS_N( &pMosaicSrc->info )) )
+	{
+		// a canvas goes out one period after it was installed
+		period = gst_util_uint64_scale_int( GST_SECOND, GST_VIDEO_INFO_FPS_D( &pMosaicSrc->info ), GST_VIDEO_INFO_FPS_N( &pMosaicSrc->info ) );
+		gst_query_set_latency( pQuery, TRUE, period, GST_CLOCK_TIME_NONE );
+		return TRUE;
+	}
+
+	return GST_BASE_SRC_CLASS (gst_nxvideomosaic_parent_class)->query (pBaseSrc, pQuery);
+}
+
+static gboolean
+gst_nxvideomosaic_unlock (GstBaseSrc *pBaseSrc)
+{
+	GstNxVideoMosaic *pMosaicSrc = GST_NXVIDEOMOSAIC (pBaseSrc);
+
+	GST_OBJECT_LOCK( pMosaicSrc );
+	pMosaicSrc->bFlushing = TRUE;
+	if( pMosaicSrc->clockId )
+	{
+		gst_clock_id_unschedule( pMosaicSrc->clockId );
+	}
+	GST_OBJECT_UNLOCK( pMosaicSrc );
+
+	return TRUE;
+}
+
+static gboolean
+gst_nxvideomosaic_unlock_stop (GstBaseSrc *pBaseSrc)
+{
+	GstNxVideoMosaic *pMosaicSrc = GST_NXVIDEOMOSAIC (pBaseSrc);
+
+	GST_OBJECT_LOCK( pMosaicSrc );
+	pMosaicSrc->bFlushing = FALSE;
+	GST_OBJECT_UNLOCK( pMosaicSrc );
+
+	return TRUE;
+}
+
+// Sleeps until the running time of the current tick, skipping ticks that are already over
+static GstFlowReturn
+nxvideomosaic_wait_tick (GstNxVideoMosaic *pMosaicSrc, GstClockTime period)
+{
+	GstClock *pClock;
+	GstClockReturn clockRet;
+	GstClockTimeDiff jitter = 0;
+
+	pClock = gst_element_get_clock( GST_ELEMENT (pMosaicSrc) );
+	if( NULL == pClock )
+	{
+		return GST_FLOW_OK;
+	}
+	MosaicSetClock( pMosaicSrc->pMosaic, pClock, GST_ELEMENT_CAST (pMosaicSrc)->base_time );
+
+	GST_OBJECT_LOCK( pMosaicSrc );
+	if( pMosaicSrc->bFlushing )
+	{
+		GST_OBJECT_UNLOCK( pMosaicSrc );
+		gst_object_unref( pClock );
+		return GST_FLOW_FLUSHING;
+	}
+	pMosaicSrc->clockId = gst_clock_new_single_shot_id( pClock,
+		GST_ELEMENT_CAST (pMosaicSrc)->base_time + pMosaicSrc->tick * period );
+	GST_OBJECT_UNLOCK( pMosaicSrc );
+
+	clockRet = gst_clock_id_wait( pMosaicSrc->clockId, &jitter );
+
+	GST_OBJECT_LOCK( pMosaicSrc );
+	gst_clock_id_unref( pMosaicSrc->clockId );
+	pMosaicSrc->clockId = NULL;
+	GST_OBJECT_UNLOCK( pMosaicSrc );
+	gst_object_unref( pClock );
+
+	if( GST_CLOCK_UNSCHEDULED == clockRet )
+	{
+		return GST_FLOW_FLUSHING;
+	}
+	if( (GstClockTimeDiff)period < jitter )
+	{
+		GST_DEBUG_OBJECT( pMosaicSrc, "%" G_GINT64_FORMAT " ticks late", jitter / (GstClockTimeDiff)period );
+		pMosaicSrc->tick += jitter / period;
+	}
+
+	return GST_FLOW_OK;
+}
+
+//
+//	One tick: install the next canvas, wait for the decoders still
+//	writing into the current one, fill its stale tiles and push it.
+//
+static GstFlowReturn
+gst_nxvideomosaic_create (GstPushSrc *pPushSrc, GstBuffer **ppBuffer)
+{
+	GstNxVideoMosaic *pMosaicSrc = GST_NXVIDEOMOSAIC (pPushSrc);
+	GstClockTime period;
+	GstBuffer *pNext = NULL;
+	GstBuffer *pCanvas = NULL;
+	GstFlowReturn flowRet;
+	guint64 written = 0;
+
+	if( NULL == pMosaicSrc->pPool )
+	{
+		return GST_FLOW_NOT_NEGOTIATED;
+	}
+
+	period = gst_util_uint64_scale_int( GST_SECOND, GST_VIDEO_INFO_FPS_D( &pMosaicSrc->info ), GST_VIDEO_INFO_FPS_N( &pMosaicSrc->info ) );
+	flowRet = nxvideomosaic_wait_tick( pMosaicSrc, period );
+	if( GST_FLOW_OK != flowRet )
+	{
+		return flowRet;
+	}
+
+	flowRet = gst_buffer_pool_acquire_buffer( pMosaicSrc->pPool, &pNext, NULL );
+	if( GST_FLOW_OK != flowRet )
+	{
+		return flowRet;
+	}
+
+	pCanvas = MosaicSwapCanvas( pMosaicSrc->pMosaic, pNext, &written );
+	if( NULL == pCanvas )
+	{
+		return GST_FLOW_ERROR;
+	}
+	MosaicFillStale( pMosaicSrc->pMosaic, pCanvas, pMosaicSrc->pLast, written );
+	gst_buffer_replace( &pMosaicSrc->pLast, pCanvas );
+
+	GST_BUFFER_PTS( pCanvas ) = pMosaicSrc->tick * period;
+	GST_BUFFER_DURATION( pCanvas ) = period;
+	GST_BUFFER_OFFSET( pCanvas ) = pMosaicSrc->tick;
+	pMosaicSrc->tick++;
+
+	*ppBuffer = pCanvas;
+
+	return GST_FLOW_OK;
+}
+
+static void
+gst_nxvideomosaic_class_init (GstNxVideoMosaicClass *pKlass)
+{
+	GObjectClass *pGobjectClass = G_OBJECT_CLASS (pKlass);
+	GstElementClass *pElementClass = GST_ELEMENT_CLASS (pKlass);
+	GstBaseSrcClass *pBaseSrcClass = GST_BASE_SRC_CLASS (pKlass);
+	GstPushSrcClass *pPushSrcClass = GST_PUSH_SRC_CLASS (pKlass);
+
+	gst_element_class_set_details_simple( pElementClass,
+		"S5P6818 Video Mosaic",
+		"Source/Video",
+		"Composes the output of several nxvideodec instances into one canvas",
+		"Hyun Chul Jun <hcjun@nexell.co.kr>" );
+	gst_element_class_add_pad_template( pElementClass, gst_static_pad_template_get (&gst_nxvideomosaic_src_template) );
+
+	pGobjectClass->set_property = gst_nxvideomosaic_set_property;
+	pGobjectClass->get_property = gst_nxvideomosaic_get_property;
+
+	pBaseSrcClass->start = GST_DEBUG_FUNCPTR (gst_nxvideomosaic_start);
+	pBaseSrcClass->stop = GST_DEBUG_FUNCPTR (gst_nxvideomosaic_stop);
+	pBaseSrcClass->fixate = GST_DEBUG_FUNCPTR (gst_nxvideomosaic_fixate);
+	pBaseSrcClass->set_caps = GST_DEBUG_FUNCPTR (gst_nxvideomosaic_set_caps);
+	pBaseSrcClass->query = GST_DEBUG_FUNCPTR (gst_nxvideomosaic_query);
+	pBaseSrcClass->unlock = GST_DEBUG_FUNCPTR (gst_nxvideomosaic_unlock);
+	pBaseSrcClass->unlock_stop = GST_DEBUG_FUNCPTR (gst_nxvideomosaic_unlock_stop);
+	pPushSrcClass->create = GST_DEBUG_FUNCPTR (gst_nxvideomosaic_create);
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_COLUMNS,
+		g_param_spec_int ("columns", "columns", "Tiles per canvas row, applied with the next caps",
+			1, 8, MOSAIC_COLUMNS_DEFAULT, G_PARAM_READWRITE));
+
+	g_object_class_install_property (
+		pGobjectClass,
+		PROP_ROWS,
+		g_param_spec_int ("rows", "rows", "Tile rows per canvas, applied with the next caps",
+			1, 8, MOSAIC_ROWS_DEFAULT, G_PARAM_READWRITE));
+}
+
+static void
+gst_nxvideomosaic_init (GstNxVideoMosaic *pMosaicSrc)
+{
+	pMosaicSrc->columns = MOSAIC_COLUMNS_DEFAULT;
+	pMosaicSrc->rows = MOSAIC_ROWS_DEFAULT;
+	pMosaicSrc->pMosaic = NULL;
+	gst_video_info_init( &pMosaicSrc->info );
+	pMosaicSrc->pPool = NULL;
+	pMosaicSrc->pLast = NULL;
+	pMosaicSrc->tick = 0;
+	pMosaicSrc->clockId = NULL;
+	pMosaicSrc->bFlushing = FALSE;
+
+	gst_base_src_set_live( GST_BASE_SRC (pMosaicSrc), TRUE );
+	gst_base_src_set_format( GST_BASE_SRC (pMosaicSrc), GST_FORMAT_TIME );
+}
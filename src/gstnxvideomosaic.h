@@ -0,0 +1,49 @@
+#include <gst/gst.h>
+
+#ifndef __GST_NXVIDEOMOSAIC_H__
+#define __GST_NXVIDEOMOSAIC_H__
+
+#include <gst/base/gstpushsrc.h>
+#include <gst/video/video.h>
+
+#include "mosaic.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_NXVIDEOMOSAIC   (gst_nxvideomosaic_get_type())
+#define GST_NXVIDEOMOSAIC(obj)   (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_NXVIDEOMOSAIC,GstNxVideoMosaic))
+
+typedef struct _GstNxVideoMosaic GstNxVideoMosaic;
+typedef struct _GstNxVideoMosaicClass GstNxVideoMosaicClass;
+
+//
+//	Live source pushing one composed canvas per frame period. nxvideodec
+//	instances whose "mosaic" property names this element write their
+//	pictures into its tiles directly, replacing a full-size copy per
+//	channel plus a compositor pass.
+//
+struct _GstNxVideoMosaic
+{
+	GstPushSrc parent;
+
+	gint columns;
+	gint rows;
+	NX_MOSAIC *pMosaic;					// registered under the element name while running
+	GstVideoInfo info;
+	GstBufferPool *pPool;
+	GstBuffer *pLast;					// last pushed canvas, source of stale tiles
+	guint64 tick;
+	GstClockID clockId;					// protected by the object lock
+	gboolean bFlushing;					// protected by the object lock
+};
+
+struct _GstNxVideoMosaicClass
+{
+	GstPushSrcClass parent_class;
+};
+
+GType gst_nxvideomosaic_get_type (void);
+
+G_END_DECLS
+
+#endif // __GST_NXVIDEOMOSAIC_H__
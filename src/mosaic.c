@@ -0,0 +1,393 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "mosaic.h"
+#include "copy.h"
+
+typedef struct
+{
+	GstBuffer *pBuffer;
+	GstVideoFrame frame;			// mapped for writing while installed
+	gint writers;					// decoders copying into it right now
+	guint64 written;				// tiles written since it was installed
+} NX_MOSAIC_CANVAS;
+
+struct _NX_MOSAIC
+{
+	gchar *pName;
+	gint refCount;					// protected by gstMosaics.mutex
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;			// signalled when the last writer leaves a canvas
+	GstVideoInfo info;
+	gboolean bConfigured;
+	gint columns;
+	gint rows;
+	NX_MOSAIC_CANVAS *pCanvas;		// NULL while the owner is not running
+	GstClock *pClock;				// the owner's, NULL while it does not tick
+	GstClockTime baseTime;
+};
+
+typedef struct
+{
+	pthread_mutex_t mutex;
+	GList *pList;					// NX_MOSAIC
+} NX_MOSAIC_REGISTRY;
+
+static NX_MOSAIC_REGISTRY gstMosaics = {
+	PTHREAD_MUTEX_INITIALIZER,
+	NULL,
+};
+
+NX_MOSAIC *MosaicAcquire( const gchar *pName )
+{
+	NX_MOSAIC *pMosaic = NULL;
+	GList *pItem;
+
+	g_return_val_if_fail( pName != NULL, NULL );
+
+	pthread_mutex_lock( &gstMosaics.mutex );
+	for( pItem = gstMosaics.pList ; pItem ; pItem = pItem->next )
+	{
+		if( !strcmp( ((NX_MOSAIC *)pItem->data)->pName, pName ) )
+		{
+			pMosaic = (NX_MOSAIC *)pItem->data;
+			break;
+		}
+	}
+
+	if( NULL == pMosaic )
+	{
+		pMosaic = g_new0( NX_MOSAIC, 1 );
+		pMosaic->pName = g_strdup( pName );
+		pthread_mutex_init( &pMosaic->mutex, NULL );
+		pthread_cond_init( &pMosaic->cond, NULL );
+		gst_video_info_init( &pMosaic->info );
+		gstMosaics.pList = g_list_prepend( gstMosaics.pList, pMosaic );
+	}
+	pMosaic->refCount++;
+	pthread_mutex_unlock( &gstMosaics.mutex );
+
+	return pMosaic;
+}
+
+void MosaicRelease( NX_MOSAIC *pMosaic )
+{
+	GstBuffer *pBuffer;
+	guint64 written;
+
+	if( NULL == pMosaic )
+		return;
+
+	pthread_mutex_lock( &gstMosaics.mutex );
+	if( 0 < --pMosaic->refCount )
+	{
+		pthread_mutex_unlock( &gstMosaics.mutex );
+		return;
+	}
+	gstMosaics.pList = g_list_remove( gstMosaics.pList, pMosaic );
+	pthread_mutex_unlock( &gstMosaics.mutex );
+
+	pBuffer = MosaicSwapCanvas( pMosaic, NULL, &written );
+	if( pBuffer )
+	{
+		gst_buffer_unref( pBuffer );
+	}
+	MosaicSetClock( pMosaic, NULL, GST_CLOCK_TIME_NONE );
+
+	pthread_cond_destroy( &pMosaic->cond );
+	pthread_mutex_destroy( &pMosaic->mutex );
+	g_free( pMosaic->pName );
+	g_free( pMosaic );
+}
+
+// caller holds pMosaic->mutex
+static void MosaicTileRect( NX_MOSAIC *pMosaic, gint tile, gint *pX, gint *pY, gint *pWidth, gint *pHeight )
+{
+	gint width = GST_VIDEO_INFO_WIDTH( &pMosaic->info );
+	gint height = GST_VIDEO_INFO_HEIGHT( &pMosaic->info );
+	gint col = tile % pMosaic->columns;
+	gint row = tile / pMosaic->columns;
+	gint x1, y1;
+
+	*pX = (col * width / pMosaic->columns) & ~1;
+	*pY = (row * height / pMosaic->rows) & ~1;
+	x1 = (col + 1 == pMosaic->columns) ? width : (((col + 1) * width / pMosaic->columns) & ~1);
+	y1 = (row + 1 == pMosaic->rows) ? height : (((row + 1) * height / pMosaic->rows) & ~1);
+	*pWidth = x1 - *pX;
+	*pHeight = y1 - *pY;
+}
+
+//
+//	A frame describing the rectangle of a mapped canvas: same strides,
+//	planes moved to the rectangle's origin, size of the rectangle. The
+//	copy functions take it like any other frame.
+//
+static void MosaicTileView( const GstVideoFrame *pCanvas, gint x, gint y, gint width, gint height, GstVideoFrame *pTile )
+{
+	const GstVideoFormatInfo *pFormatInfo = GST_VIDEO_FRAME_FORMAT_INFO( pCanvas );
+	guint i;
+
+	*pTile = *pCanvas;
+	GST_VIDEO_INFO_WIDTH( &pTile->info ) = width;
+	GST_VIDEO_INFO_HEIGHT( &pTile->info ) = height;
+
+	for( i=0 ; i<GST_VIDEO_FRAME_N_PLANES( pCanvas ) ; i++ )
+	{
+		pTile->data[i] = (guint8 *)pCanvas->data[i] +
+			(gsize)(y >> GST_VIDEO_FORMAT_INFO_H_SUB( pFormatInfo, i )) * GST_VIDEO_FRAME_PLANE_STRIDE( pCanvas, i ) +
+			(x >> GST_VIDEO_FORMAT_INFO_W_SUB( pFormatInfo, i )) * GST_VIDEO_FRAME_COMP_PSTRIDE( pCanvas, i );
+	}
+}
+
+// Copies a tile of the same geometry, or paints it black without a source
+static void MosaicFillTile( const GstVideoFrame *pDst, const GstVideoFrame *pSrc )
+{
+	NX_COPY_PLANE planes[GST_VIDEO_MAX_PLANES];
+	guint8 *pRow;
+	gint width, height, y;
+	guint i;
+
+	memset( planes, 0, sizeof(planes) );
+	for( i=0 ; i<GST_VIDEO_FRAME_N_PLANES( pDst ) ; i++ )
+	{
+		width = GST_VIDEO_FRAME_COMP_WIDTH( pDst, i ) * GST_VIDEO_FRAME_COMP_PSTRIDE( pDst, i );
+		height = GST_VIDEO_FRAME_COMP_HEIGHT( pDst, i );
+
+		if( pSrc )
+		{
+			planes[i].pDst = GST_VIDEO_FRAME_PLANE_DATA( pDst, i );
+			planes[i].dstStride = GST_VIDEO_FRAME_PLANE_STRIDE( pDst, i );
+			planes[i].pSrc = GST_VIDEO_FRAME_PLANE_DATA( pSrc, i );
+			planes[i].srcStride = GST_VIDEO_FRAME_PLANE_STRIDE( pSrc, i );
+			planes[i].width = width;
+			planes[i].height = height;
+			planes[i].pixelStride = GST_VIDEO_FRAME_COMP_PSTRIDE( pDst, i );
+			continue;
+		}
+
+		// Y, U and V planes or interleaved UV, limited range black
+		for( y=0 ; y<height ; y++ )
+		{
+			pRow = (guint8 *)GST_VIDEO_FRAME_PLANE_DATA( pDst, i ) + (gsize)y * GST_VIDEO_FRAME_PLANE_STRIDE( pDst, i );
+			memset( pRow, i ? 128 : 16, width );
+		}
+	}
+
+	if( pSrc )
+	{
+		CopyPlanes( planes, GST_VIDEO_FRAME_N_PLANES( pDst ) );
+	}
+}
+
+void MosaicConfigure( NX_MOSAIC *pMosaic, const GstVideoInfo *pInfo, gint columns, gint rows )
+{
+	pthread_mutex_lock( &pMosaic->mutex );
+	pMosaic->info = *pInfo;
+	pMosaic->columns = CLAMP( columns, 1, NX_MOSAIC_MAX_TILES );
+	pMosaic->rows = CLAMP( rows, 1, NX_MOSAIC_MAX_TILES / pMosaic->columns );
+	pMosaic->bConfigured = TRUE;
+	pthread_mutex_unlock( &pMosaic->mutex );
+
+	GST_INFO("mosaic \"%s\": %dx%d %s, %dx%d tiles", pMosaic->pName,
+		GST_VIDEO_INFO_WIDTH( pInfo ), GST_VIDEO_INFO_HEIGHT( pInfo ),
+		gst_video_format_to_string( GST_VIDEO_INFO_FORMAT( pInfo ) ), pMosaic->columns, pMosaic->rows);
+}
+
+//
+//	Installs pNext (NULL: none) as the canvas decoders write into and
+//	returns the one it replaces, once the decoders still writing into it
+//	are done. pWritten receives the tiles it got.
+//
+GstBuffer *MosaicSwapCanvas( NX_MOSAIC *pMosaic, GstBuffer *pNext, guint64 *pWritten )
+{
+	NX_MOSAIC_CANVAS *pCanvas = NULL;
+	NX_MOSAIC_CANVAS *pDone = NULL;
+	GstBuffer *pBuffer = NULL;
+	GstVideoInfo info;
+
+	*pWritten = 0;
+
+	if( pNext )
+	{
+		pthread_mutex_lock( &pMosaic->mutex );
+		info = pMosaic->info;
+		pthread_mutex_unlock( &pMosaic->mutex );
+
+		pCanvas = g_new0( NX_MOSAIC_CANVAS, 1 );
+		if( !gst_video_frame_map( &pCanvas->frame, &info, pNext, GST_MAP_WRITE ) )
+		{
+			GST_ERROR("mosaic \"%s\": cannot map canvas", pMosaic->pName);
+			g_free( pCanvas );
+			pCanvas = NULL;
+		}
+		else
+		{
+			pCanvas->pBuffer = pNext;
+		}
+	}
+
+	pthread_mutex_lock( &pMosaic->mutex );
+	pDone = pMosaic->pCanvas;
+	pMosaic->pCanvas = pCanvas;
+	while( pDone && (0 < pDone->writers) )
+	{
+		pthread_cond_wait( &pMosaic->cond, &pMosaic->mutex );
+	}
+	pthread_mutex_unlock( &pMosaic->mutex );
+
+	if( pNext && (NULL == pCanvas) )
+	{
+		gst_buffer_unref( pNext );
+	}
+
+	if( NULL == pDone )
+	{
+		return NULL;
+	}
+
+	*pWritten = pDone->written;
+	gst_video_frame_unmap( &pDone->frame );
+	pBuffer = pDone->pBuffer;
+	g_free( pDone );
+
+	return pBuffer;
+}
+
+//
+//	Completes a canvas taken out by MosaicSwapCanvas(): tiles that were
+//	not written are copied from the previous canvas, or painted black
+//	without one. pPrev must have the current geometry.
+//
+void MosaicFillStale( NX_MOSAIC *pMosaic, GstBuffer *pCanvas, GstBuffer *pPrev, guint64 written )
+{
+	GstVideoFrame canvas, prev, dstTile, srcTile;
+	GstVideoInfo info;
+	gboolean bPrev = FALSE;
+	gint columns, rows;
+	gint tile, x, y, width, height;
+
+	pthread_mutex_lock( &pMosaic->mutex );
+	info = pMosaic->info;
+	columns = pMosaic->columns;
+	rows = pMosaic->rows;
+	pthread_mutex_unlock( &pMosaic->mutex );
+
+	if( !gst_video_frame_map( &canvas, &info, pCanvas, GST_MAP_WRITE ) )
+	{
+		GST_ERROR("mosaic \"%s\": cannot map canvas", pMosaic->pName);
+		return;
+	}
+	if( pPrev )
+	{
+		bPrev = gst_video_frame_map( &prev, &info, pPrev, GST_MAP_READ );
+	}
+
+	for( tile=0 ; tile<columns*rows ; tile++ )
+	{
+		if( written & ((guint64)1 << tile) )
+			continue;
+
+		pthread_mutex_lock( &pMosaic->mutex );
+		MosaicTileRect( pMosaic, tile, &x, &y, &width, &height );
+		pthread_mutex_unlock( &pMosaic->mutex );
+
+		MosaicTileView( &canvas, x, y, width, height, &dstTile );
+		if( bPrev )
+		{
+			MosaicTileView( &prev, x, y, width, height, &srcTile );
+		}
+		MosaicFillTile( &dstTile, bPrev ? &srcTile : NULL );
+	}
+
+	if( bPrev )
+	{
+		gst_video_frame_unmap( &prev );
+	}
+	gst_video_frame_unmap( &canvas );
+}
+
+void MosaicSetClock( NX_MOSAIC *pMosaic, GstClock *pClock, GstClockTime baseTime )
+{
+	pthread_mutex_lock( &pMosaic->mutex );
+	if( pMosaic->pClock != pClock )
+	{
+		if( pMosaic->pClock )
+		{
+			gst_object_unref( pMosaic->pClock );
+		}
+		pMosaic->pClock = pClock ? (GstClock *)gst_object_ref( pClock ) : NULL;
+	}
+	pMosaic->baseTime = baseTime;
+	pthread_mutex_unlock( &pMosaic->mutex );
+}
+
+//
+//	A single-shot id on the owner's clock at the given running time of
+//	the mosaic, NULL while the owner does not tick.
+//
+GstClockID MosaicNewClockId( NX_MOSAIC *pMosaic, GstClockTime runningTime )
+{
+	GstClockID clockId = NULL;
+
+	pthread_mutex_lock( &pMosaic->mutex );
+	if( pMosaic->pClock && GST_CLOCK_TIME_IS_VALID( pMosaic->baseTime ) )
+	{
+		clockId = gst_clock_new_single_shot_id( pMosaic->pClock, pMosaic->baseTime + runningTime );
+	}
+	pthread_mutex_unlock( &pMosaic->mutex );
+
+	return clockId;
+}
+
+GstVideoFormat MosaicGetFormat( NX_MOSAIC *pMosaic )
+{
+	GstVideoFormat format;
+
+	pthread_mutex_lock( &pMosaic->mutex );
+	format = pMosaic->bConfigured ? GST_VIDEO_INFO_FORMAT( &pMosaic->info ) : GST_VIDEO_FORMAT_UNKNOWN;
+	pthread_mutex_unlock( &pMosaic->mutex );
+
+	return format;
+}
+
+//
+//	Scales the visible picture into its tile of the installed canvas.
+//	FALSE when there is nothing to write into: no canvas, a tile outside
+//	the grid, or a canvas format other than the decoded one, which the
+//	caller fixes by reopening its decoder in the canvas format.
+//
+gboolean MosaicWriteTile( NX_MOSAIC *pMosaic, gint tile, NX_VIDEO_DEC_STRUCT *pDecHandle, NX_V4L2DEC_OUT *pDecOut )
+{
+	NX_MOSAIC_CANVAS *pCanvas;
+	GstVideoFrame tileFrame;
+	gint x, y, width, height;
+
+	pthread_mutex_lock( &pMosaic->mutex );
+	pCanvas = pMosaic->pCanvas;
+	if( (NULL == pCanvas) || (0 > tile) || (pMosaic->columns * pMosaic->rows <= tile) ||
+		(GST_VIDEO_INFO_FORMAT( &pMosaic->info ) != GetDecodedFormat( pDecHandle )) )
+	{
+		pthread_mutex_unlock( &pMosaic->mutex );
+		return FALSE;
+	}
+	MosaicTileRect( pMosaic, tile, &x, &y, &width, &height );
+	MosaicTileView( &pCanvas->frame, x, y, width, height, &tileFrame );
+	pCanvas->writers++;
+	pthread_mutex_unlock( &pMosaic->mutex );
+
+	// tiles of other decoders do not overlap, no lock while copying
+	CopyDecodedPicture( pDecHandle, pDecOut, &tileFrame );
+
+	pthread_mutex_lock( &pMosaic->mutex );
+	pCanvas->written |= (guint64)1 << tile;
+	if( 0 == --pCanvas->writers )
+	{
+		pthread_cond_broadcast( &pMosaic->cond );
+	}
+	pthread_mutex_unlock( &pMosaic->mutex );
+
+	return TRUE;
+}
@@ -0,0 +1,51 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <pthread.h>
+
+#ifndef __MOSAIC_H__
+#define __MOSAIC_H__
+
+// declared ahead of the includes, gstnxvideodec.h needs it via decoder.h
+typedef struct _NX_MOSAIC NX_MOSAIC;
+
+#include "decoder.h"
+
+G_BEGIN_DECLS
+
+#define	NX_MOSAIC_MAX_TILES			64
+
+//
+//	Process-wide registry of mosaic canvases, looked up by name.
+//
+//	An nxvideomosaic element owns the canvas of its name: it configures the
+//	geometry, installs an empty canvas and, once per output tick, swaps in
+//	the next one and pushes the finished canvas. Decoders writing to the
+//	same name scale their pictures straight into their tile of the
+//	installed canvas, so every pixel of the composed frame is written once.
+//	Tiles nobody wrote during a tick are carried over from the previous
+//	canvas (black at first).
+//
+//	Tiles are laid out row-major, columns x rows, and split the canvas on
+//	even coordinates so that no area is left uncovered.
+//
+//	While ticking, the owner publishes its clock and base time. Decoders
+//	hold each picture back until the mosaic's running time reaches it, so
+//	a tile advances at its stream's rate whatever pipeline feeds it.
+//
+NX_MOSAIC *MosaicAcquire( const gchar *pName );
+void MosaicRelease( NX_MOSAIC *pMosaic );
+
+// owner side
+void MosaicConfigure( NX_MOSAIC *pMosaic, const GstVideoInfo *pInfo, gint columns, gint rows );
+GstBuffer *MosaicSwapCanvas( NX_MOSAIC *pMosaic, GstBuffer *pNext, guint64 *pWritten );
+void MosaicFillStale( NX_MOSAIC *pMosaic, GstBuffer *pCanvas, GstBuffer *pPrev, guint64 written );
+void MosaicSetClock( NX_MOSAIC *pMosaic, GstClock *pClock, GstClockTime baseTime );
+
+// decoder side
+GstVideoFormat MosaicGetFormat( NX_MOSAIC *pMosaic );
+gboolean MosaicWriteTile( NX_MOSAIC *pMosaic, gint tile, NX_VIDEO_DEC_STRUCT *pDecHandle, NX_V4L2DEC_OUT *pDecOut );
+GstClockID MosaicNewClockId( NX_MOSAIC *pMosaic, GstClockTime runningTime );
+
+G_END_DECLS
+
+#endif //__MOSAIC_H__
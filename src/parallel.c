@@ -0,0 +1,360 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <pthread.h>
+
+#include "parallel.h"
+#include "gstnxvideodec.h"
+
+struct _NX_GOP_DECODER
+{
+	NX_VIDEO_DEC_STRUCT *pDecs[NX_GOP_MAX_INSTANCES];
+	gint numInstances;
+	gint window;
+
+	GAsyncQueue *pFreeDecs;			// idle NX_VIDEO_DEC_STRUCT
+	GThreadPool *pPool;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	GQueue jobs;					// dispatched jobs, input order
+	NX_GOP_JOB *pCurJob;			// GOP being collected
+	gint bCancel;
+	gboolean bStarted;				// a random access point was seen
+	gint leadIn;					// frames left to the caller before that
+};
+
+// scheduling attributes last applied on this worker thread
+static __thread guint gTlsAttrSerial = 0;
+
+static void GopCollectPicture( NX_VIDEO_DEC_STRUCT *pDec, NX_GOP_JOB *pJob, NX_V4L2DEC_OUT *pDecOut )
+{
+	GstBuffer *pBuf = NULL;
+	GstVideoInfo info;
+	GstVideoFrame frame;
+	gint64 timeStamp = 0;
+
+	gst_video_info_set_format( &info, GetDecodedFormat( pDec ), pDec->outWidth, pDec->outHeight );
+	pBuf = gst_buffer_new_allocate( NULL, GST_VIDEO_INFO_SIZE( &info ), NULL );
+	if( pBuf && gst_video_frame_map( &frame, &info, pBuf, GST_MAP_WRITE ) )
+	{
+		CopyDecodedPicture( pDec, pDecOut, &frame );
+		gst_video_frame_unmap( &frame );
+		SetInterlaceFlags( pDec, pDecOut, pBuf );
+
+		if( 0 == GetTimeStamp( pDec, &timeStamp ) )
+		{
+			GST_BUFFER_PTS( pBuf ) = timeStamp;
+		}
+		g_queue_push_tail( &pJob->pictures, pBuf );
+	}
+	else
+	{
+		GST_ERROR("failed to allocate GOP output buffer(%" G_GSIZE_FORMAT ")\n", GST_VIDEO_INFO_SIZE( &info ));
+		if( pBuf )
+			gst_buffer_unref( pBuf );
+		GetTimeStamp( pDec, &timeStamp );
+	}
+
+	DisplayDone( pDec, pDecOut->dispIdx, pDec->generation );
+}
+
+static void GopWorker( gpointer pData, gpointer pUserData )
+{
+	NX_GOP_JOB *pJob = (NX_GOP_JOB *)pData;
+	NX_GOP_DECODER *pGop = (NX_GOP_DECODER *)pUserData;
+	NX_VIDEO_DEC_STRUCT *pDec = NULL;
+	NX_V4L2DEC_OUT decOut;
+	GList *pList = NULL;
+	gint ret = 0;
+
+	FUNC_IN();
+
+	if( pJob->threadAttr.serial != gTlsAttrSerial )
+	{
+		gTlsAttrSerial = pJob->threadAttr.serial;
+		ThreadAttrApply( &pJob->threadAttr );
+	}
+
+	pDec = (NX_VIDEO_DEC_STRUCT *)g_async_queue_pop( pGop->pFreeDecs );
+
+	for( pList = pJob->frames.head ; pList ; pList = pList->next )
+	{
+		GstVideoCodecFrame *pFrame = (GstVideoCodecFrame *)pList->data;
+
+		if( g_atomic_int_get( &pGop->bCancel ) )
+			break;
+
+		ret = VideoDecodeFrame( pDec, pFrame->input_buffer, &decOut, GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT(pFrame) );
+		if( (DEC_INIT_ERR == ret) || (DEC_BUDGET_ERR == ret) )
+		{
+			pJob->error = ret;
+			break;
+		}
+
+		if( (0 == ret) && (0 <= decOut.dispIdx) )
+		{
+			GopCollectPicture( pDec, pJob, &decOut );
+		}
+	}
+
+	if( (0 == pJob->error) && !g_atomic_int_get( &pGop->bCancel ) )
+	{
+		while( (0 == VideoDecodeDrain( pDec, &decOut )) && (0 <= decOut.dispIdx) )
+		{
+			GopCollectPicture( pDec, pJob, &decOut );
+		}
+	}
+
+	// the next GOP on this handle starts from a clean decoder
+	if( pDec->bInitialized )
+	{
+		pDec->bFlush = TRUE;
+	}
+	g_async_queue_push( pGop->pFreeDecs, pDec );
+
+	pthread_mutex_lock( &pGop->mutex );
+	pJob->bDone = TRUE;
+	pthread_cond_broadcast( &pGop->cond );
+	pthread_mutex_unlock( &pGop->mutex );
+
+	FUNC_OUT();
+}
+
+NX_GOP_DECODER *GopDecoderCreate( NX_VIDEO_DEC_STRUCT *pTemplate, gint numInstances, gint window, gint *pError )
+{
+	NX_GOP_DECODER *pGop = NULL;
+	gint i;
+
+	FUNC_IN();
+
+	*pError = 0;
+	numInstances = CLAMP( numInstances, 1, NX_GOP_MAX_INSTANCES );
+
+	pGop = (NX_GOP_DECODER *)g_malloc( sizeof(NX_GOP_DECODER) );
+	memset( pGop, 0, sizeof(NX_GOP_DECODER) );
+	pGop->window = (0 < window) ? CLAMP( window, 1, NX_GOP_MAX_WINDOW ) : numInstances;
+	pthread_mutex_init( &pGop->mutex, NULL );
+	pthread_cond_init( &pGop->cond, NULL );
+	g_queue_init( &pGop->jobs );
+	pGop->pFreeDecs = g_async_queue_new();
+
+	for( i=0 ; i<numInstances ; i++ )
+	{
+		*pError = CloneVideoDec( pTemplate, &pGop->pDecs[i] );
+		if( 0 != *pError )
+		{
+			GST_ERROR("GOP decoder: cannot open hardware instance %d (ret = %d)\n", i, *pError);
+			GopDecoderDestroy( pGop );
+			return NULL;
+		}
+		pGop->numInstances++;
+		g_async_queue_push( pGop->pFreeDecs, pGop->pDecs[i] );
+	}
+
+	pGop->pPool = g_thread_pool_new( GopWorker, pGop, numInstances, TRUE, NULL );
+	if( NULL == pGop->pPool )
+	{
+		*pError = -1;
+		GopDecoderDestroy( pGop );
+		return NULL;
+	}
+
+	GST_INFO("GOP decoder: %d instances, window %d GOPs", pGop->numInstances, pGop->window);
+	if( 1 == VpuArbiterGetSlots() )
+	{
+		GST_WARNING("GOP decoder: NX_VPU_ARBITER_SLOTS=1 runs one hardware call at a time, the instances only overlap copying");
+	}
+
+	FUNC_OUT();
+
+	return pGop;
+}
+
+void GopDecoderDestroy( NX_GOP_DECODER *pGop )
+{
+	gint i;
+
+	if( NULL == pGop )
+		return;
+
+	if( pGop->pPool )
+	{
+		GopDecoderCancel( pGop );
+		g_thread_pool_free( pGop->pPool, FALSE, TRUE );
+	}
+
+	for( i=0 ; i<pGop->numInstances ; i++ )
+	{
+		CloseVideoDec( pGop->pDecs[i] );
+	}
+
+	g_async_queue_unref( pGop->pFreeDecs );
+	pthread_mutex_destroy( &pGop->mutex );
+	pthread_cond_destroy( &pGop->cond );
+	g_free( pGop );
+}
+
+//
+//	Takes ownership of pFrame when it returns NX_GOP_QUEUED. Otherwise the
+//	frame stays with the caller, who decodes it serially, and after
+//	NX_GOP_FALLBACK everything that follows as well.
+//
+gint GopDecoderAddFrame( NX_GOP_DECODER *pGop, GstVideoCodecFrame *pFrame, const NX_THREAD_ATTR *pAttr )
+{
+	GstMapInfo mapInfo;
+	gboolean bSplit = FALSE;
+
+	if( GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT(pFrame) &&
+		gst_buffer_map( pFrame->input_buffer, &mapInfo, GST_MAP_READ ) )
+	{
+		bSplit = IsRandomAccessPoint( pGop->pDecs[0], mapInfo.data, mapInfo.size );
+		gst_buffer_unmap( pFrame->input_buffer, &mapInfo );
+	}
+
+	if( (NULL == pGop->pCurJob) && (FALSE == bSplit) )
+	{
+		// after a flush the stream is known to have split points
+		if( !pGop->bStarted && (++pGop->leadIn > NX_GOP_MAX_LEAD_IN) )
+		{
+			return NX_GOP_FALLBACK;
+		}
+		return NX_GOP_SERIAL;
+	}
+
+	// the GOP would be held until it ends, a single IDR stream until EOS
+	if( !bSplit && (NX_GOP_MAX_FRAMES <= g_queue_get_length( &pGop->pCurJob->frames )) )
+	{
+		return NX_GOP_FALLBACK;
+	}
+
+	if( bSplit && pGop->pCurJob )
+	{
+		GopDecoderEndGop( pGop, pAttr );
+	}
+
+	if( NULL == pGop->pCurJob )
+	{
+		pGop->bStarted = TRUE;
+		pGop->pCurJob = (NX_GOP_JOB *)g_malloc( sizeof(NX_GOP_JOB) );
+		memset( pGop->pCurJob, 0, sizeof(NX_GOP_JOB) );
+		g_queue_init( &pGop->pCurJob->frames );
+		g_queue_init( &pGop->pCurJob->pictures );
+	}
+
+	g_queue_push_tail( &pGop->pCurJob->frames, pFrame );
+
+	return NX_GOP_QUEUED;
+}
+
+void GopDecoderEndGop( NX_GOP_DECODER *pGop, const NX_THREAD_ATTR *pAttr )
+{
+	NX_GOP_JOB *pJob = pGop->pCurJob;
+
+	if( NULL == pJob )
+		return;
+
+	pGop->pCurJob = NULL;
+	pJob->threadAttr = *pAttr;
+
+	pthread_mutex_lock( &pGop->mutex );
+	g_queue_push_tail( &pGop->jobs, pJob );
+	pthread_mutex_unlock( &pGop->mutex );
+
+	g_thread_pool_push( pGop->pPool, pJob, NULL );
+}
+
+//
+//	Hands the GOP being collected back to the caller, undispatched.
+//
+NX_GOP_JOB *GopDecoderTakeGop( NX_GOP_DECODER *pGop )
+{
+	NX_GOP_JOB *pJob = pGop->pCurJob;
+
+	pGop->pCurJob = NULL;
+
+	return pJob;
+}
+
+gint GopDecoderNumPending( NX_GOP_DECODER *pGop )
+{
+	gint num;
+
+	pthread_mutex_lock( &pGop->mutex );
+	num = g_queue_get_length( &pGop->jobs );
+	pthread_mutex_unlock( &pGop->mutex );
+
+	return num;
+}
+
+//
+//	Returns the oldest dispatched GOP once it is decoded. With bWait the
+//	call blocks until then; NULL means there is nothing (ready) to output.
+//
+NX_GOP_JOB *GopDecoderPopDone( NX_GOP_DECODER *pGop, gboolean bWait )
+{
+	NX_GOP_JOB *pJob = NULL;
+
+	pthread_mutex_lock( &pGop->mutex );
+
+	pJob = (NX_GOP_JOB *)g_queue_peek_head( &pGop->jobs );
+	while( pJob && !pJob->bDone && bWait )
+	{
+		pthread_cond_wait( &pGop->cond, &pGop->mutex );
+	}
+
+	if( pJob && pJob->bDone )
+	{
+		g_queue_pop_head( &pGop->jobs );
+	}
+	else
+	{
+		pJob = NULL;
+	}
+
+	pthread_mutex_unlock( &pGop->mutex );
+
+	return pJob;
+}
+
+//
+//	Drops every GOP, collected or dispatched. Running workers stop at the
+//	next frame boundary.
+//
+void GopDecoderCancel( NX_GOP_DECODER *pGop )
+{
+	NX_GOP_JOB *pJob;
+
+	if( pGop->pCurJob )
+	{
+		GopJobFree( pGop->pCurJob );
+		pGop->pCurJob = NULL;
+	}
+
+	g_atomic_int_set( &pGop->bCancel, TRUE );
+	while( (pJob = GopDecoderPopDone( pGop, TRUE )) )
+	{
+		GopJobFree( pJob );
+	}
+	g_atomic_int_set( &pGop->bCancel, FALSE );
+}
+
+void GopJobFree( NX_GOP_JOB *pJob )
+{
+	GstVideoCodecFrame *pFrame;
+	GstBuffer *pBuf;
+
+	while( (pFrame = (GstVideoCodecFrame *)g_queue_pop_head( &pJob->frames )) )
+	{
+		gst_video_codec_frame_unref( pFrame );
+	}
+
+	while( (pBuf = (GstBuffer *)g_queue_pop_head( &pJob->pictures )) )
+	{
+		gst_buffer_unref( pBuf );
+	}
+
+	g_free( pJob );
+}
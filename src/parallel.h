@@ -0,0 +1,69 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/video/gstvideodecoder.h>
+
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+// declared ahead of the includes, gstnxvideodec.h needs it via decoder.h
+typedef struct _NX_GOP_DECODER NX_GOP_DECODER;
+
+#include "decoder.h"
+#include "thread.h"
+
+G_BEGIN_DECLS
+
+#define	NX_GOP_MAX_INSTANCES	4
+#define	NX_GOP_MAX_WINDOW		16
+#define	NX_GOP_MAX_LEAD_IN		300		// frames waiting for the first split point
+#define	NX_GOP_MAX_FRAMES		300		// frames of one GOP
+
+// what GopDecoderAddFrame() did with a frame
+enum
+{
+	NX_GOP_QUEUED	= 0,	// taken into the current GOP
+	NX_GOP_SERIAL	= 1,	// not taken, it lies in front of the first GOP
+	NX_GOP_FALLBACK	= 2,	// not taken, the stream cannot be cut into GOPs
+};
+
+typedef struct _NX_GOP_JOB NX_GOP_JOB;
+
+struct _NX_GOP_JOB
+{
+	GQueue frames;					// GstVideoCodecFrame *, decode order
+	GQueue pictures;				// GstBuffer *, presentation order
+	gint error;						// DEC_xxx of the first fatal error
+	gboolean bDone;
+	NX_THREAD_ATTR threadAttr;		// attributes for the worker thread
+};
+
+//
+//	Offline GOP-parallel decoding.
+//
+//	The input is cut at random access points (see IsRandomAccessPoint())
+//	and every GOP is decoded on its own hardware instance from a pool of
+//	numInstances handles, copied to system memory and handed back to the
+//	streaming thread in input order. At most `window` GOPs are in flight,
+//	which bounds both the reorder delay and the memory held by decoded
+//	pictures.
+//
+//	Frames in front of the first random access point belong to no GOP and
+//	are left to the caller's serial decoder. A stream which shows none
+//	within NX_GOP_MAX_LEAD_IN frames (open GOP MPEG-2, H.264 with recovery
+//	points only) is not cut at all and stays with the serial decoder, and
+//	so does one whose GOP grows beyond NX_GOP_MAX_FRAMES frames; the caller
+//	takes that GOP back with GopDecoderTakeGop() and decodes it serially.
+//
+NX_GOP_DECODER *GopDecoderCreate( NX_VIDEO_DEC_STRUCT *pTemplate, gint numInstances, gint window, gint *pError );
+void GopDecoderDestroy( NX_GOP_DECODER *pGop );
+gint GopDecoderAddFrame( NX_GOP_DECODER *pGop, GstVideoCodecFrame *pFrame, const NX_THREAD_ATTR *pAttr );
+void GopDecoderEndGop( NX_GOP_DECODER *pGop, const NX_THREAD_ATTR *pAttr );
+NX_GOP_JOB *GopDecoderTakeGop( NX_GOP_DECODER *pGop );
+gint GopDecoderNumPending( NX_GOP_DECODER *pGop );
+NX_GOP_JOB *GopDecoderPopDone( NX_GOP_DECODER *pGop, gboolean bWait );
+void GopDecoderCancel( NX_GOP_DECODER *pGop );
+void GopJobFree( NX_GOP_JOB *pJob );
+
+G_END_DECLS
+
+#endif //__PARALLEL_H__
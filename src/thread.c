@@ -0,0 +1,257 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "thread.h"
+#include "gstnxvideodec.h"
+
+#define	NX_MAX_CPUS		64
+
+// what the calling thread had before ThreadAttrApply() first changed it
+static __thread gboolean gbTlsSaved = FALSE;
+static __thread gint gTlsPolicy;
+static __thread struct sched_param gTlsParam;
+static __thread gboolean gbTlsCpuSetSaved;
+static __thread cpu_set_t gTlsCpuSet;
+// whether the policy and the affinity are currently ours
+static __thread gboolean gbTlsSchedSet = FALSE;
+static __thread gboolean gbTlsAffinitySet = FALSE;
+// last applied on the calling thread, zeroed means NX_SCHED_INHERIT
+static __thread NX_THREAD_ATTR gTlsAttr;
+
+static gint gstAttrSerial = 0;
+
+static void SaveThreadAttr( void )
+{
+	gint err;
+
+	if( gbTlsSaved )
+		return;
+	gbTlsSaved = TRUE;
+
+	err = pthread_getschedparam( pthread_self(), &gTlsPolicy, &gTlsParam );
+	if( 0 != err )
+	{
+		GST_WARNING("pthread_getschedparam() failed: %s\n", strerror(err));
+		gTlsPolicy = SCHED_OTHER;
+		memset( &gTlsParam, 0, sizeof(gTlsParam) );
+	}
+
+	err = pthread_getaffinity_np( pthread_self(), sizeof(gTlsCpuSet), &gTlsCpuSet );
+	gbTlsCpuSetSaved = (0 == err);
+	if( 0 != err )
+	{
+		GST_WARNING("pthread_getaffinity_np() failed: %s\n", strerror(err));
+	}
+}
+
+void ThreadAttrInit( NX_THREAD_ATTR *pAttr )
+{
+	memset( pAttr, 0, sizeof(NX_THREAD_ATTR) );
+	pAttr->policy = NX_SCHED_INHERIT;
+}
+
+// never 0, which stands for attributes nobody set
+guint ThreadAttrNewSerial( void )
+{
+	return (guint)g_atomic_int_add( &gstAttrSerial, 1 ) + 1;
+}
+
+gint ThreadAttrApply( const NX_THREAD_ATTR *pAttr )
+{
+	gint ret = 0;
+	gint err;
+
+	FUNC_IN();
+
+	SaveThreadAttr();
+
+	if( NX_SCHED_INHERIT != pAttr->policy )
+	{
+		struct sched_param param;
+		gint policy = SCHED_OTHER;
+
+		memset( &param, 0, sizeof(param) );
+		if( NX_SCHED_FIFO == pAttr->policy )
+		{
+			policy = SCHED_FIFO;
+		}
+		else if( NX_SCHED_RR == pAttr->policy )
+		{
+			policy = SCHED_RR;
+		}
+
+		if( SCHED_OTHER != policy )
+		{
+			param.sched_priority = CLAMP( pAttr->priority,
+				sched_get_priority_min(policy), sched_get_priority_max(policy) );
+		}
+
+		err = pthread_setschedparam( pthread_self(), policy, &param );
+		if( 0 != err )
+		{
+			GST_WARNING("pthread_setschedparam(policy=%d, priority=%d) failed: %s\n",
+				policy, param.sched_priority, strerror(err));
+			ret = -1;
+		}
+		else
+		{
+			gbTlsSchedSet = TRUE;
+		}
+	}
+	else if( gbTlsSchedSet )
+	{
+		err = pthread_setschedparam( pthread_self(), gTlsPolicy, &gTlsParam );
+		if( 0 != err )
+		{
+			GST_WARNING("restoring pthread_setschedparam(policy=%d, priority=%d) failed: %s\n",
+				gTlsPolicy, gTlsParam.sched_priority, strerror(err));
+			ret = -1;
+		}
+		else
+		{
+			gbTlsSchedSet = FALSE;
+		}
+	}
+
+	if( 0 != pAttr->cpuMask )
+	{
+		cpu_set_t cpuSet;
+		gint i;
+
+		CPU_ZERO( &cpuSet );
+		for( i=0 ; i<NX_MAX_CPUS ; i++ )
+		{
+			if( pAttr->cpuMask & (G_GUINT64_CONSTANT(1) << i) )
+				CPU_SET( i, &cpuSet );
+		}
+
+		err = pthread_setaffinity_np( pthread_self(), sizeof(cpuSet), &cpuSet );
+		if( 0 != err )
+		{
+			GST_WARNING("pthread_setaffinity_np(0x%" G_GINT64_MODIFIER "x) failed: %s\n",
+				pAttr->cpuMask, strerror(err));
+			ret = -1;
+		}
+		else
+		{
+			gbTlsAffinitySet = TRUE;
+		}
+	}
+	else if( gbTlsAffinitySet && gbTlsCpuSetSaved )
+	{
+		err = pthread_setaffinity_np( pthread_self(), sizeof(gTlsCpuSet), &gTlsCpuSet );
+		if( 0 != err )
+		{
+			GST_WARNING("restoring pthread_setaffinity_np() failed: %s\n", strerror(err));
+			ret = -1;
+		}
+		else
+		{
+			gbTlsAffinitySet = FALSE;
+		}
+	}
+
+	gTlsAttr = *pAttr;
+
+	FUNC_OUT();
+
+	return ret;
+}
+
+void ThreadAttrGetCurrent( NX_THREAD_ATTR *pAttr )
+{
+	*pAttr = gTlsAttr;
+}
+
+//
+//	CPU list in the taskset/cpuset syntax, e.g. "4-7" or "0,2,4-5".
+//	An empty string clears the mask.
+//
+gboolean ThreadAttrParseCpuList( const gchar *pList, guint64 *pMask )
+{
+	guint64 mask = 0;
+	const gchar *pPos = pList;
+	gchar *pEnd = NULL;
+
+	if( NULL == pList )
+	{
+		*pMask = 0;
+		return TRUE;
+	}
+
+	while( *pPos )
+	{
+		glong first, last;
+
+		while( *pPos == ' ' || *pPos == ',' )
+			pPos++;
+		if( *pPos == '\0' )
+			break;
+
+		first = strtol( pPos, &pEnd, 10 );
+		if( pEnd == pPos || first < 0 || first >= NX_MAX_CPUS )
+			return FALSE;
+		last = first;
+		pPos = pEnd;
+
+		if( *pPos == '-' )
+		{
+			pPos++;
+			last = strtol( pPos, &pEnd, 10 );
+			if( pEnd == pPos || last < first || last >= NX_MAX_CPUS )
+				return FALSE;
+			pPos = pEnd;
+		}
+
+		if( *pPos != '\0' && *pPos != ',' && *pPos != ' ' )
+			return FALSE;
+
+		for( ; first <= last ; first++ )
+			mask |= G_GUINT64_CONSTANT(1) << first;
+	}
+
+	*pMask = mask;
+	return TRUE;
+}
+
+gchar *ThreadAttrCpuListString( guint64 cpuMask )
+{
+	GString *pStr = g_string_new( NULL );
+	gint i = 0;
+
+	while( i < NX_MAX_CPUS )
+	{
+		gint first;
+
+		if( !(cpuMask & (G_GUINT64_CONSTANT(1) << i)) )
+		{
+			i++;
+			continue;
+		}
+
+		first = i;
+		while( (i+1) < NX_MAX_CPUS && (cpuMask & (G_GUINT64_CONSTANT(1) << (i+1))) )
+			i++;
+
+		if( pStr->len )
+			g_string_append_c( pStr, ',' );
+		if( first == i )
+			g_string_append_printf( pStr, "%d", first );
+		else
+			g_string_append_printf( pStr, "%d-%d", first, i );
+		i++;
+	}
+
+	return g_string_free( pStr, FALSE );
+}
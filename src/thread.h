@@ -0,0 +1,48 @@
+#include <gst/gst.h>
+#include <pthread.h>
+
+#ifndef __THREAD_H__
+#define __THREAD_H__
+
+G_BEGIN_DECLS
+
+enum
+{
+	NX_SCHED_INHERIT	= 0,		// the thread's own policy, restored if changed before
+	NX_SCHED_OTHER		= 1,
+	NX_SCHED_FIFO		= 2,
+	NX_SCHED_RR			= 3,
+};
+
+#define	NX_SCHED_PRIORITY_MAX	99
+
+typedef struct _NX_THREAD_ATTR NX_THREAD_ATTR;
+
+struct _NX_THREAD_ATTR
+{
+	gint policy;					// NX_SCHED_xxx
+	gint priority;					// only used for FIFO/RR
+	guint64 cpuMask;				// bit N = CPU N, 0 = no pinning (the thread's own affinity)
+	guint serial;					// new on every change, unique in the process
+};
+
+//
+//	Scheduling attributes for decoder owned threads.
+//	Every thread which runs decoder work compares the serial it applied
+//	last with the current one and calls ThreadAttrApply() on a mismatch,
+//	so properties can be changed while the pipeline is running.
+//	The policy and affinity a thread had before the first change are kept
+//	per thread and restored when the properties are reset.
+//	Threads shared by several decoders (the copy helpers) take the
+//	attributes of the thread they work for, see ThreadAttrGetCurrent().
+//
+void ThreadAttrInit( NX_THREAD_ATTR *pAttr );
+guint ThreadAttrNewSerial( void );
+gint ThreadAttrApply( const NX_THREAD_ATTR *pAttr );
+void ThreadAttrGetCurrent( NX_THREAD_ATTR *pAttr );
+gboolean ThreadAttrParseCpuList( const gchar *pList, guint64 *pMask );
+gchar *ThreadAttrCpuListString( guint64 cpuMask );
+
+G_END_DECLS
+
+#endif //__THREAD_H__
@@ -0,0 +1,270 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pthread.h>
+
+#include "warm.h"
+
+typedef struct
+{
+	gint codecType;
+	gint target;					// parked handles the refill keeps, the largest standing request
+	gint requests[NX_WARM_MAX_HANDLES + 1];	// standing prewarm requests per count
+	GQueue handles;					// NX_V4L2DEC_HANDLE
+} NX_WARM_ENTRY;
+
+static pthread_mutex_t gstWarmMutex = PTHREAD_MUTEX_INITIALIZER;
+static GList *gpWarmEntries = NULL;		// NX_WARM_ENTRY *, one per codec, never freed
+static gint gstWarmParked = 0;			// including handles being opened by the refill
+static GThreadPool *gpWarmRefill = NULL;
+
+// caller holds gstWarmMutex
+static NX_WARM_ENTRY *GetEntry( gint codecType, gboolean bCreate )
+{
+	NX_WARM_ENTRY *pEntry;
+	GList *pItem;
+
+	for( pItem = gpWarmEntries ; pItem ; pItem = pItem->next )
+	{
+		pEntry = (NX_WARM_ENTRY *)pItem->data;
+		if( codecType == pEntry->codecType )
+			return pEntry;
+	}
+
+	if( !bCreate )
+		return NULL;
+
+	pEntry = g_new0( NX_WARM_ENTRY, 1 );
+	pEntry->codecType = codecType;
+	g_queue_init( &pEntry->handles );
+	gpWarmEntries = g_list_prepend( gpWarmEntries, pEntry );
+
+	return pEntry;
+}
+
+static void WarmRefill( gpointer pData, gpointer pUserData )
+{
+	gint codecType = GPOINTER_TO_INT( pData );
+	NX_WARM_ENTRY *pEntry;
+	NX_V4L2DEC_HANDLE hCodec;
+
+	for( ;; )
+	{
+		pthread_mutex_lock( &gstWarmMutex );
+		pEntry = GetEntry( codecType, FALSE );
+		if( (NULL == pEntry) || ((gint)g_queue_get_length( &pEntry->handles ) >= pEntry->target) ||
+			(NX_WARM_MAX_HANDLES <= gstWarmParked) )
+		{
+			pthread_mutex_unlock( &gstWarmMutex );
+			return;
+		}
+		// counted before the open, handles closed meanwhile do not overfill the pool
+		gstWarmParked++;
+		pthread_mutex_unlock( &gstWarmMutex );
+
+		hCodec = NX_V4l2DecOpen( codecType );
+
+		pthread_mutex_lock( &gstWarmMutex );
+		if( NULL == hCodec )
+		{
+			gstWarmParked--;
+			pthread_mutex_unlock( &gstWarmMutex );
+			GST_WARNING("cannot prewarm a handle for %" GST_FOURCC_FORMAT, GST_FOURCC_ARGS( codecType ));
+			return;
+		}
+		g_queue_push_tail( &pEntry->handles, hCodec );
+		pthread_mutex_unlock( &gstWarmMutex );
+
+		GST_DEBUG("prewarmed a handle for %" GST_FOURCC_FORMAT, GST_FOURCC_ARGS( codecType ));
+	}
+}
+
+static void ScheduleRefill( gint codecType )
+{
+	pthread_mutex_lock( &gstWarmMutex );
+	if( NULL == gpWarmRefill )
+	{
+		gpWarmRefill = g_thread_pool_new( WarmRefill, NULL, 1, FALSE, NULL );
+	}
+	if( gpWarmRefill )
+	{
+		g_thread_pool_push( gpWarmRefill, GINT_TO_POINTER( codecType ), NULL );
+	}
+	pthread_mutex_unlock( &gstWarmMutex );
+}
+
+// caller holds gstWarmMutex
+static void UpdateTarget( NX_WARM_ENTRY *pEntry )
+{
+	gint count;
+
+	for( count = NX_WARM_MAX_HANDLES ; (0 < count) && (0 == pEntry->requests[count]) ; count-- )
+		;
+	pEntry->target = count;
+}
+
+// caller holds gstWarmMutex, the handles are returned to be closed outside of it
+static void TakeParked( NX_WARM_ENTRY *pEntry, gint keep, GQueue *pClose )
+{
+	while( (gint)g_queue_get_length( &pEntry->handles ) > keep )
+	{
+		g_queue_push_tail( pClose, g_queue_pop_tail( &pEntry->handles ) );
+		gstWarmParked--;
+	}
+}
+
+static void CloseHandles( GQueue *pClose )
+{
+	NX_V4L2DEC_HANDLE hCodec;
+
+	while( (hCodec = (NX_V4L2DEC_HANDLE)g_queue_pop_head( pClose )) )
+	{
+		NX_V4l2DecClose( hCodec );
+	}
+}
+
+//
+//	The device has a fixed number of instances, the ones parked for other
+//	codecs are given back before an open is given up. Their refill waits
+//	for the next handle of those codecs to come back.
+//
+static NX_V4L2DEC_HANDLE OpenEvicting( gint codecType )
+{
+	NX_V4L2DEC_HANDLE hCodec = NX_V4l2DecOpen( codecType );
+	GQueue evicted = G_QUEUE_INIT;
+	GList *pItem;
+
+	if( hCodec )
+		return hCodec;
+
+	pthread_mutex_lock( &gstWarmMutex );
+	for( pItem = gpWarmEntries ; pItem ; pItem = pItem->next )
+	{
+		if( codecType != ((NX_WARM_ENTRY *)pItem->data)->codecType )
+		{
+			TakeParked( (NX_WARM_ENTRY *)pItem->data, 0, &evicted );
+		}
+	}
+	pthread_mutex_unlock( &gstWarmMutex );
+
+	if( g_queue_is_empty( &evicted ) )
+		return NULL;
+
+	GST_WARNING("out of decoder instances, closing %u prewarmed handles of other codecs", g_queue_get_length( &evicted ));
+	CloseHandles( &evicted );
+
+	return NX_V4l2DecOpen( codecType );
+}
+
+NX_V4L2DEC_HANDLE WarmPoolOpen( gint codecType )
+{
+	NX_WARM_ENTRY *pEntry;
+	NX_V4L2DEC_HANDLE hCodec = NULL;
+	gboolean bRefill = FALSE;
+
+	pthread_mutex_lock( &gstWarmMutex );
+	pEntry = GetEntry( codecType, FALSE );
+	if( pEntry )
+	{
+		hCodec = (NX_V4L2DEC_HANDLE)g_queue_pop_head( &pEntry->handles );
+	}
+	if( hCodec )
+	{
+		gstWarmParked--;
+		bRefill = (0 < pEntry->target);
+	}
+	pthread_mutex_unlock( &gstWarmMutex );
+
+	if( bRefill )
+	{
+		ScheduleRefill( codecType );
+	}
+
+	if( hCodec )
+	{
+		GST_DEBUG("warm handle for %" GST_FOURCC_FORMAT, GST_FOURCC_ARGS( codecType ));
+		return hCodec;
+	}
+
+	return OpenEvicting( codecType );
+}
+
+void WarmPoolClose( gint codecType, NX_V4L2DEC_HANDLE hCodec, gboolean bFresh )
+{
+	NX_WARM_ENTRY *pEntry;
+	gboolean bParked = FALSE;
+	gboolean bRefill = FALSE;
+
+	if( NULL == hCodec )
+		return;
+
+	pthread_mutex_lock( &gstWarmMutex );
+	pEntry = GetEntry( codecType, bFresh );
+	if( bFresh && (NX_WARM_MAX_HANDLES > gstWarmParked) )
+	{
+		g_queue_push_tail( &pEntry->handles, hCodec );
+		gstWarmParked++;
+		bParked = TRUE;
+	}
+	else if( pEntry )
+	{
+		bRefill = ((gint)g_queue_get_length( &pEntry->handles ) < pEntry->target);
+	}
+	pthread_mutex_unlock( &gstWarmMutex );
+
+	if( !bParked )
+	{
+		NX_V4l2DecClose( hCodec );
+	}
+
+	// the closed handle freed an instance the refill may have waited for
+	if( bRefill )
+	{
+		ScheduleRefill( codecType );
+	}
+}
+
+void WarmPoolPrewarm( gint codecType, gint count )
+{
+	NX_WARM_ENTRY *pEntry;
+
+	count = CLAMP( count, 0, NX_WARM_MAX_HANDLES );
+	if( 0 == count )
+		return;
+
+	pthread_mutex_lock( &gstWarmMutex );
+	pEntry = GetEntry( codecType, TRUE );
+	pEntry->requests[count]++;
+	UpdateTarget( pEntry );
+	pthread_mutex_unlock( &gstWarmMutex );
+
+	ScheduleRefill( codecType );
+}
+
+//
+//	Withdraws a request of WarmPoolPrewarm(). Handles parked beyond the
+//	largest request left are closed, the last request gone closes all of
+//	the codec's.
+//
+void WarmPoolUnprewarm( gint codecType, gint count )
+{
+	NX_WARM_ENTRY *pEntry;
+	GQueue surplus = G_QUEUE_INIT;
+
+	count = CLAMP( count, 0, NX_WARM_MAX_HANDLES );
+	if( 0 == count )
+		return;
+
+	pthread_mutex_lock( &gstWarmMutex );
+	pEntry = GetEntry( codecType, FALSE );
+	if( pEntry && (0 < pEntry->requests[count]) )
+	{
+		pEntry->requests[count]--;
+		UpdateTarget( pEntry );
+		TakeParked( pEntry, pEntry->target, &surplus );
+	}
+	pthread_mutex_unlock( &gstWarmMutex );
+
+	CloseHandles( &surplus );
+}
@@ -0,0 +1,36 @@
+#include <gst/gst.h>
+#include <nx_video_api.h>
+
+#ifndef __WARM_H__
+#define __WARM_H__
+
+G_BEGIN_DECLS
+
+#define	NX_WARM_MAX_HANDLES		4		// parked handles of all codecs together
+
+//
+//	Process-wide pool of opened hardware handles.
+//
+//	A handle which was opened but never initialized for a stream is parked
+//	here when its decoder lets go of it, keyed by codec, and the next open
+//	of that codec takes it instead of opening the device again.
+//	WarmPoolPrewarm() opens handles ahead of the first stream and keeps
+//	that many parked for the codec, refilled in the background as streams
+//	take them, until the request is withdrawn by WarmPoolUnprewarm(); the
+//	largest request still standing is kept. Parked handles hold hardware
+//	instances, so only a few are kept, and an open which finds the device
+//	out of instances closes the ones parked for other codecs and tries
+//	again.
+//
+//	Initialized handles are always closed: NX_V4l2DecInit() sizes the
+//	capture buffers from the sequence header of its stream and cannot be
+//	run again for another one.
+//
+NX_V4L2DEC_HANDLE WarmPoolOpen( gint codecType );
+void WarmPoolClose( gint codecType, NX_V4L2DEC_HANDLE hCodec, gboolean bFresh );
+void WarmPoolPrewarm( gint codecType, gint count );
+void WarmPoolUnprewarm( gint codecType, gint count );
+
+G_END_DECLS
+
+#endif //__WARM_H__
@@ -0,0 +1,427 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include <gst/gst.h>
+
+#include "copy.h"
+
+//
+//	Runs CopyPlane() of every kernel compiled in against a scalar reference,
+//	over odd widths, odd and padded strides, the ALIGN(16)/ALIGN(32) strides
+//	of the capture buffers and misaligned row heads. The kernel is picked
+//	once per process, so the test runs itself again for each kernel with
+//	NX_VDEC_COPY_KERNEL set; a kernel the CPU lacks is skipped.
+//
+//	A scaled interlaced plane has to come out as the scaled de-interlaced
+//	plane: CopyPlanes() doing both at once and the two passes are compared
+//	to a scalar de-interlacer and box filter, so are the passes alone.
+//
+//	The CopyPlanes() checks run a second time with every picture cut into
+//	bands for the copy helpers, which must take the caller's scheduling
+//	attributes.
+//
+
+#define	EXIT_SKIP		77		// automake's skip status
+#define	GUARD_BYTE		0xa5
+#define	GUARD_SIZE		64
+
+static const gchar *gpKernels[] = { "c", "sse2", "avx2", "neon" };
+
+static const gint gstWidths[] = { 1, 2, 3, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 128, 129, 255, 257, 719, 1281, 1921 };
+static const gint gstHeights[] = { 1, 2, 5 };
+
+// the copy helpers take the caller's scheduling attributes; thread.c
+// needs the plugin, so these stand in for it and only count
+static NX_THREAD_ATTR gstCallerAttr;
+static gint gstAttrApplied = 0;
+
+void ThreadAttrGetCurrent( NX_THREAD_ATTR *pAttr )
+{
+	*pAttr = gstCallerAttr;
+}
+
+gint ThreadAttrApply( const NX_THREAD_ATTR *pAttr )
+{
+	g_atomic_int_inc( &gstAttrApplied );
+
+	return 0;
+}
+
+static void RefCopy( guint8 *pDst, gint dstStride, const guint8 *pSrc, gint srcStride, gint width, gint height )
+{
+	gint x, y;
+
+	for( y=0 ; y<height ; y++ )
+	{
+		for( x=0 ; x<width ; x++ )
+		{
+			pDst[(gsize)y * dstStride + x] = pSrc[(gsize)y * srcStride + x];
+		}
+	}
+}
+
+static gboolean CheckLayout( GRand *pRand, gint width, gint height, gint srcStride, gint srcOffset, gint dstStride, gint dstOffset )
+{
+	gsize srcSize = (gsize)srcOffset + (gsize)srcStride * height + GUARD_SIZE;
+	gsize dstSize = (gsize)dstOffset + (gsize)dstStride * height + GUARD_SIZE;
+	guint8 *pSrc = g_malloc( srcSize );
+	guint8 *pDst = g_malloc( dstSize );
+	guint8 *pRef = g_malloc( dstSize );
+	gboolean bOk;
+	gsize i;
+
+	for( i=0 ; i<srcSize ; i++ )
+	{
+		pSrc[i] = (guint8)g_rand_int( pRand );
+	}
+	memset( pDst, GUARD_BYTE, dstSize );
+	memset( pRef, GUARD_BYTE, dstSize );
+
+	CopyPlane( pDst + dstOffset, dstStride, pSrc + srcOffset, srcStride, width, height );
+	RefCopy( pRef + dstOffset, dstStride, pSrc + srcOffset, srcStride, width, height );
+
+	// the padding between rows and past the last one stays untouched too
+	bOk = (0 == memcmp( pDst, pRef, dstSize ));
+	if( !bOk )
+	{
+		fprintf( stderr, "%s: %dx%d, src stride %d + %d, dst stride %d + %d differs from the reference\n",
+			CopyKernelName(), width, height, srcStride, srcOffset, dstStride, dstOffset );
+	}
+
+	g_free( pSrc );
+	g_free( pDst );
+	g_free( pRef );
+
+	return bOk;
+}
+
+// bob rebuilds the dropped field from its neighbours, blend filters 1/4, 1/2, 1/4
+static void RefDeinterlace( guint8 *pDst, const guint8 *pSrc, gint srcStride, gint width, gint height, gint deinterlace )
+{
+	gint keep = (NX_COPY_DEINT_BOB_BOTTOM == deinterlace) ? 1 : 0;
+	const guint8 *pPrev, *pCur, *pNext;
+	gint x, y, a;
+
+	for( y=0 ; y<height ; y++ )
+	{
+		// mirrored at the edges
+		pCur = pSrc + (gsize)y * srcStride;
+		pPrev = pSrc + (gsize)((0 < y) ? y - 1 : MIN( 1, height - 1 )) * srcStride;
+		pNext = pSrc + (gsize)((y < height - 1) ? y + 1 : MAX( 0, height - 2 )) * srcStride;
+
+		for( x=0 ; x<width ; x++ )
+		{
+			a = (pPrev[x] + pNext[x] + 1) >> 1;
+			if( NX_COPY_DEINT_BLEND == deinterlace )
+				pDst[(gsize)y * width + x] = (guint8)((a + pCur[x] + 1) >> 1);
+			else if( ((y & 1) == keep) || (1 == height) )
+				pDst[(gsize)y * width + x] = pCur[x];
+			else
+				pDst[(gsize)y * width + x] = (guint8)a;
+		}
+	}
+}
+
+// every output sample is the rounded mean of the source samples under it
+static void RefScale( guint8 *pDst, gint width, gint height, const guint8 *pSrc, gint srcWidth, gint srcHeight, gint pixelStride )
+{
+	gint dstPixels = width / pixelStride;
+	gint srcPixels = srcWidth / pixelStride;
+	gint x, y, c, sx, sy, sx0, sx1, sy0, sy1;
+	guint32 sum, n;
+
+	for( y=0 ; y<height ; y++ )
+	{
+		sy0 = (gint)((gint64)y * srcHeight / height);
+		sy1 = MAX( sy0 + 1, (gint)((gint64)(y + 1) * srcHeight / height) );
+
+		for( x=0 ; x<dstPixels ; x++ )
+		{
+			sx0 = (gint)((gint64)x * srcPixels / dstPixels);
+			sx1 = MAX( sx0 + 1, (gint)((gint64)(x + 1) * srcPixels / dstPixels) );
+			n = (sx1 - sx0) * (sy1 - sy0);
+
+			for( c=0 ; c<pixelStride ; c++ )
+			{
+				sum = 0;
+				for( sy=sy0 ; sy<sy1 ; sy++ )
+				for( sx=sx0 ; sx<sx1 ; sx++ )
+				{
+					sum += pSrc[(gsize)sy * srcWidth + sx * pixelStride + c];
+				}
+				pDst[(gsize)y * width + x * pixelStride + c] = (guint8)((sum + n / 2) / n);
+			}
+		}
+	}
+}
+
+// a picture of three planes, cut into bands unless it is below the minimum size
+static gboolean CheckPlanes( GRand *pRand, gint width, gint height )
+{
+	NX_COPY_PLANE planes[3];
+	gint heights[3] = { height, (height + 1) / 2, (height + 3) / 4 };
+	gsize srcOffset[3], dstOffset[3];
+	gsize srcSize = 0, dstSize = GUARD_SIZE;
+	guint8 *pSrc, *pDst, *pRef;
+	gboolean bOk;
+	gsize i;
+	gint p;
+
+	memset( planes, 0, sizeof(planes) );
+	for( p=0 ; p<3 ; p++ )
+	{
+		planes[p].width = width;
+		planes[p].height = heights[p];
+		planes[p].srcStride = GST_ROUND_UP_32( width ) + 32 * p;
+		planes[p].dstStride = width + p;
+		srcOffset[p] = srcSize;
+		dstOffset[p] = dstSize;
+		srcSize += (gsize)planes[p].srcStride * heights[p];
+		dstSize += (gsize)planes[p].dstStride * heights[p] + GUARD_SIZE;
+	}
+
+	pSrc = g_malloc( srcSize );
+	pDst = g_malloc( dstSize );
+	pRef = g_malloc( dstSize );
+	for( i=0 ; i<srcSize ; i++ )
+	{
+		pSrc[i] = (guint8)g_rand_int( pRand );
+	}
+	memset( pDst, GUARD_BYTE, dstSize );
+	memset( pRef, GUARD_BYTE, dstSize );
+
+	for( p=0 ; p<3 ; p++ )
+	{
+		planes[p].pSrc = pSrc + srcOffset[p];
+		planes[p].pDst = pDst + dstOffset[p];
+		RefCopy( pRef + dstOffset[p], planes[p].dstStride, planes[p].pSrc, planes[p].srcStride, width, heights[p] );
+	}
+	CopyPlanes( planes, 3 );
+
+	bOk = (0 == memcmp( pDst, pRef, dstSize ));
+	if( !bOk )
+	{
+		fprintf( stderr, "%s: planes of %dx%d differ from the reference\n", CopyKernelName(), width, height );
+	}
+
+	g_free( pSrc );
+	g_free( pDst );
+	g_free( pRef );
+
+	return bOk;
+}
+
+static gboolean CheckScaledDeinterlace( GRand *pRand, gint deinterlace, gint pixelStride, gint srcWidth, gint srcHeight, gint width, gint height )
+{
+	gint srcStride = GST_ROUND_UP_32( srcWidth * pixelStride );
+	guint8 *pSrc = g_malloc( (gsize)srcStride * srcHeight );
+	guint8 *pProg = g_malloc( (gsize)srcWidth * pixelStride * srcHeight );
+	guint8 *pRefProg = g_malloc( (gsize)srcWidth * pixelStride * srcHeight );
+	guint8 *pRef = g_malloc( (gsize)width * pixelStride * height );
+	guint8 *pTwo = g_malloc( (gsize)width * pixelStride * height );
+	guint8 *pDst = g_malloc( (gsize)width * pixelStride * height );
+	NX_COPY_PLANE plane;
+	gboolean bOk = TRUE;
+	gint i;
+
+	for( i=0 ; i<srcStride * srcHeight ; i++ )
+	{
+		pSrc[i] = (guint8)g_rand_int( pRand );
+	}
+
+	memset( &plane, 0, sizeof(plane) );
+	plane.pDst = pProg;
+	plane.dstStride = srcWidth * pixelStride;
+	plane.pSrc = pSrc;
+	plane.srcStride = srcStride;
+	plane.width = srcWidth * pixelStride;
+	plane.height = srcHeight;
+	plane.pixelStride = pixelStride;
+	plane.deinterlace = deinterlace;
+	CopyPlanes( &plane, 1 );
+
+	RefDeinterlace( pRefProg, pSrc, srcStride, srcWidth * pixelStride, srcHeight, deinterlace );
+	RefScale( pRef, width * pixelStride, height, pRefProg, srcWidth * pixelStride, srcHeight, pixelStride );
+
+	plane.pDst = pTwo;
+	plane.dstStride = width * pixelStride;
+	plane.pSrc = pProg;
+	plane.srcStride = srcWidth * pixelStride;
+	plane.width = width * pixelStride;
+	plane.height = height;
+	plane.srcWidth = srcWidth * pixelStride;
+	plane.srcHeight = srcHeight;
+	plane.deinterlace = NX_COPY_DEINT_NONE;
+	CopyPlanes( &plane, 1 );
+
+	plane.pDst = pDst;
+	plane.pSrc = pSrc;
+	plane.srcStride = srcStride;
+	plane.deinterlace = deinterlace;
+	CopyPlanes( &plane, 1 );
+
+	if( memcmp( pProg, pRefProg, (gsize)srcWidth * pixelStride * srcHeight ) )
+	{
+		fprintf( stderr, "%s: de-interlace %d of %dx%d (pixel stride %d) differs from the reference\n",
+			CopyKernelName(), deinterlace, srcWidth, srcHeight, pixelStride );
+		bOk = FALSE;
+	}
+	if( memcmp( pTwo, pRef, (gsize)width * pixelStride * height ) )
+	{
+		fprintf( stderr, "%s: de-interlace %d, then scaling %dx%d (pixel stride %d) to %dx%d differs from the reference\n",
+			CopyKernelName(), deinterlace, srcWidth, srcHeight, pixelStride, width, height );
+		bOk = FALSE;
+	}
+	if( memcmp( pDst, pRef, (gsize)width * pixelStride * height ) )
+	{
+		fprintf( stderr, "%s: scaled de-interlace %d, %dx%d (pixel stride %d) to %dx%d differs from the reference\n",
+			CopyKernelName(), deinterlace, srcWidth, srcHeight, pixelStride, width, height );
+		bOk = FALSE;
+	}
+
+	g_free( pSrc );
+	g_free( pProg );
+	g_free( pRefProg );
+	g_free( pRef );
+	g_free( pTwo );
+	g_free( pDst );
+
+	return bOk;
+}
+
+// the CopyPlanes() checks, returns the number of failures
+static gint CheckCopyPlanes( GRand *pRand )
+{
+	static const gint deinterlace[] = { NX_COPY_DEINT_BOB_TOP, NX_COPY_DEINT_BOB_BOTTOM, NX_COPY_DEINT_BLEND };
+	static const gint heights[] = { 1, 2, 5, 37, 240 };
+	gint i, h, ps;
+	gint failed = 0;
+
+	for( i=0 ; i<(gint)G_N_ELEMENTS( gstWidths ) ; i++ )
+	for( h=0 ; h<(gint)G_N_ELEMENTS( heights ) ; h++ )
+	{
+		if( !CheckPlanes( pRand, gstWidths[i], heights[h] ) )
+		{
+			failed++;
+		}
+	}
+
+	for( i=0 ; i<(gint)G_N_ELEMENTS( deinterlace ) ; i++ )
+	for( ps=1 ; ps<=2 ; ps++ )
+	{
+		if( !CheckScaledDeinterlace( pRand, deinterlace[i], ps, 64, 36, 32, 18 ) ||
+			!CheckScaledDeinterlace( pRand, deinterlace[i], ps, 719, 241, 360, 60 ) ||
+			!CheckScaledDeinterlace( pRand, deinterlace[i], ps, 33, 2, 17, 1 ) )
+		{
+			failed++;
+		}
+	}
+
+	return failed;
+}
+
+static gint RunKernel( const gchar *pKernel )
+{
+	GRand *pRand;
+	gint srcStrides[4], dstStrides[4];
+	gint w, h, s, d, srcOffset, dstOffset, width;
+	gint failed = 0;
+
+	if( strcmp( CopyKernelName(), pKernel ) )
+	{
+		printf( "kernel %s: not supported here, skipped\n", pKernel );
+		return EXIT_SKIP;
+	}
+
+	pRand = g_rand_new_with_seed( 0x4e58 );
+
+	for( w=0 ; w<(gint)G_N_ELEMENTS( gstWidths ) ; w++ )
+	{
+		width = gstWidths[w];
+
+		srcStrides[0] = width;
+		srcStrides[1] = width + 7;
+		srcStrides[2] = GST_ROUND_UP_16( width );
+		srcStrides[3] = GST_ROUND_UP_32( width );
+		dstStrides[0] = width;
+		dstStrides[1] = width + 3;
+		dstStrides[2] = GST_ROUND_UP_16( width );
+		dstStrides[3] = GST_ROUND_UP_32( width );
+
+		for( h=0 ; h<(gint)G_N_ELEMENTS( gstHeights ) ; h++ )
+		for( s=0 ; s<4 ; s++ )
+		for( d=0 ; d<4 ; d++ )
+		for( srcOffset=0 ; srcOffset<=3 ; srcOffset+=3 )
+		for( dstOffset=0 ; dstOffset<=17 ; dstOffset+=(dstOffset ? 16 : 1) )
+		{
+			if( !CheckLayout( pRand, width, gstHeights[h], srcStrides[s], srcOffset, dstStrides[d], dstOffset ) )
+			{
+				failed++;
+			}
+		}
+	}
+
+	// small pictures stay on the caller
+	failed += CheckCopyPlanes( pRand );
+
+	// and now every picture in bands, on helpers working for a caller
+	// with attributes of its own
+	CopyPoolSetMinSize( 0 );
+	CopyPoolSetThreads( 3 );
+	gstCallerAttr.serial = 1;
+	failed += CheckCopyPlanes( pRand );
+	if( 0 == g_atomic_int_get( &gstAttrApplied ) )
+	{
+		fprintf( stderr, "%s: the copy helpers did not take the caller's attributes\n", pKernel );
+		failed++;
+	}
+	CopyPoolSetMinSize( NX_COPY_MIN_SIZE_DEFAULT );
+	CopyPoolSetThreads( NX_COPY_THREADS_AUTO );
+
+	g_rand_free( pRand );
+
+	printf( "kernel %s: %s\n", pKernel, failed ? "FAILED" : "ok" );
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main( int argc, char *argv[] )
+{
+	const gchar *pKernel = g_getenv( "NX_VDEC_COPY_KERNEL" );
+	gchar *pArgv[] = { argv[0], NULL };
+	gchar **ppEnv;
+	gint status, ret = EXIT_SUCCESS;
+	GError *pError = NULL;
+	guint i;
+
+	gst_init( &argc, &argv );
+
+	if( pKernel )
+	{
+		return RunKernel( pKernel );
+	}
+
+	for( i=0 ; i<G_N_ELEMENTS( gpKernels ) ; i++ )
+	{
+		ppEnv = g_environ_setenv( g_get_environ(), "NX_VDEC_COPY_KERNEL", gpKernels[i], TRUE );
+		if( !g_spawn_sync( NULL, pArgv, ppEnv, G_SPAWN_CHILD_INHERITS_STDIN, NULL, NULL, NULL, NULL, &status, &pError ) )
+		{
+			fprintf( stderr, "cannot run the %s kernel: %s\n", gpKernels[i], pError->message );
+			g_clear_error( &pError );
+			ret = EXIT_FAILURE;
+		}
+		else if( !WIFEXITED( status ) || ((EXIT_SUCCESS != WEXITSTATUS( status )) && (EXIT_SKIP != WEXITSTATUS( status ))) )
+		{
+			ret = EXIT_FAILURE;
+		}
+		g_strfreev( ppEnv );
+	}
+
+	return ret;
+}
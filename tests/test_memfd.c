@@ -0,0 +1,148 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/video/gstvideopool.h>
+#include <gst/allocators/gstfdmemory.h>
+
+#include "gstnxmemfdallocator.h"
+
+//
+//	Host test of the memfd allocator: its memories are fd memories whose
+//	fd reads back what was written through the mapping and the other way
+//	round, which cannot be resized, and which a video buffer pool recycles
+//	instead of creating a memfd per frame.
+//
+
+#ifndef F_GET_SEALS
+#define	F_GET_SEALS			1034
+#define	F_SEAL_SHRINK		0x0002
+#define	F_SEAL_GROW			0x0004
+#endif
+
+#define	CHECK(cond)		do { if( !(cond) ) { fprintf( stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond ); return FALSE; } } while(0)
+
+#define	TEST_SIZE		(3 * 4096 + 100)
+#define	TEST_PREFIX		16
+
+static gboolean TestMemory( GstAllocator *pAllocator )
+{
+	GstAllocationParams params;
+	GstMemory *pMem;
+	GstMapInfo mapInfo;
+	guint8 *pData = g_malloc( TEST_SIZE );
+	gsize offset, maxSize;
+	gint fd, seals, i;
+
+	gst_allocation_params_init( &params );
+	params.prefix = TEST_PREFIX;
+	pMem = gst_allocator_alloc( pAllocator, TEST_SIZE, &params );
+	CHECK( NULL != pMem );
+	CHECK( gst_is_fd_memory( pMem ) );
+	CHECK( TEST_SIZE == gst_memory_get_sizes( pMem, &offset, &maxSize ) );
+	CHECK( TEST_PREFIX == offset );
+	CHECK( TEST_PREFIX + TEST_SIZE <= maxSize );
+
+	fd = gst_fd_memory_get_fd( pMem );
+	CHECK( 0 <= fd );
+
+	// written through the mapping, read through the fd
+	CHECK( gst_memory_map( pMem, &mapInfo, GST_MAP_WRITE ) );
+	for( i=0 ; i<TEST_SIZE ; i++ )
+	{
+		mapInfo.data[i] = (guint8)(i * 7 + 1);
+	}
+	gst_memory_unmap( pMem, &mapInfo );
+
+	CHECK( TEST_SIZE == pread( fd, pData, TEST_SIZE, TEST_PREFIX ) );
+	for( i=0 ; i<TEST_SIZE ; i++ )
+	{
+		CHECK( (guint8)(i * 7 + 1) == pData[i] );
+	}
+
+	// and the other way round, the mapping is shared
+	for( i=0 ; i<TEST_SIZE ; i++ )
+	{
+		pData[i] = (guint8)(i * 3 + 5);
+	}
+	CHECK( TEST_SIZE == pwrite( fd, pData, TEST_SIZE, TEST_PREFIX ) );
+	CHECK( gst_memory_map( pMem, &mapInfo, GST_MAP_READ ) );
+	CHECK( 0 == memcmp( mapInfo.data, pData, TEST_SIZE ) );
+	gst_memory_unmap( pMem, &mapInfo );
+
+	// sealed, a receiver may map it without guarding against SIGBUS
+	seals = fcntl( fd, F_GET_SEALS );
+	CHECK( 0 <= seals );
+	CHECK( (F_SEAL_SHRINK | F_SEAL_GROW) == (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) );
+	CHECK( 0 != ftruncate( fd, (off_t)maxSize / 2 ) );
+	CHECK( 0 != ftruncate( fd, (off_t)maxSize * 2 ) );
+
+	gst_memory_unref( pMem );
+	g_free( pData );
+
+	return TRUE;
+}
+
+static gboolean TestPool( GstAllocator *pAllocator )
+{
+	GstBufferPool *pPool = gst_video_buffer_pool_new();
+	GstCaps *pCaps = gst_caps_from_string( "video/x-raw,format=I420,width=64,height=48" );
+	GstStructure *pConfig;
+	GstVideoInfo info;
+	GstBuffer *pBuf0 = NULL, *pBuf1 = NULL, *pBuf = NULL;
+	GstMemory *pMem0;
+
+	CHECK( gst_video_info_from_caps( &info, pCaps ) );
+
+	pConfig = gst_buffer_pool_get_config( pPool );
+	gst_buffer_pool_config_set_params( pConfig, pCaps, (guint)GST_VIDEO_INFO_SIZE( &info ), 2, 2 );
+	gst_buffer_pool_config_set_allocator( pConfig, pAllocator, NULL );
+	CHECK( gst_buffer_pool_set_config( pPool, pConfig ) );
+	CHECK( gst_buffer_pool_set_active( pPool, TRUE ) );
+
+	CHECK( GST_FLOW_OK == gst_buffer_pool_acquire_buffer( pPool, &pBuf0, NULL ) );
+	CHECK( GST_FLOW_OK == gst_buffer_pool_acquire_buffer( pPool, &pBuf1, NULL ) );
+	CHECK( gst_is_fd_memory( gst_buffer_peek_memory( pBuf0, 0 ) ) );
+	CHECK( gst_buffer_peek_memory( pBuf0, 0 )->allocator == pAllocator );
+	CHECK( gst_fd_memory_get_fd( gst_buffer_peek_memory( pBuf0, 0 ) ) !=
+		gst_fd_memory_get_fd( gst_buffer_peek_memory( pBuf1, 0 ) ) );
+
+	// a released buffer comes back with the same memfd
+	pMem0 = gst_buffer_peek_memory( pBuf0, 0 );
+	gst_buffer_unref( pBuf0 );
+	CHECK( GST_FLOW_OK == gst_buffer_pool_acquire_buffer( pPool, &pBuf, NULL ) );
+	CHECK( gst_buffer_peek_memory( pBuf, 0 ) == pMem0 );
+
+	gst_buffer_unref( pBuf );
+	gst_buffer_unref( pBuf1 );
+	CHECK( gst_buffer_pool_set_active( pPool, FALSE ) );
+	gst_object_unref( pPool );
+	gst_caps_unref( pCaps );
+
+	return TRUE;
+}
+
+int main( int argc, char *argv[] )
+{
+	GstAllocator *pAllocator;
+	gboolean bOk;
+
+	gst_init( &argc, &argv );
+
+	pAllocator = gst_nxmemfd_allocator_new();
+	bOk = TestMemory( pAllocator ) && TestPool( pAllocator );
+	gst_object_unref( pAllocator );
+
+	printf( "memfd allocator: %s\n", bOk ? "ok" : "FAILED" );
+
+	return bOk ? EXIT_SUCCESS : EXIT_FAILURE;
+}